@@ -2,6 +2,7 @@
 #define MONO_MUSIC_MANAGER__BITSET_H
 
 #include <bitset>
+#include <climits>
 #include <concepts>
 #include <type_traits>
 
@@ -9,16 +10,16 @@
 namespace Momuma
 {
 
-// a bitset based on a type
+// a bitset based on a type, with one bit per bit of `T`
 template<typename T>
-struct Bitset : public std::bitset<sizeof(T)>
+struct Bitset : public std::bitset<sizeof(T) * CHAR_BIT>
 {
 	using Unsigned = std::make_unsigned_t<T>;
 	using Signed = std::make_signed_t<T>;
 	
 	constexpr inline
 	Bitset(const T val) :
-		std::bitset<sizeof (T)> { static_cast<Unsigned>(val) }
+		std::bitset<sizeof(T) * CHAR_BIT> { static_cast<Unsigned>(val) }
 	{}
 	
 	[[nodiscard]] constexpr inline
@@ -30,4 +31,4 @@ struct Bitset : public std::bitset<sizeof(T)>
 
 }
 
-#endif /* UTILS__BITSET_H */
+#endif /* MONO_MUSIC_MANAGER__BITSET_H */
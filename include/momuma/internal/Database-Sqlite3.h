@@ -2,10 +2,16 @@
 #define MONO_MUSIC_MANAGER__INTERNAL__DATABASE_SQLITE3_H
 
 #define SQLITE_OMIT_DEPRECATED
+#include <chrono>
 #include <filesystem>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <sigc++/slot.h>
 #include <sqlite3.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 
@@ -16,6 +22,179 @@ namespace fs = std::filesystem;
 enum class IterFlag : bool { STOP = false, NEXT = !STOP, };
 enum class StorageType { DISK, MEMORY };
 
+/* #File names of a playlist, stored back to back in a single buffer.
+! Name `i` is `arena[offsets[i], offsets[i + 1])`, the views stay valid until the batch
+is modified. `indexes[i]` is its stored position, which may have gaps.
+*/
+struct MediaBatch
+{
+	std::string arena;
+	std::vector<size_t> offsets; // `size() + 1` elements, empty when there are no names
+	std::vector<int64_t> indexes;
+	
+	[[nodiscard]] inline size_t size(void) const
+	{
+		return offsets.empty() ? 0 : offsets.size() - 1;
+	}
+	[[nodiscard]] inline bool empty(void) const { return this->size() == 0; }
+	
+	[[nodiscard]] inline std::string_view operator[](const size_t i) const
+	{
+		return std::string_view(arena).substr(offsets[i], offsets[i + 1] - offsets[i]);
+	}
+	
+	inline void clear(void)
+	{
+		arena.clear();
+		offsets.clear();
+		indexes.clear();
+	}
+};
+
+// A file found by `Sqlite3::search_media()`.
+struct SearchHit
+{
+	std::string playlist;
+	std::string name; // stored name, see `Sqlite3::get_media_names()`
+	int64_t index; // stored position inside of `playlist`
+};
+
+// A change to the playlists folder, applied by `Sqlite3::apply_file_changes()`.
+struct FileChange
+{
+	enum class Kind {
+		ADD_FILE, /* appends `name` to `playlist` */
+		REMOVE_FILE, /* removes `name` from `playlist` */
+		RENAME_FILE, /* renames `name` to `newName` inside of `playlist`, replacing `newName` */
+		ADD_PLAYLIST, /* creates `playlist` */
+		REMOVE_PLAYLIST, /* removes `playlist` with all of its files */
+		RENAME_PLAYLIST, /* renames `playlist` to `newName` */
+	};
+	
+	Kind kind;
+	std::string playlist;
+	fs::path name = {}; // stored name of the file, relative to the playlist's folder
+	fs::path newName = {};
+};
+
+// Identifies one version of a file, any modification changes `size` or `mtime`.
+struct FileStamp
+{
+	fs::path path;
+	int64_t size;
+	int64_t mtime; // nanoseconds since the epoch of `fs::file_time_type`
+	
+	// #Reads the stamp of the file at `path`, nothing if it can't be accessed.
+	[[nodiscard]] static std::optional<FileStamp> of(const fs::path &path);
+};
+
+/* #Tags of a media file, as stored by `Sqlite3::set_media_tags()`.
+! The text isn't owned, it must stay valid until it's stored. Empty fields are unknown.
+*/
+struct MediaTags
+{
+	std::string_view title;
+	std::string_view artist;
+	std::string_view albumArtist; // groups compilations, `artist` is used when it's empty
+	std::string_view album;
+	std::string_view genre;
+	int64_t track = 0; // position inside of the album
+	int64_t year = 0;
+};
+
+// Tags read back by `Sqlite3::get_media_tags()`, empty fields are unknown.
+struct StoredTags
+{
+	std::string title;
+	std::string artist;
+	std::string albumArtist; // artist the album is stored under, see `MediaTags::albumArtist`
+	std::string album;
+	std::string genre;
+	int64_t track = 0;
+	int64_t year = 0;
+};
+
+// A finished playback of a media file, see `Sqlite3::add_play_events()`.
+struct PlayEvent
+{
+	enum class Kind { PLAYED, SKIPPED };
+	
+	fs::path path;
+	Kind kind;
+	std::chrono::system_clock::time_point time; // when the playback ended
+	std::chrono::microseconds position; // where the playback ended
+};
+
+// Statistics of a media file, kept up to date by `Sqlite3::add_play_events()`.
+struct PlayStats
+{
+	int64_t playCount = 0;
+	int64_t skipCount = 0;
+	std::optional<std::chrono::system_clock::time_point> lastPlayed; // empty if never played
+};
+
+/* #Per-connection cache of prepared statements, keyed by their SQL text.
+! A statement is taken out of the cache while it's in use, so the same query can run
+more than once at a time (e.g. from inside of a callback) without sharing a `sqlite3_stmt`.
+*/
+class StmtCache
+{
+public:
+	StmtCache(void) = default;
+	StmtCache(StmtCache &&other);
+	~StmtCache(void);
+	
+	StmtCache(const StmtCache&) = delete;
+	StmtCache& operator=(const StmtCache&) = delete;
+	
+	/* #Takes a statement for `query` out of the cache, preparing a new one if none is free.
+	! @param stmt: receives the prepared statement, `nullptr` on failure.
+	! @return: `SQLITE_OK`, or the error code returned by `sqlite3_prepare_v2()`.
+	*/
+	[[nodiscard]] int acquire(sqlite3 *db, const std::string &query, sqlite3_stmt *&stmt);
+	
+	// #Resets `stmt`, clears its bindings and puts it back into the cache.
+	void release(sqlite3_stmt *stmt);
+	
+	// #Finalizes all cached statements. Must be called before closing the connection.
+	void clear(void);
+	
+private:
+	struct Hash : std::hash<std::string_view>
+	{
+		using is_transparent = void;
+	};
+	
+	std::mutex m_mutex;
+	std::unordered_map<std::string, std::vector<sqlite3_stmt*>, Hash, std::equal_to<>> m_free;
+};
+
+class ConnectionPool;
+struct ReadConnection;
+
+/* #A read connection kept by one thread, see `Sqlite3::reserve_reader()`.
+! Must be destroyed by the thread which reserved it, before the database.
+*/
+class ReservedReader
+{
+public:
+	~ReservedReader(void);
+	
+	ReservedReader(const ReservedReader&) = delete;
+	ReservedReader& operator=(const ReservedReader&) = delete;
+	
+	// `false` if no read connection was free, queries use the shared ones.
+	[[nodiscard]] explicit operator bool(void) const;
+	
+private:
+	friend class Sqlite3;
+	
+	ConnectionPool *const m_pool;
+	ReadConnection *const m_conn;
+	
+	ReservedReader(ConnectionPool *pool, ReadConnection *conn);
+};
+
 class Sqlite3
 {
 public:
@@ -26,8 +205,15 @@ public:
 	/* #Creates (if doesn't already exist) new database inside of the folder `fullFolderPath`.
 	! @param fullFolderPath: path to the root folder of the database, created if doesn't exist.
 	! @param storage: store the database on disk or in memory.
+	! @param readers: number of read-only connections shared by the query methods. When
+	non-zero the database is switched to WAL mode, so that queries from several threads
+	run in parallel and don't wait for writes. Ignored for `StorageType::MEMORY`. Without a
+	free reader, queries use the writer connection and wait for the running transaction.
 	*/
-	Sqlite3(const fs::path &fullFolderPath, StorageType storage = StorageType::DISK);
+	Sqlite3(
+		const fs::path &fullFolderPath,
+		StorageType storage = StorageType::DISK, unsigned readers = 0
+	);
 	
 	Sqlite3(Sqlite3&&);
 	
@@ -35,9 +221,23 @@ public:
 	
 	[[nodiscard]] explicit operator bool(void) const;
 	
+	/* #Takes a read connection out of the pool for the queries of the calling thread.
+	! A thread running many queries next to the application's writes, like a background
+	loader, neither waits for a free reader nor for the writer connection.
+	! @return: an empty reservation when no reader is free (always without readers), or if
+	the thread already has one.
+	*/
+	[[nodiscard]] ReservedReader reserve_reader(void);
+	
 	// #Returns the full path to the database's root folder.
 	fs::path get_database_location(void) noexcept;
 	
+	// #Returns the full path to the folder containing a folder for each playlist.
+	fs::path get_playlists_location(void) noexcept;
+	
+	// #Returns the full path to the folder of `playlist`.
+	fs::path get_playlist_location(const std::string &playlist);
+	
 	/* #Queries the names of saved playlists.
 	! @param callback: callback function which will receive `std::string` s in
 	the stored playing order. The callback can return `false` to stop half-way.
@@ -61,21 +261,157 @@ public:
 	! @param playlist: name of a playlist to extract the media from.
 	! @param callback: callback function which will receive `FilePath` s in
 	the stored playing order. The callback can return `false` to stop half-way.
+	! Rows are read in small chunks between the calls, so stopping skips reading the others.
 	! @return: the number of times `callback()` was called. `-1` on failure.
 	*/
 	int get_media_paths(
 		const std::string &playlist, sigc::slot<IterFlag(fs::path)> callback
 	);
 	
+	/* #Queries the stored names of a playlist's media files in a single pass.
+	! Names are relative to the playlist's folder (see `get_playlist_location()`), unless
+	the file is outside of it, in which case they're absolute.
+	! @param playlist: name of a playlist to extract the media from.
+	! @param batch: cleared and filled with the names in the stored playing order.
+	! @return: the number of names in `batch`. `-1` on failure.
+	*/
+	int get_media_names(const std::string &playlist, MediaBatch &batch);
+	
+	/* #Queries at most `limit` media names of a playlist, starting at a stored index.
+	! Seeks to `fromIndex` in the index instead of reading the rows before it, so any page
+	costs as much as the first one. The next page starts at `batch.indexes.back() + 1`.
+	! @param playlist: name of a playlist to extract the media from.
+	! @param fromIndex: smallest stored index to return, `0` for the first page.
+	! @param limit: maximum number of names to return.
+	! @param batch: cleared and filled like with `get_media_names()`.
+	! @return: the number of names in `batch`, less than `limit` on the last page.
+	`-1` on failure.
+	*/
+	int get_media_window(
+		const std::string &playlist, int64_t fromIndex, int limit, MediaBatch &batch
+	);
+	
+	/* #Query run by `get_media_window()`, exposed so that its plan can be checked.
+	! `?1` is the playlist, `?2` the first index and `?3` the maximum number of rows.
+	*/
+	[[nodiscard]] static const std::string& media_window_query(void);
+	
+	/* #Searches the names of all media files, best matches first.
+	! `text` matches anywhere inside of a name, ignoring ASCII case. The names are indexed by
+	trigrams, so `text` shorter than 3 characters never matches anything.
+	! The files written by `set_playlist_data()` since the last search are indexed first.
+	! @param text: text to search, no query syntax is interpreted.
+	! @param limit: maximum number of hits to return.
+	! @param hits: cleared and filled with the hits ranked by relevance.
+	! @return: the number of hits. `-1` on failure.
+	*/
+	int search_media(const std::string &text, int limit, std::vector<SearchHit> &hits);
+	
+	/* #Searches the names of all playlists, best matches first.
+	! Matches like `search_media()`.
+	! @param text: text to search, no query syntax is interpreted.
+	! @param limit: maximum number of playlists to return.
+	! @param playlists: cleared and filled with the names of the matching playlists.
+	! @return: the number of playlists. `-1` on failure.
+	*/
+	int search_playlists(
+		const std::string &text, int limit, std::vector<std::string> &playlists
+	);
+	
 	/* #Sets a list of absolute paths to media files, replacing the existing list.
-	! @param playlist: name of a playlist to modify.
+	! The whole list is replaced in a single transaction, using multi-row inserts. The files
+	are only added to the search index by the next `search_media()`, in a single query.
+	! @param playlist: name of an existing playlist to modify.
 	! @param paths: list of absolute paths to the media files. The order is preserved.
 	! @return: `true` on success. If `false` is returned, the existing list didn't change.
 	*/
 	bool set_playlist_data(const std::string &playlist, const std::vector<fs::path> &paths);
 	
+	/* #Applies `changes` in order, in a single transaction.
+	! Adding a file which is already in the playlist, or a playlist which already exists,
+	does nothing.
+	! @return: `true` on success. If `false` is returned, nothing was changed.
+	*/
+	bool apply_file_changes(const std::vector<FileChange> &changes);
+	
+	/* #Looks up the durations cached for `files`.
+	! @return: one element per file, empty when the file isn't cached or has changed since.
+	*/
+	[[nodiscard]] std::vector<std::optional<std::chrono::microseconds>>
+	get_cached_durations(const std::vector<FileStamp> &files);
+	
+	/* #Caches the durations of files, replacing older entries of the same paths.
+	! @param entries: stamps of the files at the time their duration was queried.
+	! @return: `true` on success. If `false` is returned, the cache didn't change.
+	*/
+	bool set_cached_durations(
+		const std::vector<std::pair<FileStamp, std::chrono::microseconds>> &entries
+	);
+	
+	/* #Looks up where the playback of `media` stopped, see `set_resume_points()`.
+	! @return: nothing if no position is stored, or on failure.
+	*/
+	[[nodiscard]] std::optional<std::chrono::microseconds> get_resume_point(const fs::path &media);
+	
+	/* #Stores the positions where the playback of files stopped, replacing older ones.
+	! @param entries: paths of the files with their position, a negative position removes
+	the file's resume point instead.
+	! @return: `true` on success. If `false` is returned, nothing was changed.
+	*/
+	bool set_resume_points(
+		const std::vector<std::pair<fs::path, std::chrono::microseconds>> &entries
+	);
+	
+	/* #Appends `events` to the play history and updates the statistics of their files.
+	! Meant to be called with batches of events, everything is written in a single transaction.
+	! @return: `true` on success. If `false` is returned, nothing was changed.
+	*/
+	bool add_play_events(const std::vector<PlayEvent> &events);
+	
+	/* #Looks up the statistics of `files`.
+	! @return: one element per file, all zero for files which were never played or skipped.
+	*/
+	[[nodiscard]] std::vector<PlayStats> get_play_stats(const std::vector<fs::path> &files);
+	
+	/* #Queries the last events added to the play history, most recently added first.
+	! @param limit: maximum number of events to return.
+	! @param events: cleared and filled with the events.
+	! @return: the number of events. `-1` on failure.
+	*/
+	int get_play_history(int limit, std::vector<PlayEvent> &events);
+	
+	/* #Looks up the tags stored for `files`.
+	! @return: one element per file, empty when the file isn't stored or has changed since.
+	*/
+	[[nodiscard]] std::vector<std::optional<StoredTags>>
+	get_media_tags(const std::vector<FileStamp> &files);
+	
+	/* #Stores the tags of files, replacing older entries of the same paths.
+	! Artists, albums and genres are stored once and shared by all of their files. Albums
+	are keyed by their album artist, and the names no file uses anymore are removed.
+	The text is bound without being copied.
+	! @param entries: stamps of the files at the time their tags were read.
+	! @return: `true` on success. If `false` is returned, nothing was changed.
+	*/
+	bool set_media_tags(const std::vector<std::pair<FileStamp, MediaTags>> &entries);
+	
 private:
 	const fs::path m_path;
+	StmtCache m_stmtCache;
+	std::unique_ptr<ConnectionPool> m_pool;
+	
+	/* #Serializes the use of `_handle`, must be held by every method which writes.
+	! Queries hold it as well when they fall back to `_handle`, see `ReadLease`.
+	*/
+	[[nodiscard]] std::unique_lock<std::recursive_mutex> lock_writer(void);
+	
+	// #Returns the `id` of `playlist`, nothing if it doesn't exist or on failure.
+	[[nodiscard]] std::optional<int64_t> get_playlist_id(const std::string &playlist);
+	
+	/* #Adds the files written by `set_playlist_data()` since the last search to the index.
+	! @return: `false` on failure.
+	*/
+	[[nodiscard]] bool index_deferred_files(void);
 	
 	int close_handle(void);
 };
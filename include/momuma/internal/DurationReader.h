@@ -0,0 +1,41 @@
+#ifndef MONO_MUSIC_MANAGER__INTERNAL__DURATION_READER_H
+#define MONO_MUSIC_MANAGER__INTERNAL__DURATION_READER_H
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+
+#include "MpvPlayer.h"
+
+
+namespace Momuma
+{
+
+/* #Reads the duration stored in the headers of a media file, without decoding it.
+! Supported: MP3 (Xing/Info and VBRI frames, or a constant bitrate), FLAC STREAMINFO, Ogg
+Vorbis and Opus (granule position of the last page), and PCM WAV (`fmt ` and `data` chunks).
+Like mpv, the encoder delay and padding of MP3 files are part of the duration.
+! @param data: the whole file.
+! @return: nothing if the format isn't supported or the headers are invalid.
+*/
+[[nodiscard]]
+std::optional<std::chrono::microseconds> parse_header_duration(std::span<const uint8_t> data);
+
+// #Maps the file at `media` and calls `parse_header_duration()`.
+[[nodiscard]]
+std::optional<std::chrono::microseconds> read_header_duration(const std::filesystem::path &media);
+
+/* #Reads the duration of `media` from its headers, falling back to
+`MpvPlayer::query_duration()` for unsupported files.
+! @return: the duration of the file at `media`, or -1 in case of failure.
+*/
+[[nodiscard]] std::chrono::microseconds read_duration(
+	const std::filesystem::path &media,
+	std::chrono::microseconds timeout = MpvPlayer::PROBE_TIMEOUT
+);
+
+}
+
+#endif /* MONO_MUSIC_MANAGER__INTERNAL__DURATION_READER_H */
@@ -0,0 +1,119 @@
+#ifndef MONO_MUSIC_MANAGER__INTERNAL__DURATION_SCANNER_H
+#define MONO_MUSIC_MANAGER__INTERNAL__DURATION_SCANNER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+#include "MpvPlayer.h"
+#include "momuma/sigc.h"
+
+
+namespace Momuma
+{
+
+/* #Queries the duration of media files in parallel.
+! Durations are read from the file headers when possible (see `parse_header_duration()`).
+Otherwise every worker thread owns a private `MpvPlayer` in probe mode, so scans scale with
+the number of cores instead of going through the single player of `MpvPlayer::query_duration()`.
+*/
+class DurationScanner
+{
+public:
+	struct Result
+	{
+		std::filesystem::path media;
+		std::chrono::microseconds duration; // -1 in case of failure
+	};
+	
+	/* #Starts the worker threads.
+	! @param workers: number of threads (and mpv instances), `0` to use one per core.
+	! @param timeout: time limit of each file, those exceeding it fail.
+	*/
+	explicit DurationScanner(
+		unsigned workers = 0,
+		std::chrono::microseconds timeout = MpvPlayer::PROBE_TIMEOUT
+	);
+	
+	/* #Stops the workers, queued files which weren't scanned yet are dropped.
+	! Files being scanned are abandoned, without waiting for their timeout.
+	*/
+	~DurationScanner(void);
+	
+	DurationScanner(const DurationScanner&) = delete;
+	DurationScanner& operator=(const DurationScanner&) = delete;
+	
+	[[nodiscard]] unsigned worker_count(void) const;
+	
+	/* #Queues `media` for scanning, the results are collected with `wait_result()`.
+	! Thread-safe. The results of all calls are mixed, but not with those of `scan()`.
+	*/
+	void submit(std::vector<std::filesystem::path> media);
+	
+	/* #Takes the next finished result, in order of completion.
+	! @param timeout: how long to wait for a result, negative values wait forever.
+	! @return: nothing on timeout, or when no submitted file is left without a result.
+	*/
+	[[nodiscard]] std::optional<Result> wait_result(std::chrono::microseconds timeout);
+	
+	// #Number of submitted files whose result wasn't taken yet.
+	[[nodiscard]] size_t pending(void) const;
+	
+	/* #Scans `media` and streams the results to `callback` as they complete.
+	! Thread-safe, every call only receives the results of its own files. `callback` is
+	called from the calling thread.
+	! @return: the number of times `callback()` was called.
+	*/
+	size_t scan(std::vector<std::filesystem::path> media, sigc::slot<void(const Result&)> callback);
+	
+private:
+	// Where the results of the files of one `scan()`, or of all `submit()`s, are delivered.
+	struct Channel
+	{
+		std::condition_variable cond;
+		std::deque<Result> results;
+		size_t pending = 0; // files whose result wasn't taken yet
+	};
+	
+	struct Job
+	{
+		std::filesystem::path media;
+		Channel *channel;
+	};
+	
+	mutable std::mutex m_mutex;
+	std::condition_variable m_workCond;
+	
+	std::deque<Job> m_queue;
+	Channel m_submitted; // results of `submit()`
+	bool m_stop = false;
+	std::stop_source m_stopSource; // cancels the probes in progress
+	const std::chrono::microseconds m_timeout;
+	
+	std::vector<std::thread> m_workers;
+	
+	// @param player: created by the first file needing it.
+	[[nodiscard]] std::chrono::microseconds scan_file(
+		const std::filesystem::path &media,
+		std::optional<MpvPlayer> &player
+	);
+	void run_worker(void);
+	
+	// Queues `media` with its results delivered to `channel`.
+	void enqueue(std::vector<std::filesystem::path> media, Channel &channel);
+	
+	// Takes the next result of `channel`, see `wait_result()`.
+	[[nodiscard]] std::optional<Result> take_result(
+		Channel &channel, std::chrono::microseconds timeout
+	);
+};
+
+}
+
+#endif /* MONO_MUSIC_MANAGER__INTERNAL__DURATION_SCANNER_H */
@@ -0,0 +1,92 @@
+#ifndef MONO_MUSIC_MANAGER__INTERNAL__EVENT_DISPATCHER_H
+#define MONO_MUSIC_MANAGER__INTERNAL__EVENT_DISPATCHER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#include "MpvPlayer.h"
+#include "momuma/sigc.h"
+#include "momuma/spsc_ring.h"
+
+
+namespace Momuma
+{
+
+/* #Receives the events of a player on a dedicated thread.
+! The thread sleeps until libmpv signals new events through `mpv_set_wakeup_callback()`,
+updates the player like `MpvPlayer::wait_event()` does, and hands a compact copy of every
+event to the application thread through a lock-free ring. No signal of the player is
+emitted, the application reads the records with `drain()` instead.
+! While a dispatcher exists, `MpvPlayer::wait_event()` (and the functions using it, like
+`MpvPlayer::probe_duration()`) must not be called on its player. Replies to asynchronous
+requests are resolved on the dispatcher's thread.
+*/
+class EventDispatcher
+{
+public:
+	static constexpr size_t RING_SIZE = 1024;
+	
+	// An event reduced to the fields which stay valid after the next `mpv_wait_event()`.
+	struct Record
+	{
+		mpv_event_id id;
+		int error; // `mpv_event::error`, or `mpv_event_end_file::error` of `MPV_EVENT_END_FILE`
+		uint64_t replyUserdata;
+		int64_t entryId; // `playlist_entry_id` of `MPV_EVENT_START_FILE/END_FILE`, otherwise -1
+		int endReason; // `mpv_end_file_reason` of `MPV_EVENT_END_FILE`, otherwise -1
+		MpvPlayer::State state; // state of the player after the event
+	};
+	
+	/* #Starts the thread.
+	! @param player: player whose events are received, must outlive the dispatcher.
+	*/
+	explicit EventDispatcher(MpvPlayer &player);
+	
+	// Stops the thread, records which weren't drained are dropped.
+	~EventDispatcher(void);
+	
+	EventDispatcher(const EventDispatcher&) = delete;
+	EventDispatcher& operator=(const EventDispatcher&) = delete;
+	
+	// `false` if the thread couldn't be started, in which case nothing is received.
+	[[nodiscard]] explicit operator bool(void) const;
+	
+	/* #File descriptor which is readable while records are waiting.
+	! Meant to be added to the application's main loop, `drain()` resets it.
+	*/
+	[[nodiscard]] int notify_fd(void) const;
+	
+	/* #Waits until records can be drained.
+	! @param timeout: how long to wait, negative values wait forever.
+	! @return: `false` on timeout.
+	*/
+	bool wait(std::chrono::milliseconds timeout);
+	
+	/* #Passes the waiting records to `callback`, oldest first, on the calling thread.
+	! When the ring was full, the events which didn't fit were dropped and a record of
+	`MPV_EVENT_QUEUE_OVERFLOW` follows the last record which fit.
+	! @param max: maximum number of records to drain.
+	! @return: the number of times `callback()` was called.
+	*/
+	size_t drain(sigc::slot<void(const Record&)> callback, size_t max = RING_SIZE);
+	
+private:
+	MpvPlayer &d_player;
+	
+	SpscRing<Record, RING_SIZE> m_ring;
+	int m_notifyFd = -1; // eventfd, written after a batch of records was pushed
+	
+	std::atomic<uint64_t> m_wakeups = 0; // incremented by the wakeup callback
+	std::atomic<bool> m_stop = false;
+	std::thread m_thread;
+	
+	static void on_wakeup(void *self);
+	
+	void run(void);
+};
+
+}
+
+#endif /* MONO_MUSIC_MANAGER__INTERNAL__EVENT_DISPATCHER_H */
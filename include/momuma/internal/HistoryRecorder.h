@@ -0,0 +1,114 @@
+#ifndef MONO_MUSIC_MANAGER__INTERNAL__HISTORY_RECORDER_H
+#define MONO_MUSIC_MANAGER__INTERNAL__HISTORY_RECORDER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Database-Sqlite3.h"
+#include "MpvPlayer.h"
+
+
+namespace Momuma
+{
+
+/* #Records the play history and statistics without writing from the event loop.
+! `record()` only queues the event in memory, a background thread writes the queued events
+with `Sqlite3::add_play_events()`: after the first event of a batch it waits up to
+`commitDelay` for more, so a burst of events (like skipping through a playlist) costs a
+single transaction.
+! The queue is bounded, events recorded while it's full are dropped and counted. Everything
+queued before the destructor is written before it returns.
+*/
+class HistoryRecorder
+{
+public:
+	// Playback which stopped before this position, and before half of its media, is a skip.
+	static constexpr std::chrono::minutes PLAYED_POSITION { 4 };
+	
+	/* #Starts the background writer.
+	! @param database: must outlive the recorder.
+	! @param capacity: maximum number of events waiting to be written.
+	! @param commitDelay: longest time an event waits for others to be written with.
+	*/
+	explicit HistoryRecorder(
+		Database::Sqlite3 &database, size_t capacity = 4096,
+		std::chrono::milliseconds commitDelay = std::chrono::seconds(1)
+	);
+	
+	// Writes the queued events and stops the background writer, detaches all players.
+	~HistoryRecorder(void);
+	
+	HistoryRecorder(const HistoryRecorder&) = delete;
+	HistoryRecorder& operator=(const HistoryRecorder&) = delete;
+	
+	/* #Queues `event` to be written, never waits for the database.
+	! Thread-safe.
+	! @return: `false` if the queue is full, `event` was dropped.
+	*/
+	bool record(Database::PlayEvent event);
+	
+	/* #Writes the queued events without waiting for `commitDelay`, and waits until they are.
+	! Thread-safe.
+	! @return: `false` on timeout.
+	*/
+	bool flush(std::chrono::milliseconds timeout);
+	
+	// #Number of events dropped because the queue was full, or because their write failed.
+	[[nodiscard]] uint64_t dropped(void) const;
+	
+	/* #Records the media played by `player`, until it's detached.
+	! A media which reached its end is played, one which was left before `PLAYED_POSITION`
+	and before half of its duration is skipped. Media failing to play isn't recorded.
+	! Must be called from the thread handling the events of `player`, like `detach()`.
+	`player` must be detached before it's destroyed or moved.
+	*/
+	void attach(MpvPlayer &player);
+	
+	// #Stops recording the media played by `player`, does nothing if it isn't attached.
+	void detach(MpvPlayer &player);
+	
+private:
+	// State of an attached player, only used by the thread handling its events.
+	struct Tracking
+	{
+		std::vector<sigc::connection> connections;
+		std::filesystem::path media; // empty between two media
+		std::chrono::microseconds duration { 0 };
+		std::chrono::microseconds position { 0 };
+	};
+	
+	Database::Sqlite3 &d_database;
+	const size_t m_capacity;
+	const std::chrono::milliseconds m_commitDelay;
+	
+	std::mutex m_mutex;
+	std::condition_variable m_queueCond; // wakes up the writer
+	std::condition_variable m_writtenCond; // wakes up `flush()`
+	std::vector<Database::PlayEvent> m_queue;
+	uint64_t m_queued = 0; // number of events ever queued
+	uint64_t m_written = 0; // number of queued events handled by the writer
+	bool m_flush = false;
+	bool m_stop = false;
+	std::atomic<uint64_t> m_dropped = 0;
+	std::thread m_thread;
+	
+	std::unordered_map<MpvPlayer*, std::unique_ptr<Tracking>> m_players;
+	
+	// Writes the queued events in batches until the recorder is destroyed, on `m_thread`.
+	void write_loop(void);
+	
+	// Records the media which ended, if any.
+	void on_end_file(Tracking &state, const mpv_event_end_file &data);
+};
+
+}
+
+#endif /* MONO_MUSIC_MANAGER__INTERNAL__HISTORY_RECORDER_H */
@@ -0,0 +1,66 @@
+#ifndef MONO_MUSIC_MANAGER__INTERNAL__INDEXER_H
+#define MONO_MUSIC_MANAGER__INTERNAL__INDEXER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+
+#include "Database-Sqlite3.h"
+
+
+namespace Momuma
+{
+
+/* #Keeps the `files` table in sync with the `Playlists` folder of a database.
+! Every folder inside of `<root>/Playlists/` is a playlist and the files directly inside of
+it are its media. A background thread crawls the folder once, then follows inotify events
+and applies them to the database in small batched transactions.
+*/
+class Indexer
+{
+public:
+	/* #Starts indexing on a background thread.
+	! @param database: database to keep in sync, must outlive the indexer.
+	! @param batchDelay: how long changes are collected before being written.
+	*/
+	explicit Indexer(
+		Database::Sqlite3 &database,
+		std::chrono::milliseconds batchDelay = std::chrono::milliseconds(200)
+	);
+	
+	// Stops the thread, changes collected so far are still written.
+	~Indexer(void);
+	
+	Indexer(const Indexer&) = delete;
+	Indexer& operator=(const Indexer&) = delete;
+	
+	// `false` if inotify couldn't be set up, in which case nothing is indexed.
+	[[nodiscard]] explicit operator bool(void) const;
+	
+	/* #Waits until the initial crawl has been written to the database.
+	! @return: `false` on timeout.
+	*/
+	bool wait_crawled(std::chrono::milliseconds timeout);
+	
+private:
+	Database::Sqlite3 &d_database;
+	const std::filesystem::path m_folder;
+	const std::chrono::milliseconds m_batchDelay;
+	
+	int m_inotifyFd = -1;
+	int m_stopFd = -1; // eventfd, wakes up the thread on destruction
+	
+	std::mutex m_mutex;
+	std::condition_variable m_crawledCond;
+	bool m_crawled = false;
+	
+	std::thread m_thread;
+	
+	void run(void);
+};
+
+}
+
+#endif /* MONO_MUSIC_MANAGER__INTERNAL__INDEXER_H */
@@ -1,15 +1,105 @@
 #ifndef MONO_MUSIC_MANAGER__INTERNAL__MPV_PLAYER_H
 #define MONO_MUSIC_MANAGER__INTERNAL__MPV_PLAYER_H
 
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <memory>
 #include <mpv/client.h>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 
+#include "MpvProperty.h"
+#include "MpvRequest.h"
+#include "momuma/enum_operators.h"
 #include "momuma/sigc.h"
 
 
 namespace Momuma
 {
 
+class PlayerReactor;
+
+// A set of mpv event types, bit `n` is the event whose `mpv_event_id` is `n`.
+enum class MpvEventMask : uint64_t
+{
+	NONE = 0,
+	ALL = ~uint64_t(0),
+};
+ENUM_DEFINE_BITWISE_OPS(MpvEventMask)
+
+[[nodiscard]] constexpr inline
+MpvEventMask mpv_event_bit(const mpv_event_id id)
+{
+	return static_cast<MpvEventMask>(uint64_t(1) << id);
+}
+
+/* #Rows which differ between two `PlaylistSnapshot`s, see `PlaylistSnapshot::diff()`.
+! Rows `[position, position + removed)` of the previous snapshot were replaced by rows
+`[position, position + added)` of the new one. The rows around them are the same entries,
+`updated` lists those whose flags or filename changed, by their index in the new snapshot.
+*/
+struct PlaylistDiff
+{
+	size_t position = 0;
+	size_t removed = 0;
+	size_t added = 0;
+	std::vector<size_t> updated;
+	
+	[[nodiscard]] inline bool empty(void) const
+	{
+		return removed == 0 && added == 0 && updated.empty();
+	}
+};
+
+/* #Copy of mpv's `playlist` property, filled by `MpvPlayer::get_playlist()`.
+! The filenames are stored back to back in a single buffer, entry `i` refers to its name
+by offset, so a snapshot is two allocations whatever the size of the playlist.
+*/
+struct PlaylistSnapshot
+{
+	struct Entry
+	{
+		int64_t id; // `playlist/N/id`, unique among the entries of a player
+		uint32_t offset; // start of the filename inside of `arena`
+		uint32_t length;
+		bool current; // `playlist/N/current`, the entry selected by `playlist-pos`
+		bool playing; // `playlist/N/playing`, the entry being loaded or played
+	};
+	
+	std::string arena;
+	std::vector<Entry> entries;
+	
+	[[nodiscard]] inline size_t size(void) const { return entries.size(); }
+	[[nodiscard]] inline bool empty(void) const { return entries.empty(); }
+	
+	[[nodiscard]] inline std::string_view filename(const size_t i) const
+	{
+		return std::string_view(arena).substr(entries[i].offset, entries[i].length);
+	}
+	
+	inline void clear(void)
+	{
+		arena.clear();
+		entries.clear();
+	}
+	
+	/* #Compares the entries with those of `previous`, by id.
+	! Runs in linear time: only the common prefix and suffix are matched, anything between
+	them is reported as replaced, like a move or several unrelated edits.
+	*/
+	[[nodiscard]] PlaylistDiff diff(const PlaylistSnapshot &previous) const;
+};
+
 class MpvPlayer
 {
 public:
@@ -19,24 +109,63 @@ public:
 		PLAY, /* Player is active and playlist has items */
 	};
 	
+	/* #Options trading memory and I/O for seamless transitions between playlist entries.
+	! The defaults prefetch the next entry and read ahead enough to hide slow storage.
+	*/
+	struct PlaybackTuning
+	{
+		enum class Gapless { NO, YES, WEAK };
+		
+		Gapless gapless = Gapless::WEAK; // `gapless-audio`, `WEAK` keeps it when formats match
+		bool prefetchPlaylist = true; // `prefetch-playlist`, opens the next entry in advance
+		bool cache = true; // `cache`, `false` only buffers the demuxer's own packets
+		int64_t demuxerMaxBytes = 32 * 1024 * 1024; // `demuxer-max-bytes`
+		std::chrono::duration<double> demuxerReadahead = std::chrono::seconds(10);
+	};
+	
+	// Time spent switching to the next media, see `signal_transition`.
+	struct TransitionTiming
+	{
+		std::chrono::microseconds loading; // from `MPV_EVENT_END_FILE` to `MPV_EVENT_FILE_LOADED`
+		std::chrono::microseconds starting; // from `FILE_LOADED` to `MPV_EVENT_PLAYBACK_RESTART`
+		
+		[[nodiscard]] std::chrono::microseconds total(void) const { return loading + starting; }
+	};
+	
+	enum class Mode
+	{
+		PLAYBACK,
+		// Only opens and demuxes media: no audio or video output, no scripts, no config files.
+		PROBE,
+	};
+	
+	// Default time limit of a duration query, a hung mount or a broken file can't block longer.
+	static constexpr std::chrono::seconds PROBE_TIMEOUT { 10 };
+	
 	/* #Query the duration of a random media file using a private MpvPlayer object.
 	! Due to the nature of libmpv's `mpv_wait_event()`, this function is *not* MT thread-safe.
+	Use a `DurationScanner` to query many files, possibly from several threads.
 	! @param media: path to a media file.
+	! @param timeout: see `probe_duration()`.
 	! @return: the duration of the file at `media`, or -1 in case of failure.
 	*/
 	[[nodiscard]] static
-	std::chrono::microseconds query_duration(const std::filesystem::path &media);
+	std::chrono::microseconds query_duration(
+		const std::filesystem::path &media,
+		std::chrono::microseconds timeout = PROBE_TIMEOUT
+	);
 	
 	
 	mpv_handle *_ctx;
 	
 	// Equivalent to `mpv_create()` followed by `mpv_initialize()`.
 	MpvPlayer(void);
-	MpvPlayer(mpv_error &err);
+	MpvPlayer(mpv_error &err, Mode mode = Mode::PLAYBACK);
 	~MpvPlayer(void);
 	
-	MpvPlayer(MpvPlayer &&other) = default;
-	MpvPlayer& operator=(MpvPlayer &&other) = default;
+	// `other` is left without a handle, like a player which failed to initialize.
+	MpvPlayer(MpvPlayer &&other) noexcept;
+	MpvPlayer& operator=(MpvPlayer &&other) noexcept;
 	
 	MpvPlayer(const MpvPlayer &other) = delete;
 	MpvPlayer& operator=(const MpvPlayer &other) = delete;
@@ -45,9 +174,107 @@ public:
 	
 	[[nodiscard]] MpvPlayer create_client(void);
 	
-	// Called by the destructor.
+	/* #Called by the destructor.
+	! Removes the player from its `PlayerReactor`, if any.
+	! Asynchronous requests still waiting for their reply fail with `MPV_ERROR_GENERIC`.
+	*/
 	void destroy(void);
 	
+	/* #Replaces the playlist with `media` and waits until its duration is known.
+	! Events received in the meantime are emitted as usual, so this must not be used while
+	another thread is waiting for events of this player.
+	! Loading is stopped when the time runs out or a stop is requested, the next call can
+	follow right away.
+	! @param media: path to a media file.
+	! @param timeout: how long to wait for the duration, negative values wait forever.
+	! @param stop: aborts the wait when a stop is requested, from any thread.
+	! @return: the duration of the file at `media`, or -1 in case of failure.
+	*/
+	[[nodiscard]] std::chrono::microseconds probe_duration(
+		const std::filesystem::path &media,
+		std::chrono::microseconds timeout = std::chrono::microseconds(-1),
+		std::stop_token stop = {}
+	);
+	
+	/* #Sends a command without waiting for mpv to run it.
+	! @param args: the command name followed by its arguments, without a terminating `nullptr`.
+	! @return: the error code of the command once its reply was received by `wait_event()`.
+	*/
+	[[nodiscard]] MpvRequest<mpv_error> command_async(std::span<const char *const> args);
+	
+	/* #Reads a property without waiting for mpv.
+	! `T` is one of `bool`, `int64_t`, `double`, `std::string` or `std::chrono::microseconds`.
+	! @param name: name of the property.
+	! @return: the value once its reply was received by `wait_event()`.
+	*/
+	template<typename T>
+	[[nodiscard]] MpvRequest<PropertyReply<T>> get_property_async(const char *name);
+	
+	// #Equivalent to `get_property_async()` for a property of the `Prop` namespace.
+	template<MpvProperty P>
+	[[nodiscard]] MpvRequest<PropertyReply<typename P::Type>> get_async(void)
+	{
+		return this->get_property_async<typename P::Type>(P::NAME);
+	}
+	
+	/* #Reads a property of the `Prop` namespace, like `player.get<Prop::Volume>()`.
+	! The name and the format are known at compile time, this is a single `mpv_get_property()`.
+	! @return: the value, only set if `error` is `MPV_ERROR_SUCCESS`.
+	*/
+	template<MpvProperty P>
+	[[nodiscard]] PropertyReply<typename P::Type> get(void) const
+	{
+		using Format = MpvFormat<typename P::Type>;
+		typename Format::Storage data {};
+		PropertyReply<typename P::Type> reply {
+			static_cast<mpv_error>(mpv_get_property(_ctx, P::NAME, P::FORMAT, &data)), {}
+		};
+		if (reply.error == MPV_ERROR_SUCCESS) {
+			reply.value = Format::read(&data);
+			Format::release(data);
+		}
+		return reply;
+	}
+	
+	// #Writes a property of the `Prop` namespace, read-only properties don't compile.
+	template<MpvProperty P> requires P::WRITABLE
+	[[nodiscard]] mpv_error set(const std::type_identity_t<typename P::Type> &value)
+	{
+		using Format = MpvFormat<typename P::Type>;
+		typename Format::Storage data = Format::store(value);
+		return static_cast<mpv_error>(mpv_set_property(_ctx, P::NAME, P::FORMAT, &data));
+	}
+	
+	/* #Observes every property of a `PropertyList` in one pass.
+	! Property `i` of the list is observed with the `reply_userdata` `firstId + i`, so the
+	changes can be told apart with `PropertyList::index_of()`.
+	! @return: the error of the first property which couldn't be observed, the following
+	ones are observed anyway.
+	*/
+	template<MpvProperty... Ps>
+	mpv_error observe(PropertyList<Ps...>, const uint64_t firstId)
+	{
+		mpv_error result = MPV_ERROR_SUCCESS;
+		uint64_t id = firstId;
+		const auto observe_one = [&](const char *name, const mpv_format format) {
+			const auto err = static_cast<mpv_error>(mpv_observe_property(_ctx, id++, name, format));
+			if (result == MPV_ERROR_SUCCESS) {
+				result = err;
+			}
+		};
+		(observe_one(Ps::NAME, Ps::FORMAT), ...);
+		return result;
+	}
+	
+	// #Stops observing the properties observed by `observe()` with the same arguments.
+	template<MpvProperty... Ps>
+	void unobserve(PropertyList<Ps...>, const uint64_t firstId)
+	{
+		for (uint64_t id = firstId; id < firstId + sizeof...(Ps); ++id) {
+			(void)mpv_unobserve_property(_ctx, id);
+		}
+	}
+	
 	// Clears the playlist and pauses the playback.
 	void stop_playback(void);
 	
@@ -63,7 +290,25 @@ public:
 	*/
 	[[nodiscard]] mpv_error append_media(const std::filesystem::path &media, bool play=false);
 	
+	/* #Appends all of `media` to the end of the current playlist, in order.
+	! The paths are sent as a single in-memory playlist, except for the few which can't be
+	written as a playlist line (like names with line breaks), which are loaded one by one.
+	Relative paths are made absolute.
+	! @param media: paths to playable media files.
+	! @param play: like with the single file overload, applies to the first file.
+	! @return: the error of the first failed command, the following paths weren't appended.
+	*/
+	[[nodiscard]] mpv_error append_media(
+		std::span<const std::filesystem::path> media, bool play=false
+	);
+	
 	[[nodiscard]] mpv_error set_position(std::chrono::microseconds position);
+	
+	/* #Playback position of the current media.
+	! Like the other getters of observed properties, this reads the value received by the
+	last `wait_event()`, falling back to querying mpv until one was received. After a set
+	through this player, it queries mpv until `wait_event()` received a value newer than the set.
+	*/
 	[[nodiscard]] std::chrono::microseconds get_position(mpv_error &err) const;
 	
 	/* # Index of the "playing" media on playlist.
@@ -91,17 +336,73 @@ public:
 	// the result is negative when the state is `State::STOP`
 	[[nodiscard]] int64_t playlist_size(void) const;
 	
+	/* #Number of playlist changes made through this player's methods.
+	! Thread-safe. Lets a thread filling the playlist notice that it was replaced meanwhile.
+	! Every call changing the playlist adds exactly one, even if it failed or sent several
+	commands, like the bulk `append_media()`. A thread can then predict the generation its own
+	call leaves (`PlaylistLoader` relies on this).
+	*/
+	[[nodiscard]] uint64_t playlist_generation(void) const;
+	
 	// equivalent to `get_media_count() <= 0`.
 	[[nodiscard]] bool playlist_empty(void) const;
 	
+	/* #Reads the whole playlist with a single `mpv_get_property()` of `playlist`.
+	! Replaces reading `playlist-count` and the properties of every entry one by one.
+	! @param snapshot: cleared and filled with the entries in playlist order, the buffers
+	are reused, so refreshing the same snapshot doesn't allocate once they're large enough.
+	*/
+	[[nodiscard]] mpv_error get_playlist(PlaylistSnapshot &snapshot) const;
+	
 	State get_state(void) const;
 	
+	/* #Applies `tuning` to the following playback.
+	! When an option can't be set, the ones set before it are restored to their previous value.
+	! @return: the error of the first option which couldn't be set.
+	*/
+	[[nodiscard]] mpv_error set_tuning(const PlaybackTuning &tuning);
+	
+	/* #Mask of the events required by the player itself, which are never disabled.
+	! Covers the observed properties, the replies of asynchronous requests and shutdown.
+	*/
+	static const MpvEventMask REQUIRED_EVENTS;
+	
+	// #Event types currently generated by mpv for this player, all by default.
+	[[nodiscard]] MpvEventMask get_event_mask(void) const;
+	
+	/* #Enables the event types in `mask` and disables all others, using `mpv_request_event()`.
+	! Disabled events aren't generated by mpv at all, so `wait_event()` never returns them.
+	Functions waiting for specific events, like `probe_duration()`, need them enabled.
+	! @param mask: events to enable, `REQUIRED_EVENTS` are always added.
+	*/
+	void set_event_mask(MpvEventMask mask);
+	
+	/* #Events whose signal has at least one connected slot, including `REQUIRED_EVENTS`.
+	! A connected `signal_eventUnknown` selects all events.
+	*/
+	[[nodiscard]] MpvEventMask connected_events(void) const;
+	
+	/* #Waits for the next event and emits the matching signals.
+	! Changes of the observed properties (`pause`, `playlist-count`, `playlist-pos` and
+	`playback-time`) update the values returned by their getters before any signal is emitted.
+	Replies to asynchronous requests resolve them before `signal_eventCommandReply` and
+	`signal_eventGetPropertyReply` are emitted. Their awaiting coroutines are resumed by the
+	next call, before it waits: a call which resumed any doesn't block.
+	*/
 	mpv_event* wait_event(std::chrono::microseconds timeout);
 	
 	sigc::signal<void(MpvPlayer &src)> signal_streamStarted;
 	sigc::signal<void(MpvPlayer &src)> signal_streamEnded;
 	sigc::signal<void(MpvPlayer &src, State prevState, State newState)> signal_stateChanged;
 	
+	/* #Emitted when the media following an ended one starts playing.
+	! Only automatic transitions are measured: stopping the playback, loading another media or
+	reaching the end of the playlist cancels the measure.
+	! Times are taken when `wait_event()` receives the events, so they include any delay of the
+	thread calling it.
+	*/
+	sigc::signal<void(MpvPlayer &src, const TransitionTiming &timing)> signal_transition;
+	
 	sigc::signal<void()> signal_eventNone;
 	sigc::signal<void()> signal_eventShutdown;
 	sigc::signal<void(mpv_event_log_message &data)> signal_eventLogMessage;
@@ -124,12 +425,117 @@ public:
 	sigc::signal<void(mpv_event &event)> signal_eventUnknown;
 	
 private:
+	friend class EventDispatcher;
+	friend class PlayerReactor;
+	
+	/* #Last known values of the observed properties, written by `wait_event()`.
+	! `INVALID` entries are unknown, their getter queries mpv instead.
+	*/
+	struct PropertyCache
+	{
+		static constexpr int64_t INVALID = INT64_MIN;
+		static constexpr int64_t UNAVAILABLE = INT64_MIN + 1; // the property has no value
+		
+		/* #Value of one property, invalid from a set until a value newer than the set arrives.
+		! A `MPV_EVENT_PROPERTY_CHANGE` queued before the set would write the old value back,
+		so change events are ignored until the reply of a request sent after the set.
+		*/
+		struct Value
+		{
+			std::atomic<int64_t> value = INVALID;
+			std::atomic<uint64_t> generation = 0; // number of sets
+			std::atomic<uint64_t> synced = 0; // last generation whose reply arrived
+			
+			// Called before setting the property, from any thread. Returns the new generation.
+			uint64_t invalidate(void);
+			
+			// Stores the reply of a request sent after the set of `setGeneration`.
+			void store_reply(int64_t newValue, uint64_t setGeneration);
+			
+			// Stores a change event, unless a set is waiting for its reply.
+			void store_change(int64_t newValue);
+			
+			[[nodiscard]] int64_t load(void) const
+			{
+				return value;
+			}
+		};
+		
+		Value paused;
+		Value count;
+		Value index;
+		Value position; // microseconds
+		
+		std::atomic<uint64_t> playlistGeneration = 0; // see `playlist_generation()`
+	};
+	
+	// Asynchronous requests waiting for their reply.
+	struct PendingReplies
+	{
+		/* #Called with `mpv_event::error` and `mpv_event::data`, which may be `nullptr`.
+		! @return: the coroutine awaiting the request, or `nullptr`.
+		*/
+		using Resolver = std::function<std::coroutine_handle<>(int error, void *data)>;
+		
+		std::mutex mutex;
+		uint64_t lastId = 0;
+		std::unordered_map<uint64_t, Resolver> resolvers;
+		std::vector<std::coroutine_handle<>> ready; // resolved, not resumed yet
+	};
+	
 	State m_lastState = State::STOP;
 	
+	// reception times of the events of the current transition, default while not reached
+	std::chrono::steady_clock::time_point m_endFileTime;
+	std::chrono::steady_clock::time_point m_fileLoadedTime;
+	std::optional<TransitionTiming> m_transition; // finished, not emitted yet
+	
+	MpvEventMask m_eventMask = MpvEventMask::ALL;
+	PlayerReactor *m_reactor = nullptr; // servicing the events, the player is removed on destruction
+	std::unique_ptr<PropertyCache> m_cache;
+	std::unique_ptr<PendingReplies> m_pending;
+	
 	// Equivalent to `mpv_create_client()`.
 	MpvPlayer(mpv_handle &ctx, const char *name);
 	
-	[[nodiscard]] mpv_error initialize(void);
+	[[nodiscard]] mpv_error initialize(Mode mode = Mode::PLAYBACK);
+	
+	// Updates `m_cache` with a `MPV_EVENT_PROPERTY_CHANGE` of an observed property.
+	void update_cache(uint64_t replyUserdata, const mpv_event_property &property);
+	
+	/* #Forgets the properties changed by modifying the playlist.
+	! Must be called after the modification, see `resync()`.
+	*/
+	void invalidate_playlist(void);
+	
+	/* #Requests the value of `P` to end the invalidation of `cached`.
+	! @param generation: returned by `cached.invalidate()` before the set, which must be done.
+	*/
+	template<MpvProperty P>
+	void resync(PropertyCache::Value &cached, uint64_t generation);
+	
+	/* #Registers `resolver` under a new `reply_userdata` and sends the request with `send`.
+	! @return: `false` if `send` failed, in which case `resolver` was already called.
+	*/
+	bool send_async(PendingReplies::Resolver resolver, const std::function<int(uint64_t id)> &send);
+	
+	// Resolves the request waiting for `event`, if any, and queues its coroutine.
+	void resolve_reply(const mpv_event &event);
+	
+	/* #Resumes the coroutines queued by `resolve_reply()`.
+	! Must be called once the event which resolved them was dispatched, as they may wait for
+	events themselves.
+	! @return: whether any coroutine was resumed.
+	*/
+	bool resume_ready(void);
+	
+	/* #Updates the player with `event`, without emitting any signal.
+	! @return: the state after `event`.
+	*/
+	State handle_event(mpv_event &event);
+	
+	// Emits the signals of `event`, except `signal_stateChanged`.
+	void emit_event(mpv_event &event);
 	
 	[[nodiscard]] bool is_idle(void) const;
 };
@@ -0,0 +1,167 @@
+#ifndef MONO_MUSIC_MANAGER__INTERNAL__MPV_PROPERTY_H
+#define MONO_MUSIC_MANAGER__INTERNAL__MPV_PROPERTY_H
+
+#include <algorithm>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <mpv/client.h>
+#include <string>
+
+
+namespace Momuma
+{
+
+// A string literal usable as a template argument.
+template<size_t N>
+struct FixedString
+{
+	char data[N];
+	
+	consteval FixedString(const char (&str)[N])
+	{
+		std::copy_n(str, N, data);
+	}
+};
+
+/* #Conversion between a C++ value type and the mpv format holding it.
+! `Storage` is the variable passed to `mpv_get_property()` and `mpv_set_property()`,
+`read()` converts the data of a reply or of a property change.
+*/
+template<typename T>
+struct MpvFormat;
+
+template<>
+struct MpvFormat<bool>
+{
+	static constexpr mpv_format FORMAT = MPV_FORMAT_FLAG;
+	using Storage = int;
+	
+	static bool read(const void *data) { return *static_cast<const int*>(data) != 0; }
+	static Storage store(const bool value) { return value; }
+	static void release(Storage&) {}
+};
+
+template<>
+struct MpvFormat<int64_t>
+{
+	static constexpr mpv_format FORMAT = MPV_FORMAT_INT64;
+	using Storage = int64_t;
+	
+	static int64_t read(const void *data) { return *static_cast<const int64_t*>(data); }
+	static Storage store(const int64_t value) { return value; }
+	static void release(Storage&) {}
+};
+
+template<>
+struct MpvFormat<double>
+{
+	static constexpr mpv_format FORMAT = MPV_FORMAT_DOUBLE;
+	using Storage = double;
+	
+	static double read(const void *data) { return *static_cast<const double*>(data); }
+	static Storage store(const double value) { return value; }
+	static void release(Storage&) {}
+};
+
+template<>
+struct MpvFormat<std::string>
+{
+	static constexpr mpv_format FORMAT = MPV_FORMAT_STRING;
+	using Storage = char*;
+	
+	static std::string read(const void *data) { return *static_cast<char *const*>(data); }
+	// only read by mpv, which copies it
+	static Storage store(const std::string &value) { return const_cast<char*>(value.c_str()); }
+	static void release(Storage &value) { mpv_free(value); }
+};
+
+// Times are exchanged with mpv as seconds.
+template<>
+struct MpvFormat<std::chrono::microseconds>
+{
+	static constexpr mpv_format FORMAT = MPV_FORMAT_DOUBLE;
+	using Storage = double;
+	
+	static std::chrono::microseconds read(const void *data)
+	{
+		const std::chrono::duration<double> seconds(*static_cast<const double*>(data));
+		return std::chrono::duration_cast<std::chrono::microseconds>(seconds);
+	}
+	static Storage store(const std::chrono::microseconds value)
+	{
+		return std::chrono::duration<double>(value).count();
+	}
+	static void release(Storage&) {}
+};
+
+/* #Describes an mpv property at compile time, see the `Prop` namespace.
+! @tparam NAME: name of the property, as documented by mpv.
+! @tparam T: type of its value, one of the `MpvFormat` specializations.
+! @tparam WRITABLE: `false` for read-only properties, which `MpvPlayer::set()` rejects.
+*/
+template<FixedString NAME_, typename T, bool WRITABLE_ = true>
+struct PropertyDesc
+{
+	using Type = T;
+	static constexpr const char *NAME = NAME_.data;
+	static constexpr mpv_format FORMAT = MpvFormat<T>::FORMAT;
+	static constexpr bool WRITABLE = WRITABLE_;
+};
+
+template<typename P>
+concept MpvProperty = requires {
+	typename P::Type;
+	{ P::NAME } -> std::convertible_to<const char*>;
+	{ P::FORMAT } -> std::convertible_to<mpv_format>;
+	{ P::WRITABLE } -> std::convertible_to<bool>;
+};
+
+// Properties used by the player, a misspelled name doesn't compile.
+namespace Prop
+{
+	// playback
+	using Pause = PropertyDesc<"pause", bool>;
+	using Volume = PropertyDesc<"volume", double>;
+	using Mute = PropertyDesc<"mute", bool>;
+	using PlaybackTime = PropertyDesc<"playback-time", std::chrono::microseconds>;
+	using TimePos = PropertyDesc<"time-pos", std::chrono::microseconds>; // writing it seeks
+	using Duration = PropertyDesc<"duration", std::chrono::microseconds, false>;
+	using Path = PropertyDesc<"path", std::string, false>;
+	using CoreIdle = PropertyDesc<"core-idle", bool, false>;
+	
+	// playlist
+	using PlaylistCount = PropertyDesc<"playlist-count", int64_t, false>;
+	using PlaylistPos = PropertyDesc<"playlist-pos", int64_t>;
+	
+	// options
+	using KeepOpen = PropertyDesc<"keep-open", bool>;
+	using KeepOpenPause = PropertyDesc<"keep-open-pause", bool>;
+	using GaplessAudio = PropertyDesc<"gapless-audio", std::string>;
+	using PrefetchPlaylist = PropertyDesc<"prefetch-playlist", bool>;
+	using Cache = PropertyDesc<"cache", std::string>;
+	using DemuxerMaxBytes = PropertyDesc<"demuxer-max-bytes", std::string>; // sizes take suffixes
+	using DemuxerReadaheadSecs = PropertyDesc<"demuxer-readahead-secs", double>;
+}
+
+// A set of properties observed together by `MpvPlayer::observe()`.
+template<MpvProperty... Ps>
+struct PropertyList
+{
+	static constexpr size_t SIZE = sizeof...(Ps);
+	
+	// #Position of `P` inside of the list, doesn't compile if `P` isn't part of it.
+	template<MpvProperty P>
+	[[nodiscard]] static consteval size_t index_of(void)
+	{
+		static_assert((std::same_as<P, Ps> || ...), "the property isn't part of the list");
+		size_t index = 0;
+		(void)((!std::same_as<P, Ps> && (++index, true)) && ...);
+		return index;
+	}
+};
+
+}
+
+#endif /* MONO_MUSIC_MANAGER__INTERNAL__MPV_PROPERTY_H */
@@ -0,0 +1,105 @@
+#ifndef MONO_MUSIC_MANAGER__INTERNAL__MPV_REQUEST_H
+#define MONO_MUSIC_MANAGER__INTERNAL__MPV_REQUEST_H
+
+#include <coroutine>
+#include <future>
+#include <memory>
+#include <mpv/client.h>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+
+namespace Momuma
+{
+
+// Reply of `MpvPlayer::get_property_async()`, `value` is only set on success.
+template<typename T>
+struct PropertyReply
+{
+	mpv_error error;
+	T value;
+};
+
+/* #Reply of an asynchronous mpv request, resolved by `MpvPlayer::wait_event()`.
+! The reply can be `co_await`ed, the coroutine is then resumed by the `wait_event()` call
+following the one which received it, once that event was dispatched. It can also be read through `get_future()`, which
+must not be waited on by the thread calling `wait_event()`.
+! Requests which failed to be sent are resolved right away.
+*/
+template<typename T>
+class MpvRequest
+{
+public:
+	// shared by the request and the player waiting for its reply
+	struct State
+	{
+		std::mutex mutex;
+		std::optional<T> result;
+		std::coroutine_handle<> waiter;
+		std::promise<T> promise;
+	};
+	
+	explicit MpvRequest(std::shared_ptr<State> state) :
+		m_state { std::move(state) }
+	{}
+	
+	/* #Stores the reply.
+	! @param state: state of a request which wasn't resolved yet.
+	! @param result: the reply.
+	! @return: the coroutine awaiting the reply, to be resumed by the caller, or `nullptr`.
+	*/
+	[[nodiscard]] static std::coroutine_handle<> resolve(State &state, T result)
+	{
+		std::coroutine_handle<> waiter;
+		{
+			const std::lock_guard lock(state.mutex);
+			state.promise.set_value(result);
+			state.result = std::move(result);
+			waiter = std::exchange(state.waiter, nullptr);
+		}
+		return waiter;
+	}
+	
+	[[nodiscard]] bool ready(void) const
+	{
+		const std::lock_guard lock(m_state->mutex);
+		return m_state->result.has_value();
+	}
+	
+	// Can only be called once per request.
+	[[nodiscard]] std::future<T> get_future(void)
+	{
+		const std::lock_guard lock(m_state->mutex);
+		return m_state->promise.get_future();
+	}
+	
+	[[nodiscard]] bool await_ready(void) const
+	{
+		return this->ready();
+	}
+	
+	// `false` resumes the caller right away, the reply arrived since `await_ready()`.
+	bool await_suspend(std::coroutine_handle<> waiter)
+	{
+		const std::lock_guard lock(m_state->mutex);
+		if (m_state->result.has_value()) {
+			return false;
+		}
+		m_state->waiter = waiter;
+		return true;
+	}
+	
+	T await_resume(void)
+	{
+		const std::lock_guard lock(m_state->mutex);
+		return *m_state->result;
+	}
+	
+private:
+	std::shared_ptr<State> m_state;
+};
+
+}
+
+#endif /* MONO_MUSIC_MANAGER__INTERNAL__MPV_REQUEST_H */
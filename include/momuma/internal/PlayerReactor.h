@@ -0,0 +1,87 @@
+#ifndef MONO_MUSIC_MANAGER__INTERNAL__PLAYER_REACTOR_H
+#define MONO_MUSIC_MANAGER__INTERNAL__PLAYER_REACTOR_H
+
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "MpvPlayer.h"
+
+
+namespace Momuma
+{
+
+/* #Services the events of many players from a single thread.
+! The wakeup pipe (`mpv_get_wakeup_pipe()`) of every player is registered in one epoll set,
+`dispatch()` sleeps until some of them are readable and only calls `MpvPlayer::wait_event()`
+on those players, so their signals are emitted as usual, on the dispatching thread.
+! The reactor isn't thread-safe, all of its methods must be called by the same thread.
+A registered player must not be moved, nor waited on by another thread, nor used with an
+`EventDispatcher` (libmpv only supports one wakeup mechanism per handle). Destroying it,
+even from inside of its own signals, removes it.
+*/
+class PlayerReactor
+{
+public:
+	// Events of a player handled by one `dispatch()`, the rest waits for the next call.
+	static constexpr size_t MAX_EVENTS_PER_PLAYER = 64;
+	
+	PlayerReactor(void);
+	~PlayerReactor(void);
+	
+	PlayerReactor(const PlayerReactor&) = delete;
+	PlayerReactor& operator=(const PlayerReactor&) = delete;
+	
+	// `false` if the epoll set couldn't be created.
+	[[nodiscard]] explicit operator bool(void) const;
+	
+	/* #File descriptor which is readable while a player has events.
+	! Meant to be added to the application's main loop, which then calls `dispatch()`.
+	*/
+	[[nodiscard]] int fd(void) const;
+	
+	/* #Starts servicing the events of `player`.
+	! Players are removed automatically after their `MPV_EVENT_SHUTDOWN`.
+	! @return: `false` on failure, or if `player` is already registered.
+	*/
+	bool add(MpvPlayer &player);
+	
+	/* #Stops servicing the events of `player`, does nothing if it isn't registered.
+	! Called by the destructor of `player`.
+	*/
+	void remove(MpvPlayer &player);
+	
+	[[nodiscard]] size_t size(void) const;
+	
+	/* #Waits for players with pending events and handles them with `MpvPlayer::wait_event()`.
+	! Players may be added or removed from inside of their signals.
+	! @param timeout: how long to wait for a first event, negative values wait forever.
+	! @return: the number of events handled, `-1` on failure.
+	*/
+	int64_t dispatch(std::chrono::milliseconds timeout);
+	
+private:
+	struct Registration
+	{
+		int pipe; // wakeup pipe of the player
+		bool queued = false; // in `m_ready`, not handled yet
+	};
+	
+	int m_epollFd = -1;
+	std::unordered_map<MpvPlayer*, Registration> m_players;
+	
+	// players which had more than `MAX_EVENTS_PER_PLAYER` events, their pipe was drained
+	std::vector<MpvPlayer*> m_backlog;
+	std::vector<MpvPlayer*> m_ready; // players handled by the current `dispatch()`
+	
+	MpvPlayer *m_draining = nullptr; // player whose events are being handled
+	bool m_drainingRemoved = false; // `m_draining` was removed by one of its signals
+	
+	// #Handles the events of `player`. @return: the number of events.
+	size_t drain_player(MpvPlayer &player);
+};
+
+}
+
+#endif /* MONO_MUSIC_MANAGER__INTERNAL__PLAYER_REACTOR_H */
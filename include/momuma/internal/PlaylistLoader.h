@@ -0,0 +1,84 @@
+#ifndef MONO_MUSIC_MANAGER__INTERNAL__PLAYLIST_LOADER_H
+#define MONO_MUSIC_MANAGER__INTERNAL__PLAYLIST_LOADER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "Database-Sqlite3.h"
+#include "MpvPlayer.h"
+
+
+namespace Momuma
+{
+
+/* #Queues a stored playlist into a player without waiting for the whole list.
+! The first media is sent to the player right away, so playback starts while the rest is
+read in windows of `pageSize` rows (see `Sqlite3::get_media_window()`) and appended with the
+bulk `MpvPlayer::append_media()` on a background thread.
+! The background thread reads with a reserved connection when the database has a free
+reader. It stops once the player's playlist is changed by anything but the loader.
+! The change is checked before each window but not under a lock, so this only narrows the
+race: a change made while a window is being appended still gets that window, and the loader
+stops before the next one.
+*/
+class PlaylistLoader
+{
+public:
+	/* #Creates an idle loader.
+	! @param database: database to read the playlists from, must outlive the loader.
+	! @param player: player to queue the media into, must outlive the loader.
+	! @param pageSize: number of media read and appended at once by the background thread.
+	*/
+	PlaylistLoader(Database::Sqlite3 &database, MpvPlayer &player, int pageSize = 1024);
+	
+	// Stops the background thread, the media queued so far stay in the player.
+	~PlaylistLoader(void);
+	
+	PlaylistLoader(const PlaylistLoader&) = delete;
+	PlaylistLoader& operator=(const PlaylistLoader&) = delete;
+	
+	/* #Replaces the player's playlist with `playlist`.
+	! Returns once the first media was queued, a load still in progress is cancelled first.
+	! @param playlist: name of a stored playlist.
+	! @param play: `true` to start playing the first media.
+	! @return: `false` if the playlist is empty or couldn't be read, the player is unchanged.
+	*/
+	bool load(const std::string &playlist, bool play = true);
+	
+	// #Stops queueing the rest of the current playlist.
+	void cancel(void);
+	
+	/* #Waits until the whole playlist was queued, or the load failed, was cancelled or stopped.
+	! @return: `false` on timeout.
+	*/
+	bool wait_loaded(std::chrono::milliseconds timeout);
+	
+	// #Number of media of the current playlist queued so far.
+	[[nodiscard]] size_t queued(void) const;
+	
+private:
+	Database::Sqlite3 &d_database;
+	MpvPlayer &d_player;
+	const int m_pageSize;
+	
+	std::mutex m_mutex;
+	std::condition_variable m_doneCond;
+	bool m_done = true;
+	
+	std::atomic<bool> m_cancel = false;
+	std::atomic<size_t> m_queued = 0;
+	std::thread m_thread;
+	
+	/* #Appends the pages starting at `fromIndex`, on `m_thread`.
+	! @param generation: `MpvPlayer::playlist_generation()` once the first media was queued.
+	*/
+	void fill(std::string playlist, int64_t fromIndex, uint64_t generation);
+};
+
+}
+
+#endif /* MONO_MUSIC_MANAGER__INTERNAL__PLAYLIST_LOADER_H */
@@ -0,0 +1,111 @@
+#ifndef MONO_MUSIC_MANAGER__INTERNAL__POSITION_STREAM_H
+#define MONO_MUSIC_MANAGER__INTERNAL__POSITION_STREAM_H
+
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <vector>
+
+#include "Database-Sqlite3.h"
+#include "MpvPlayer.h"
+
+
+namespace Momuma
+{
+
+/* #Playback position of a player, delivered on a single signal at a bounded rate.
+! Observes `time-pos` instead of reading `playback-time` on demand: the changes received by
+`MpvPlayer::wait_event()` are merged, and `signal_position` is emitted with the latest one at
+most once per `interval`. State changes emit the pending position right away, and the first
+position after a seek isn't delayed.
+! With a database, resume points of long media are kept as well: their position is written
+behind, in one transaction per `saveInterval` (and on track changes), and a file which has
+one starts from it when it's loaded again.
+! Everything happens on the thread calling `wait_event()`, which must also destroy the stream.
+A player has at most one stream at a time.
+*/
+class PositionStream
+{
+public:
+	struct ResumeOptions
+	{
+		// shorter media, like songs, always start from the beginning
+		std::chrono::microseconds minDuration = std::chrono::minutes(10);
+		// longest time a position stays in memory only
+		std::chrono::milliseconds saveInterval = std::chrono::seconds(15);
+		// media stopped closer to its end is considered finished, and forgets its position
+		std::chrono::microseconds endMargin = std::chrono::seconds(30);
+	};
+	
+	/* #Starts observing the position of `player`, without resume points.
+	! @param player: must outlive the stream.
+	! @param interval: shortest time between two emissions of `signal_position`.
+	*/
+	explicit PositionStream(
+		MpvPlayer &player, std::chrono::milliseconds interval = std::chrono::milliseconds(250)
+	);
+	
+	/* #Starts observing the position of `player`, keeping resume points in `database`.
+	! @param database: must outlive the stream.
+	*/
+	PositionStream(
+		MpvPlayer &player, std::chrono::milliseconds interval,
+		Database::Sqlite3 &database, ResumeOptions options
+	);
+	
+	// Writes the pending resume points.
+	~PositionStream(void);
+	
+	PositionStream(const PositionStream&) = delete;
+	PositionStream& operator=(const PositionStream&) = delete;
+	
+	// #Last position received, zero when nothing is playing.
+	[[nodiscard]] std::chrono::microseconds position(void) const;
+	
+	// #Emits the position if it changed since the last emission.
+	void flush(void);
+	
+	/* #Writes the resume points changed since the last write.
+	! @return: `false` if the database failed, the points are kept for the next write.
+	*/
+	bool save(void);
+	
+	sigc::signal<void(std::chrono::microseconds position)> signal_position;
+	
+private:
+	using Clock = std::chrono::steady_clock;
+	
+	MpvPlayer &d_player;
+	Database::Sqlite3 *const d_database; // `nullptr` without resume points
+	const std::chrono::milliseconds m_interval;
+	const ResumeOptions m_options;
+	std::vector<sigc::connection> m_connections;
+	
+	std::chrono::microseconds m_position { 0 };
+	bool m_pending = false; // `m_position` wasn't emitted yet
+	Clock::time_point m_lastEmit;
+	
+	// resume point of the current media, if it's long enough
+	std::filesystem::path m_media;
+	std::chrono::microseconds m_duration { 0 };
+	bool m_resumable = false;
+	
+	// positions not written yet, negative ones are removed
+	std::map<std::filesystem::path, std::chrono::microseconds> m_unsaved;
+	Clock::time_point m_lastSave;
+	
+	PositionStream(
+		MpvPlayer &player, std::chrono::milliseconds interval,
+		Database::Sqlite3 *database, ResumeOptions options
+	);
+	
+	// `position` is empty while nothing is playing
+	void on_position(std::optional<std::chrono::microseconds> position);
+	void on_file_loaded(void);
+	void on_end_file(const mpv_event_end_file &data);
+};
+
+}
+
+#endif /* MONO_MUSIC_MANAGER__INTERNAL__POSITION_STREAM_H */
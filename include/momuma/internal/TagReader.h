@@ -0,0 +1,45 @@
+#ifndef MONO_MUSIC_MANAGER__INTERNAL__TAG_READER_H
+#define MONO_MUSIC_MANAGER__INTERNAL__TAG_READER_H
+
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "Database-Sqlite3.h"
+
+
+namespace Momuma
+{
+
+// Text converted to UTF-8 while parsing tags, the views of the tags reference its elements.
+using TagArena = std::deque<std::string>;
+
+/* #Parses the tags of a media file, without decoding it.
+! Supported: ID3v2.2 to 2.4 and ID3v1 (MP3), FLAC metadata blocks, and the Vorbis comments of
+Ogg Vorbis and Opus. ID3v2 fields take precedence over the ID3v1 ones.
+! Text stored as UTF-8 (or ASCII) is referenced inside of `data` without being copied,
+anything else is converted into `arena`.
+! @param data: the whole file.
+! @param tags: receives the fields which were found, the others are left as-is.
+! @return: `false` if no supported tag was found.
+*/
+bool parse_tags(std::span<const uint8_t> data, Database::MediaTags &tags, TagArena &arena);
+
+/* #Reads the tags of `media` in parallel and stores them with `Sqlite3::set_media_tags()`.
+! Files are mapped and parsed in chunks, every chunk is stored in a single transaction
+before its mappings are released, so the text is only copied by sqlite itself.
+Files without tags are stored too, with all of their fields unknown.
+! @param workers: number of threads, `0` to use one per core.
+! @return: the number of files whose tags were stored, `-1` if the database failed.
+Unreadable files are skipped.
+*/
+int64_t scan_media_tags(
+	Database::Sqlite3 &db, const std::vector<std::filesystem::path> &media, unsigned workers = 0
+);
+
+}
+
+#endif /* MONO_MUSIC_MANAGER__INTERNAL__TAG_READER_H */
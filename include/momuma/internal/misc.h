@@ -1,7 +1,11 @@
 #ifndef MONO_MUSIC_MANAGER__INTERNAL__CONSTANTS_H
 #define MONO_MUSIC_MANAGER__INTERNAL__CONSTANTS_H
 
+#include <algorithm>
+#include <cstdint>
 #include <filesystem>
+#include <span>
+#include <string_view>
 
 
 namespace Momuma
@@ -13,6 +17,67 @@ enum class Platform {
 
 bool is_filename_forbidden(std::filesystem::path filename);
 
+/* #Read-only memory mapping of a whole file.
+! Pages are only read from the storage once accessed, so parsing a few headers of a large file
+stays cheap.
+*/
+class MappedFile
+{
+public:
+	// Maps `path`, the object is empty if it can't be opened, or if the file is empty.
+	explicit MappedFile(const std::filesystem::path &path);
+	~MappedFile(void);
+	
+	MappedFile(MappedFile &&other) noexcept;
+	MappedFile& operator=(MappedFile &&other) noexcept;
+	
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	
+	[[nodiscard]] explicit operator bool(void) const;
+	
+	[[nodiscard]] std::span<const uint8_t> data(void) const;
+	
+private:
+	const uint8_t *m_data = nullptr;
+	size_t m_size = 0;
+};
+
+// #Returns whether `data` contains `magic` at `offset`, out of bounds offsets are allowed.
+[[nodiscard]] inline bool has_magic(
+	const std::span<const uint8_t> data, const size_t offset, const std::string_view magic
+) {
+	if (offset > data.size() || data.size() - offset < magic.size()) {
+		return false;
+	}
+	return std::equal(magic.begin(), magic.end(), data.begin() + offset, [](char a, uint8_t b) {
+		return static_cast<uint8_t>(a) == b;
+	});
+}
+
+// Integer readers of file headers, they don't check bounds, their callers do.
+
+[[nodiscard]] inline uint32_t read_be32(const std::span<const uint8_t> data, const size_t offset)
+{
+	return uint32_t(data[offset]) << 24 | uint32_t(data[offset + 1]) << 16
+		| uint32_t(data[offset + 2]) << 8 | uint32_t(data[offset + 3]);
+}
+
+[[nodiscard]] inline uint16_t read_le16(const std::span<const uint8_t> data, const size_t offset)
+{
+	return static_cast<uint16_t>(data[offset] | data[offset + 1] << 8);
+}
+
+[[nodiscard]] inline uint32_t read_le32(const std::span<const uint8_t> data, const size_t offset)
+{
+	return uint32_t(read_le16(data, offset)) | uint32_t(read_le16(data, offset + 2)) << 16;
+}
+
+[[nodiscard]] inline uint64_t read_le64(const std::span<const uint8_t> data, const size_t offset)
+{
+	return uint64_t(read_le32(data, offset)) | uint64_t(read_le32(data, offset + 4)) << 32;
+}
+
 }
 
 #endif /* MONO_MUSIC_MANAGER__INTERNAL__CONSTANTS_H */
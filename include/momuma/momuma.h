@@ -2,7 +2,11 @@
 #define MONO_MUSIC_MANAGER__MOMUMA_H
 
 #include "Database-Sqlite3.h"
+#include "DurationScanner.h"
+#include "EventDispatcher.h"
+#include "Indexer.h"
 #include "MpvPlayer.h"
+#include "PlaylistLoader.h"
 
 
 namespace Momuma
@@ -27,7 +31,10 @@ class Momuma
 {
 public:
 	Momuma(const fs::path &rootFolder);
-	Momuma(Momuma &&other) = default;
+	
+	// The loader refers to the player and the database, and owns a thread: neither is moved.
+	Momuma(Momuma &&other) = delete;
+	Momuma& operator=(Momuma &&other) = delete;
 	
 	Momuma(const Momuma&) = delete;
 	Momuma& operator=(const Momuma&) = delete;
@@ -36,13 +43,38 @@ public:
 	
 	[[nodiscard]] MpvPlayer& get_player(void) { return m_player; }
 	[[nodiscard]] Database::Sqlite3& get_database(void) { return m_database; }
+	[[nodiscard]] PlaylistLoader& get_loader(void) { return m_loader; }
 	
 	[[nodiscard]]
 	fs::path get_location(void);
 	
+	/* #Starts playing a stored playlist, queueing the rest of it in the background.
+	! @return: `false` if the playlist is empty or couldn't be loaded.
+	*/
+	bool play_playlist(const std::string &playlist);
+	
+	/* #Queries the duration of a media file, using the database as a cache.
+	! Only files which changed since they were last queried are read, from their headers or
+	with the single probe player of `MpvPlayer::query_duration()`.
+	! @return: the duration of the file at `media`, or -1 in case of failure.
+	*/
+	[[nodiscard]] std::chrono::microseconds query_duration(const fs::path &media);
+	
+	/* #Queries the durations of many media files, using the database as a cache.
+	! Cached results are passed to `callback` first, the rest are scanned in parallel and
+	passed in order of completion. `callback` is called from the calling thread.
+	! @return: the number of times `callback()` was called.
+	*/
+	size_t scan_durations(
+		const std::vector<fs::path> &media,
+		sigc::slot<void(const DurationScanner::Result&)> callback
+	);
+	
 private:
 	MpvPlayer m_player;
 	Database::Sqlite3 m_database;
+	PlaylistLoader m_loader;
+	std::unique_ptr<DurationScanner> m_scanner; // created by the first scan
 };
 
 }
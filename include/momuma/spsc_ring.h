@@ -0,0 +1,95 @@
+#ifndef MONO_MUSIC_MANAGER__SPSC_RING_H
+#define MONO_MUSIC_MANAGER__SPSC_RING_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <optional>
+#include <type_traits>
+
+
+namespace Momuma
+{
+
+/* #A bounded lock-free queue with a single producer thread and a single consumer thread.
+! `Capacity` must be a power of 2. Indexes only grow, wrapping around `size_t`, and the
+slot of an index is its remainder by `Capacity`.
+*/
+template<typename T, size_t Capacity>
+class SpscRing
+{
+	static_assert((Capacity & (Capacity - 1)) == 0 && Capacity > 0, "needs a power of 2");
+	static_assert(std::is_trivially_copyable_v<T>, "slots are overwritten without destruction");
+	
+	// keeps the indexes written by different threads on different cache lines
+	static constexpr size_t ALIGN = 64;
+	
+public:
+	[[nodiscard]] static constexpr size_t capacity(void) { return Capacity; }
+	
+	// #Producer only. @return: `false` when the ring is full.
+	bool try_push(const T &value)
+	{
+		const size_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail - m_headCache == Capacity) {
+			m_headCache = m_head.load(std::memory_order_acquire);
+			if (tail - m_headCache == Capacity) {
+				return false;
+			}
+		}
+		m_slots[tail & (Capacity - 1)] = value;
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+	
+	// #Consumer only. @return: nothing when the ring is empty.
+	std::optional<T> try_pop(void)
+	{
+		T value;
+		if (this->pop_batch(&value, 1) == 0) {
+			return std::nullopt;
+		}
+		return value;
+	}
+	
+	/* #Consumer only, pops up to `max` values at once.
+	! @return: the number of values copied to `out`.
+	*/
+	size_t pop_batch(T *out, const size_t max)
+	{
+		const size_t head = m_head.load(std::memory_order_relaxed);
+		if (m_tailCache - head < max) {
+			m_tailCache = m_tail.load(std::memory_order_acquire);
+		}
+		const size_t count = std::min(m_tailCache - head, max);
+		if (count == 0) {
+			return 0;
+		}
+		
+		for (size_t i = 0; i < count; ++i) {
+			out[i] = m_slots[(head + i) & (Capacity - 1)];
+		}
+		m_head.store(head + count, std::memory_order_release);
+		return count;
+	}
+	
+	// #Either thread, the result may be outdated by the time it's read.
+	[[nodiscard]] size_t size(void) const
+	{
+		return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+	}
+	
+private:
+	std::array<T, Capacity> m_slots;
+	
+	alignas(ALIGN) std::atomic<size_t> m_head = 0; // next index to pop
+	size_t m_tailCache = 0; // consumer's copy of `m_tail`
+	
+	alignas(ALIGN) std::atomic<size_t> m_tail = 0; // next index to push
+	size_t m_headCache = 0; // producer's copy of `m_head`
+};
+
+}
+
+#endif /* MONO_MUSIC_MANAGER__SPSC_RING_H */
@@ -1,4 +1,9 @@
+#include <algorithm>
+#include <array>
 #include <fmt/compile.h>
+#include <limits>
+#include <map>
+#include <set>
 
 #include "Database-Sqlite3.h"
 #include "momuma/spdlog.h"
@@ -19,26 +24,52 @@ namespace Momuma::Database
 struct SqliteStmt
 {
 	sqlite3_stmt *_p;
+	StmtCache *_cache; // owner of `_p` when it was borrowed from a cache
 	
-	SqliteStmt(SqliteStmt &&other) : _p { other._p }
+	SqliteStmt(SqliteStmt &&other) : _p { other._p }, _cache { other._cache }
 	{
 		assert(this != &other);
 		other._p = nullptr;
+		other._cache = nullptr;
 	}
 	SqliteStmt(const SqliteStmt &other) = delete;
 	
-	SqliteStmt(void) : _p { nullptr } {}
-	~SqliteStmt(void) { (void)this->finalize(); }
+	SqliteStmt(void) : _p { nullptr }, _cache { nullptr } {}
+	~SqliteStmt(void)
+	{
+		if (_cache != nullptr) {
+			_cache->release(_p);
+		}
+		else {
+			(void)this->finalize();
+		}
+	}
 	
 	[[nodiscard]] inline bool operator==(const SqliteStmt &other) const { return _p == other._p; }
 	
+	[[nodiscard]] inline int bind_int64(int iParam, int64_t value)
+	{
+		return sqlite3_bind_int64(_p, iParam, value);
+	}
+	[[nodiscard]] inline int bind_null(int iParam)
+	{
+		return sqlite3_bind_null(_p, iParam);
+	}
 	[[nodiscard]] inline int bind_text(int iParam, const std::string &value)
 	{
 		return sqlite3_bind_text(_p,
 			iParam, value.c_str(), static_cast<int>(value.size()), SQLITE_TRANSIENT
 		);
 	}
+	// `value` must stay valid until the statement is reset or re-bound.
+	[[nodiscard]] inline int bind_text_static(int iParam, std::string_view value)
+	{
+		return sqlite3_bind_text(_p,
+			iParam, value.data(), static_cast<int>(value.size()), SQLITE_STATIC
+		);
+	}
 	
+	[[nodiscard]] inline int64_t column_int64(int iCol) { return sqlite3_column_int64(_p, iCol); }
 	[[nodiscard]] inline int column_bytes(int iCol) { return sqlite3_column_bytes(_p, iCol); }
 	[[nodiscard]] inline int column_count(void) { return sqlite3_column_count(_p); }
 	[[nodiscard]] inline const char* column_text(int iCol) { return reinterpret_cast<const char*>(sqlite3_column_text(_p, iCol)); }
@@ -52,10 +83,261 @@ struct SqliteStmt
 		const auto len = static_cast<int>(std::ssize(query));
 		return sqlite3_prepare_v2(db, query.c_str(), len, &_p, nullptr);
 	}
+	// Borrows the statement from `cache`, it's handed back (reset and unbound) on destruction.
+	[[nodiscard]] inline int prepare(StmtCache &cache, sqlite3 *const db, const std::string &query)
+	{
+		assert(_p == nullptr);
+		_cache = &cache;
+		return cache.acquire(db, query, _p);
+	}
 	[[nodiscard]] inline int reset(void) { return sqlite3_reset(_p); }
 	[[nodiscard]] inline int step(void) { return sqlite3_step(_p); }
 };
 
+// how long a connection retries while the database is locked by another one
+constexpr int BUSY_TIMEOUT_MS = 5000;
+
+// Scoped `BEGIN IMMEDIATE`, rolled back on destruction unless `commit()` succeeded.
+struct SqliteTransaction
+{
+	sqlite3 *const _db;
+	bool _open;
+	
+	explicit SqliteTransaction(sqlite3 *const db) : _db { db }, _open { false } {}
+	SqliteTransaction(const SqliteTransaction &other) = delete;
+	
+	~SqliteTransaction(void)
+	{
+		if (_open) { (void)this->exec("ROLLBACK;"); }
+	}
+	
+	[[nodiscard]] inline int begin(void)
+	{
+		assert(!_open);
+		const int rc = this->exec("BEGIN IMMEDIATE;");
+		_open = (rc == SQLITE_OK);
+		return rc;
+	}
+	[[nodiscard]] inline int commit(void)
+	{
+		assert(_open);
+		const int rc = this->exec("COMMIT;");
+		_open = (rc != SQLITE_OK);
+		return rc;
+	}
+	[[nodiscard]] inline int exec(const char *query)
+	{
+		return sqlite3_exec(_db, query, nullptr, nullptr, nullptr);
+	}
+};
+
+
+
+StmtCache::StmtCache(StmtCache &&other)
+{
+	assert(this != &other);
+	const std::lock_guard lock(other.m_mutex);
+	m_free = std::move(other.m_free);
+	other.m_free.clear();
+}
+
+StmtCache::~StmtCache(void)
+{
+	this->clear();
+}
+
+int StmtCache::acquire(sqlite3 *const db, const std::string &query, sqlite3_stmt *&stmt)
+{
+	{
+		const std::lock_guard lock(m_mutex);
+		if (auto it = m_free.find(query); it != m_free.end() && !it->second.empty()) {
+			stmt = it->second.back();
+			it->second.pop_back();
+			return SQLITE_OK;
+		}
+	}
+	
+	const auto len = static_cast<int>(std::ssize(query));
+	return sqlite3_prepare_v2(db, query.c_str(), len, &stmt, nullptr);
+}
+
+void StmtCache::release(sqlite3_stmt *const stmt)
+{
+	if (stmt == nullptr) { return; }
+	
+	// the error code of `sqlite3_reset()` is the one of the last step, which was already handled
+	(void)sqlite3_reset(stmt);
+	(void)sqlite3_clear_bindings(stmt);
+	
+	const std::string_view query = sqlite3_sql(stmt);
+	const std::lock_guard lock(m_mutex);
+	if (auto it = m_free.find(query); it != m_free.end()) {
+		it->second.push_back(stmt);
+	}
+	else {
+		m_free.emplace(query, std::vector { stmt });
+	}
+}
+
+void StmtCache::clear(void)
+{
+	const std::lock_guard lock(m_mutex);
+	for (auto &[query, stmts] : m_free) {
+		for (sqlite3_stmt *stmt : stmts) {
+			(void)sqlite3_finalize(stmt);
+		}
+	}
+	m_free.clear();
+}
+
+
+
+// A read-only connection of the `ConnectionPool`, used by one thread at a time.
+struct ReadConnection
+{
+	sqlite3 *_handle = nullptr;
+	StmtCache _stmtCache;
+};
+
+// Read-only connections to the database file, and the lock of the writer connection.
+class ConnectionPool
+{
+public:
+	std::recursive_mutex _writeMutex; // recursive for the queries made by callbacks
+	
+	/* #Opens `count` read-only connections to `dbFile`.
+	! @return: error code returned by the first failed `sqlite3_open_v2()`.
+	*/
+	[[nodiscard]] int open_readers(const fs::path &dbFile, unsigned count);
+	
+	// #Closes all read connections, none of them may be in use.
+	void close(void);
+	
+	// #Takes a free read connection out of the pool, `nullptr` when all of them are in use.
+	[[nodiscard]] ReadConnection* try_acquire(void);
+	void release(ReadConnection *conn);
+	
+private:
+	std::mutex m_mutex;
+	std::vector<std::unique_ptr<ReadConnection>> m_readers;
+	std::vector<ReadConnection*> m_free;
+};
+
+int ConnectionPool::open_readers(const fs::path &dbFile, const unsigned count)
+{
+	// every connection is only ever used by the thread which leased it
+	constexpr int OPEN_BITS = SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX | SQLITE_OPEN_NOFOLLOW;
+	
+	const std::lock_guard lock(m_mutex);
+	for (unsigned i = 0; i < count; ++i) {
+		auto conn = std::make_unique<ReadConnection>();
+		const int rc = sqlite3_open_v2(dbFile.c_str(), &conn->_handle, OPEN_BITS, nullptr);
+		if (rc != SQLITE_OK) {
+			(void)sqlite3_close_v2(conn->_handle);
+			return rc;
+		}
+		(void)sqlite3_busy_timeout(conn->_handle, BUSY_TIMEOUT_MS);
+		
+		m_free.push_back(conn.get());
+		m_readers.push_back(std::move(conn));
+	}
+	return SQLITE_OK;
+}
+
+void ConnectionPool::close(void)
+{
+	const std::lock_guard lock(m_mutex);
+	assert(m_free.size() == m_readers.size());
+	for (auto &conn : m_readers) {
+		conn->_stmtCache.clear();
+		if (const int rc = sqlite3_close_v2(conn->_handle); rc != SQLITE_OK) {
+			SPDLOG_CRITICAL("sqlite3_close_v2() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		}
+	}
+	m_free.clear();
+	m_readers.clear();
+}
+
+ReadConnection* ConnectionPool::try_acquire(void)
+{
+	const std::lock_guard lock(m_mutex);
+	if (m_free.empty()) { return nullptr; }
+	
+	ReadConnection *conn = m_free.back();
+	m_free.pop_back();
+	return conn;
+}
+
+void ConnectionPool::release(ReadConnection *const conn)
+{
+	const std::lock_guard lock(m_mutex);
+	m_free.push_back(conn);
+}
+
+// Read connection reserved by the current thread, see `ReservedReader`.
+struct ThreadReader
+{
+	ConnectionPool *pool = nullptr;
+	ReadConnection *conn = nullptr;
+};
+static thread_local ThreadReader t_reserved;
+
+/* #A read connection borrowed from the pool for the duration of a query.
+! The thread's reserved reader is used first. Falls back to the writer connection when no
+reader is free, so nested queries and databases without readers still work. The writer is
+then locked for the whole lease: a query must not see the rows of another thread's
+transaction, nor be aborted by its rollback.
+*/
+struct ReadLease
+{
+	ConnectionPool *const _pool;
+	const bool _reserved; // `_conn` stays with the thread instead of going back to the pool
+	ReadConnection *const _conn;
+	const std::unique_lock<std::recursive_mutex> _writerLock;
+	sqlite3 *const _handle;
+	StmtCache &_stmtCache;
+	
+	ReadLease(ConnectionPool *const pool, sqlite3 *const writer, StmtCache &writerCache) :
+		_pool { pool },
+		_reserved { pool != nullptr && t_reserved.pool == pool },
+		_conn { _reserved ? t_reserved.conn : (pool != nullptr) ? pool->try_acquire() : nullptr },
+		_writerLock { (pool != nullptr && _conn == nullptr)
+			? std::unique_lock(pool->_writeMutex)
+			: std::unique_lock<std::recursive_mutex>()
+		},
+		_handle { (_conn != nullptr) ? _conn->_handle : writer },
+		_stmtCache { (_conn != nullptr) ? _conn->_stmtCache : writerCache }
+	{}
+	ReadLease(const ReadLease &other) = delete;
+	
+	~ReadLease(void)
+	{
+		if (_conn != nullptr && !_reserved) { _pool->release(_conn); }
+	}
+};
+
+ReservedReader::ReservedReader(ConnectionPool *const pool, ReadConnection *const conn) :
+	m_pool { pool },
+	m_conn { conn }
+{
+	if (m_conn != nullptr) {
+		t_reserved = { m_pool, m_conn };
+	}
+}
+
+ReservedReader::~ReservedReader(void)
+{
+	if (m_conn != nullptr) {
+		t_reserved = {};
+		m_pool->release(m_conn);
+	}
+}
+
+ReservedReader::operator bool(void) const
+{
+	return m_conn != nullptr;
+}
+
 
 
 // Contains all table names, with the similarly named namespace holding the columns.
@@ -76,6 +358,89 @@ namespace Tab
 		constexpr const char NAME[] = "name"; // unique, not null
 	}
 	
+	constexpr const char MEDIA_INFO[] = "media_info";
+	namespace MediaInfo
+	{
+		constexpr const char PATH[] = "path"; // pk, not null
+		constexpr const char SIZE[] = "size"; // not null, bytes
+		constexpr const char MTIME[] = "mtime"; // not null, see `FileStamp::mtime`
+		constexpr const char DURATION[] = "duration"; // not null, microseconds
+	}
+	
+	constexpr const char MEDIA_TAGS[] = "media_tags";
+	namespace MediaTags
+	{
+		constexpr const char PATH[] = "path"; // pk, not null
+		constexpr const char SIZE[] = "size"; // not null, bytes
+		constexpr const char MTIME[] = "mtime"; // not null, see `FileStamp::mtime`
+		constexpr const char TITLE[] = "title";
+		constexpr const char ARTIST_ID[] = "artist_id"; // ref: > artists.id
+		constexpr const char ALBUM_ID[] = "album_id"; // ref: > albums.id
+		constexpr const char GENRE_ID[] = "genre_id"; // ref: > genres.id
+		constexpr const char TRACK[] = "track";
+		constexpr const char YEAR[] = "year";
+	}
+	
+	constexpr const char ARTISTS[] = "artists";
+	namespace Artists
+	{
+		constexpr const char ID[] = "id"; // pk, not null
+		constexpr const char NAME[] = "name"; // unique, not null
+	}
+	
+	constexpr const char ALBUMS[] = "albums";
+	namespace Albums
+	{
+		constexpr const char ID[] = "id"; // pk, not null
+		// not null, album artist or else artist of the files, 0 when unknown, ref: > artists.id
+		constexpr const char ARTIST_ID[] = "artist_id";
+		constexpr const char NAME[] = "name"; // not null, unique with `artist_id`
+	}
+	
+	constexpr const char GENRES[] = "genres";
+	namespace Genres
+	{
+		constexpr const char ID[] = "id"; // pk, not null
+		constexpr const char NAME[] = "name"; // unique, not null
+	}
+	
+	constexpr const char RESUME_POINTS[] = "resume_points";
+	namespace ResumePoints
+	{
+		constexpr const char PATH[] = "path"; // pk, not null
+		constexpr const char POSITION[] = "position"; // not null, microseconds
+	}
+	
+	constexpr const char PLAY_HISTORY[] = "play_history";
+	namespace PlayHistory
+	{
+		constexpr const char ID[] = "id"; // pk, not null, in recording order
+		constexpr const char PATH[] = "path"; // not null
+		constexpr const char KIND[] = "kind"; // not null, see `PlayEvent::Kind`
+		constexpr const char TIME[] = "time"; // not null, microseconds since the unix epoch
+		constexpr const char POSITION[] = "position"; // not null, microseconds
+	}
+	
+	constexpr const char PLAY_STATS[] = "play_stats";
+	namespace PlayStats
+	{
+		constexpr const char PATH[] = "path"; // pk, not null
+		constexpr const char PLAY_COUNT[] = "play_count"; // not null
+		constexpr const char SKIP_COUNT[] = "skip_count"; // not null
+		constexpr const char LAST_PLAYED[] = "last_played"; // like `play_history.time`
+	}
+	
+	// full-text indexes, external content tables kept in sync by triggers
+	constexpr const char FILES_FTS[] = "files_fts"; // content: files.name
+	constexpr const char PLAYLISTS_FTS[] = "playlists_fts"; // content: playlists.name
+	
+	// playlists whose files were written by `set_playlist_data()` and aren't in `files_fts` yet
+	constexpr const char FILES_FTS_DEFERRED[] = "files_fts_deferred";
+	namespace FilesFtsDeferred
+	{
+		constexpr const char PLAYLIST_ID[] = "playlist_id"; // pk, not null, ref: > playlists.id
+	}
+	
 	constexpr const char DB_VERSION[] = "database_version";
 	namespace DbVersion
 	{
@@ -84,6 +449,20 @@ namespace Tab
 	}
 }
 
+// Contains all index names.
+namespace Idx
+{
+	// covers `get_media_paths()`: (playlist_id, index) -> name
+	constexpr const char FILES_BY_PLAYLIST[] = "files_by_playlist";
+	// lookups of a file by its name: (playlist_id, name)
+	constexpr const char FILES_BY_NAME[] = "files_by_name";
+	// sorting and grouping tagged files: artist_id, album_id
+	constexpr const char MEDIA_TAGS_BY_ARTIST[] = "media_tags_by_artist";
+	constexpr const char MEDIA_TAGS_BY_ALBUM[] = "media_tags_by_album";
+	// finding whether a genre is still used: genre_id
+	constexpr const char MEDIA_TAGS_BY_GENRE[] = "media_tags_by_genre";
+}
+
 namespace Directory
 {
 	constexpr const char DB_FILE[] = "sqlite3.db"; // the database file name
@@ -93,6 +472,38 @@ namespace Directory
 }
 
 
+/* #Converts `media` to the name stored in the `files` table.
+! Media inside of the playlist's folder is stored relative to it, anything else is kept as-is.
+*/
+[[nodiscard]] static
+fs::path to_stored_name(const fs::path &playlistFolder, const fs::path &media)
+{
+	fs::path relative = media.lexically_relative(playlistFolder);
+	if (relative.empty() || *relative.begin() == "..") {
+		return media;
+	}
+	return relative;
+}
+
+/* #Builds an insert of `rows` rows into the `files` table.
+! `?1` is the playlist id, `?2` + 2n and `?3` + 2n are the index and the name of row `n`.
+*/
+[[nodiscard]] static
+std::string make_files_insert_query(const int rows)
+{
+	assert(rows > 0);
+	std::string query = fmt::format("INSERT INTO [{}] ([{}], [{}], [{}]) VALUES ",
+		Tab::FILES, Tab::Files::PLAYLIST_ID, Tab::Files::INDEX, Tab::Files::NAME
+	);
+	for (int row = 0; row < rows; ++row) {
+		fmt::format_to(std::back_inserter(query), "{:s}(?1, ?{:d}, ?{:d})",
+			(row == 0 ? "" : ", "), 2 + 2 * row, 3 + 2 * row
+		);
+	}
+	query += ';';
+	return query;
+}
+
 [[nodiscard]] static
 int create_and_open_database(
 	sqlite3 *&handleRef, const fs::path &fullFolderPath, const StorageType storage
@@ -117,7 +528,275 @@ int create_and_open_database(
 	);
 }
 
-/* #Creates the SQL database tables
+/* #Builds the creation of a trigram FTS5 index over `table.column`.
+! The index doesn't store a copy of the text, triggers keep it in sync with `table` and
+the rows existing before the index are indexed by a rebuild.
+*/
+[[nodiscard]] static
+std::string make_fts_query(const char *fts, const char *table, const char *column)
+{
+	return fmt::format(
+		R"(CREATE VIRTUAL TABLE IF NOT EXISTS [{0}] USING fts5(
+			[{2}], content=[{1}], content_rowid=[rowid], tokenize='trigram'
+		);
+		CREATE TRIGGER IF NOT EXISTS [{0}_insert] AFTER INSERT ON [{1}] BEGIN
+			INSERT INTO [{0}] ([rowid], [{2}]) VALUES (new.[rowid], new.[{2}]);
+		END;
+		CREATE TRIGGER IF NOT EXISTS [{0}_delete] AFTER DELETE ON [{1}] BEGIN
+			INSERT INTO [{0}] ([{0}], [rowid], [{2}]) VALUES ('delete', old.[rowid], old.[{2}]);
+		END;
+		CREATE TRIGGER IF NOT EXISTS [{0}_update] AFTER UPDATE OF [{2}] ON [{1}] BEGIN
+			INSERT INTO [{0}] ([{0}], [rowid], [{2}]) VALUES ('delete', old.[rowid], old.[{2}]);
+			INSERT INTO [{0}] ([rowid], [{2}]) VALUES (new.[rowid], new.[{2}]);
+		END;
+		INSERT INTO [{0}] ([{0}]) VALUES ('rebuild');)",
+		fts, table, column
+	);
+}
+
+/* #Converts user input to a full-text query matching it as a substring.
+! @return: the input as a single quoted phrase, `std::nullopt` if it's shorter than the
+3 characters needed by the trigram tokenizer.
+*/
+[[nodiscard]] static
+std::optional<std::string> make_fts_phrase(const std::string_view text)
+{
+	// counts UTF-8 code points, continuation bytes look like 0b10xxxxxx
+	const auto chars = std::count_if(text.begin(), text.end(), [](const char c) {
+		return (static_cast<unsigned char>(c) & 0xC0) != 0x80;
+	});
+	if (chars < 3) {
+		return std::nullopt;
+	}
+	
+	std::string phrase = "\"";
+	for (const char c : text) {
+		if (c == '"') { phrase += '"'; }
+		phrase += c;
+	}
+	phrase += '"';
+	return phrase;
+}
+
+// A schema change which upgrades the database to `version`.
+struct Migration
+{
+	int version;
+	const char *notes;
+	std::string query;
+};
+
+/* #All schema changes made after the initial tables, in ascending `version` order.
+! Existing entries must never be modified, new changes are appended with the next version.
+*/
+[[nodiscard]] static
+const std::vector<Migration>& get_migrations(void)
+{
+	static const std::vector<Migration> migrations = {
+		{
+			1, "covering index for loading playlists",
+			fmt::format(
+				R"(CREATE INDEX IF NOT EXISTS [{}] ON [{}] ([{}], [{}], [{}]);)",
+				Idx::FILES_BY_PLAYLIST, Tab::FILES,
+				Tab::Files::PLAYLIST_ID, Tab::Files::INDEX, Tab::Files::NAME
+			),
+		},
+		{
+			2, "cache of media durations",
+			fmt::format(
+				R"(CREATE TABLE IF NOT EXISTS [{}] (
+					[{}] TEXT NOT NULL PRIMARY KEY,
+					[{}] INTEGER NOT NULL, [{}] INTEGER NOT NULL, [{}] INTEGER NOT NULL
+				) STRICT, WITHOUT ROWID;)",
+				Tab::MEDIA_INFO, Tab::MediaInfo::PATH,
+				Tab::MediaInfo::SIZE, Tab::MediaInfo::MTIME, Tab::MediaInfo::DURATION
+			),
+		},
+		{
+			3, "index for finding files by name",
+			fmt::format(
+				R"(CREATE INDEX IF NOT EXISTS [{}] ON [{}] ([{}], [{}]);)",
+				Idx::FILES_BY_NAME, Tab::FILES, Tab::Files::PLAYLIST_ID, Tab::Files::NAME
+			),
+		},
+		{
+			4, "full-text search over file and playlist names",
+			make_fts_query(Tab::FILES_FTS, Tab::FILES, Tab::Files::NAME)
+				+ make_fts_query(Tab::PLAYLISTS_FTS, Tab::PLAYLISTS, Tab::Playlists::NAME),
+		},
+		{
+			5, "media tags with artists, albums and genres",
+			fmt::format(
+				R"(CREATE TABLE IF NOT EXISTS [{0}] (
+					[{1}] INTEGER NOT NULL PRIMARY KEY, [{2}] TEXT NOT NULL UNIQUE
+				) STRICT;
+				CREATE TABLE IF NOT EXISTS [{3}] (
+					[{4}] INTEGER NOT NULL PRIMARY KEY, [{5}] INTEGER NOT NULL,
+					[{6}] TEXT NOT NULL, UNIQUE([{5}], [{6}])
+				) STRICT;
+				CREATE TABLE IF NOT EXISTS [{7}] (
+					[{8}] INTEGER NOT NULL PRIMARY KEY, [{9}] TEXT NOT NULL UNIQUE
+				) STRICT;)",
+				Tab::ARTISTS, Tab::Artists::ID, Tab::Artists::NAME,
+				Tab::ALBUMS, Tab::Albums::ID, Tab::Albums::ARTIST_ID, Tab::Albums::NAME,
+				Tab::GENRES, Tab::Genres::ID, Tab::Genres::NAME
+			) + fmt::format(
+				R"(CREATE TABLE IF NOT EXISTS [{0}] (
+					[{1}] TEXT NOT NULL PRIMARY KEY,
+					[{2}] INTEGER NOT NULL, [{3}] INTEGER NOT NULL, [{4}] TEXT,
+					[{5}] INTEGER, [{6}] INTEGER, [{7}] INTEGER, [{8}] INTEGER, [{9}] INTEGER
+				) STRICT, WITHOUT ROWID;
+				CREATE INDEX IF NOT EXISTS [{10}] ON [{0}] ([{5}]);
+				CREATE INDEX IF NOT EXISTS [{11}] ON [{0}] ([{6}], [{8}]);)",
+				Tab::MEDIA_TAGS, Tab::MediaTags::PATH,
+				Tab::MediaTags::SIZE, Tab::MediaTags::MTIME, Tab::MediaTags::TITLE,
+				Tab::MediaTags::ARTIST_ID, Tab::MediaTags::ALBUM_ID, Tab::MediaTags::GENRE_ID,
+				Tab::MediaTags::TRACK, Tab::MediaTags::YEAR,
+				Idx::MEDIA_TAGS_BY_ARTIST, Idx::MEDIA_TAGS_BY_ALBUM
+			),
+		},
+		{
+			6, "resume points of long media",
+			fmt::format(
+				R"(CREATE TABLE IF NOT EXISTS [{}] (
+					[{}] TEXT NOT NULL PRIMARY KEY, [{}] INTEGER NOT NULL
+				) STRICT, WITHOUT ROWID;)",
+				Tab::RESUME_POINTS, Tab::ResumePoints::PATH, Tab::ResumePoints::POSITION
+			),
+		},
+		{
+			7, "play history and statistics",
+			fmt::format(
+				R"(CREATE TABLE IF NOT EXISTS [{0}] (
+					[{1}] INTEGER NOT NULL PRIMARY KEY, [{2}] TEXT NOT NULL,
+					[{3}] INTEGER NOT NULL, [{4}] INTEGER NOT NULL, [{5}] INTEGER NOT NULL
+				) STRICT;
+				CREATE TABLE IF NOT EXISTS [{6}] (
+					[{7}] TEXT NOT NULL PRIMARY KEY,
+					[{8}] INTEGER NOT NULL, [{9}] INTEGER NOT NULL, [{10}] INTEGER
+				) STRICT, WITHOUT ROWID;)",
+				Tab::PLAY_HISTORY, Tab::PlayHistory::ID, Tab::PlayHistory::PATH,
+				Tab::PlayHistory::KIND, Tab::PlayHistory::TIME, Tab::PlayHistory::POSITION,
+				Tab::PLAY_STATS, Tab::PlayStats::PATH,
+				Tab::PlayStats::PLAY_COUNT, Tab::PlayStats::SKIP_COUNT, Tab::PlayStats::LAST_PLAYED
+			),
+		},
+		{
+			8, "index of tagged files by genre, removal of unused tag names",
+			fmt::format(
+				R"(CREATE INDEX IF NOT EXISTS [{0}] ON [{1}] ([{2}]);
+				DELETE FROM [{3}] WHERE [{4}] NOT IN (
+					SELECT [{5}] FROM [{1}] WHERE [{5}] IS NOT NULL
+				);
+				DELETE FROM [{6}] WHERE [{7}] NOT IN (
+					SELECT [{8}] FROM [{1}] WHERE [{8}] IS NOT NULL
+				) AND [{7}] NOT IN (SELECT [{9}] FROM [{3}]);
+				DELETE FROM [{10}] WHERE [{11}] NOT IN (
+					SELECT [{2}] FROM [{1}] WHERE [{2}] IS NOT NULL
+				);)",
+				Idx::MEDIA_TAGS_BY_GENRE, Tab::MEDIA_TAGS, Tab::MediaTags::GENRE_ID,
+				Tab::ALBUMS, Tab::Albums::ID, Tab::MediaTags::ALBUM_ID,
+				Tab::ARTISTS, Tab::Artists::ID, Tab::MediaTags::ARTIST_ID, Tab::Albums::ARTIST_ID,
+				Tab::GENRES, Tab::Genres::ID
+			),
+		},
+		{
+			9, "deferred indexing of the files of playlists written in bulk",
+			fmt::format(
+				R"(CREATE TABLE IF NOT EXISTS [{0}] (
+					[{1}] INTEGER NOT NULL PRIMARY KEY
+				) STRICT;
+				DROP TRIGGER IF EXISTS [{2}_insert];
+				CREATE TRIGGER [{2}_insert] AFTER INSERT ON [{3}]
+				WHEN NOT EXISTS (SELECT 1 FROM [{0}] WHERE [{1}] = new.[{4}]) BEGIN
+					INSERT INTO [{2}] ([rowid], [{5}]) VALUES (new.[rowid], new.[{5}]);
+				END;
+				DROP TRIGGER IF EXISTS [{2}_delete];
+				CREATE TRIGGER [{2}_delete] AFTER DELETE ON [{3}]
+				WHEN NOT EXISTS (SELECT 1 FROM [{0}] WHERE [{1}] = old.[{4}]) BEGIN
+					INSERT INTO [{2}] ([{2}], [rowid], [{5}]) VALUES ('delete', old.[rowid], old.[{5}]);
+				END;
+				DROP TRIGGER IF EXISTS [{2}_update];
+				CREATE TRIGGER [{2}_update] AFTER UPDATE OF [{5}] ON [{3}]
+				WHEN NOT EXISTS (SELECT 1 FROM [{0}] WHERE [{1}] = old.[{4}]) BEGIN
+					INSERT INTO [{2}] ([{2}], [rowid], [{5}]) VALUES ('delete', old.[rowid], old.[{5}]);
+					INSERT INTO [{2}] ([rowid], [{5}]) VALUES (new.[rowid], new.[{5}]);
+				END;)",
+				Tab::FILES_FTS_DEFERRED, Tab::FilesFtsDeferred::PLAYLIST_ID,
+				Tab::FILES_FTS, Tab::FILES, Tab::Files::PLAYLIST_ID, Tab::Files::NAME
+			),
+		},
+	};
+	return migrations;
+}
+
+/* #Upgrades the schema to the latest version, recorded in the `database_version` table.
+! All pending migrations are applied in a single transaction.
+! @return: error code returned by the first failed sqlite3 query.
+*/
+[[nodiscard]] static
+int migrate_database(sqlite3 &db)
+{
+	static const std::string versionQuery = fmt::format(
+		R"(SELECT IFNULL(MAX([{}]), 0) FROM [{}];)",
+		Tab::DbVersion::VERSION, Tab::DB_VERSION
+	);
+	static const std::string insertQuery = fmt::format(
+		R"(INSERT INTO [{}] ([{}], [{}]) VALUES(?1, ?2);)",
+		Tab::DB_VERSION, Tab::DbVersion::VERSION, Tab::DbVersion::NOTES
+	);
+	const std::vector<Migration> &migrations = get_migrations();
+	
+	SqliteTransaction transaction(&db);
+	if (const int rc = transaction.begin(); rc != SQLITE_OK) {
+		return rc;
+	}
+	
+	int64_t version = 0;
+	{
+		SqliteStmt stmt;
+		if (const int rc = stmt.prepare(&db, versionQuery); rc != SQLITE_OK) {
+			return rc;
+		}
+		if (const int rc = stmt.step(); rc != SQLITE_ROW) {
+			return rc;
+		}
+		version = stmt.column_int64(0);
+	}
+	
+	if (version > migrations.back().version) {
+		SPDLOG_ERROR("Database version {:d} is newer than the supported version {:d}",
+			version, migrations.back().version
+		);
+		return SQLITE_ERROR;
+	}
+	
+	for (const Migration &migration : migrations) {
+		if (migration.version <= version) { continue; }
+		SPDLOG_INFO("Migrating database to version {:d}: {:s}", migration.version, migration.notes);
+		
+		int rc = transaction.exec(migration.query.c_str());
+		if (rc != SQLITE_OK) {
+			SPDLOG_ERROR("Migration failed ({:d}): {:s}", rc, sqlite3_errmsg(&db));
+			return rc;
+		}
+		
+		SqliteStmt stmt;
+		if (rc = stmt.prepare(&db, insertQuery); rc != SQLITE_OK) {
+			return rc;
+		}
+		[[maybe_unused]] int bindRc = stmt.bind_int64(1, migration.version);
+		assert(bindRc == SQLITE_OK);
+		if (stmt.bind_text(2, migration.notes) == SQLITE_NOMEM) { throw std::bad_alloc(); }
+		if (rc = stmt.step(); rc != SQLITE_DONE) {
+			return rc;
+		}
+	}
+	
+	return transaction.commit();
+}
+
+/* #Creates the SQL database tables and applies all pending migrations.
 ! @return: error code returned by the first failed sqlite3 query.
 */
 [[nodiscard]] static
@@ -153,12 +832,31 @@ int create_database_tables(sqlite3 &db)
 	);
 	
 	const int code = sqlite3_exec(&db, query.c_str(), nullptr, nullptr, nullptr);
-	return code;
+	if (code != SQLITE_OK) {
+		return code;
+	}
+	return migrate_database(db);
+}
+
+std::optional<FileStamp> FileStamp::of(const fs::path &path)
+{
+	std::error_code err;
+	const auto size = fs::file_size(path, err);
+	if (err) { return std::nullopt; }
+	const fs::file_time_type mtime = fs::last_write_time(path, err);
+	if (err) { return std::nullopt; }
+	
+	return FileStamp {
+		.path = path,
+		.size = static_cast<int64_t>(size),
+		.mtime = chrono::duration_cast<chrono::nanoseconds>(mtime.time_since_epoch()).count(),
+	};
 }
 
-Sqlite3::Sqlite3(const fs::path &fullFolderPath, const StorageType storage) :
+Sqlite3::Sqlite3(const fs::path &fullFolderPath, const StorageType storage, const unsigned readers) :
 	_handle { nullptr },
-	m_path { fullFolderPath }
+	m_path { fullFolderPath },
+	m_pool { std::make_unique<ConnectionPool>() }
 {
 	int err = create_and_open_database(_handle, fullFolderPath, storage);
 	if (err != SQLITE_OK) {
@@ -173,11 +871,35 @@ Sqlite3::Sqlite3(const fs::path &fullFolderPath, const StorageType storage) :
 		this->close_handle();
 		return;
 	}
+	
+	if (readers == 0) {
+		return;
+	}
+	if (storage == StorageType::MEMORY) {
+		SPDLOG_WARN("In-memory databases can't share read connections, ignoring {:d}", readers);
+		return;
+	}
+	
+	(void)sqlite3_busy_timeout(_handle, BUSY_TIMEOUT_MS);
+	err = sqlite3_exec(_handle,
+		"PRAGMA journal_mode = WAL; PRAGMA synchronous = NORMAL;", nullptr, nullptr, nullptr
+	);
+	if (err == SQLITE_OK) {
+		err = m_pool->open_readers(fullFolderPath / Directory::DB_FILE, readers);
+	}
+	if (err != SQLITE_OK) {
+		SPDLOG_ERROR("Failed to open read connections ({:d}): {:s}", err, sqlite3_errstr(err));
+		this->close_handle();
+		return;
+	}
+	SPDLOG_DEBUG("Opened {:d} read connections in WAL mode", readers);
 }
 
 Sqlite3::Sqlite3(Sqlite3 &&other) :
 	_handle { other._handle },
-	m_path { std::move(other.m_path) }
+	m_path { std::move(other.m_path) },
+	m_stmtCache { std::move(other.m_stmtCache) },
+	m_pool { std::move(other.m_pool) }
 {
 	assert(this != &other);
 	other._handle = nullptr;
@@ -193,11 +915,29 @@ Sqlite3::operator bool(void) const
 	return _handle != nullptr;
 }
 
+ReservedReader Sqlite3::reserve_reader(void)
+{
+	if (m_pool == nullptr || t_reserved.pool != nullptr) {
+		return ReservedReader(nullptr, nullptr);
+	}
+	return ReservedReader(m_pool.get(), m_pool->try_acquire());
+}
+
 fs::path Sqlite3::get_database_location(void) noexcept
 {
 	return m_path;
 }
 
+fs::path Sqlite3::get_playlists_location(void) noexcept
+{
+	return m_path / Directory::PLAYLISTS;
+}
+
+fs::path Sqlite3::get_playlist_location(const std::string &playlist)
+{
+	return this->get_playlists_location() / playlist;
+}
+
 int Sqlite3::get_playlists(sigc::slot<IterFlag(std::string)> callback)
 {
 	static const std::string query = fmt::format(
@@ -205,8 +945,9 @@ int Sqlite3::get_playlists(sigc::slot<IterFlag(std::string)> callback)
 		Tab::Playlists::NAME, Tab::PLAYLISTS
 	);
 	
+	const ReadLease conn(m_pool.get(), _handle, m_stmtCache);
 	SqliteStmt stmt;
-	if (const int rc = stmt.prepare(_handle, query); rc != SQLITE_OK) {
+	if (const int rc = stmt.prepare(conn._stmtCache, conn._handle, query); rc != SQLITE_OK) {
 		SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
 		return -1;
 	}
@@ -217,7 +958,7 @@ int Sqlite3::get_playlists(sigc::slot<IterFlag(std::string)> callback)
 		ASSERT_SQLITE_COLUMN(stmt, COLUMN, SQLITE3_TEXT, Tab::Playlists::NAME);
 		
 		const char *playlist = stmt.column_text(COLUMN);
-		if (playlist == nullptr && sqlite3_errcode(_handle) == SQLITE_NOMEM) {
+		if (playlist == nullptr && sqlite3_errcode(conn._handle) == SQLITE_NOMEM) {
 			throw std::bad_alloc();
 		}
 		const int len = stmt.column_bytes(COLUMN);
@@ -242,8 +983,9 @@ bool Sqlite3::create_playlist(const std::string &playlist)
 		Tab::PLAYLISTS, Tab::Playlists::NAME, BOUND_PARAM
 	);
 	
+	const auto lock = this->lock_writer();
 	SqliteStmt stmt;
-	if (const int rc = stmt.prepare(_handle, query); rc != SQLITE_OK) {
+	if (const int rc = stmt.prepare(m_stmtCache, _handle, query); rc != SQLITE_OK) {
 		SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
 		return false;
 	}
@@ -263,65 +1005,1261 @@ bool Sqlite3::create_playlist(const std::string &playlist)
 	}
 }
 
-bool Sqlite3::remove_playlist(const std::string &/*playlist*/)
+bool Sqlite3::remove_playlist(const std::string &playlist)
 {
-	assert(!bool("Not implemented"));
-	return false;
+	return this->apply_file_changes({
+		FileChange { .kind = FileChange::Kind::REMOVE_PLAYLIST, .playlist = playlist },
+	});
 }
 
-int Sqlite3::get_media_paths(const std::string &playlist, sigc::slot<IterFlag(fs::path)> callback)
+/* #Query of the `(index, name)` rows of a playlist, in the stored playing order.
+! `?1` is the playlist.
+*/
+[[nodiscard]] static
+const std::string& playlist_media_query(void)
 {
-	// location to insert `playlist` in the query (to avoid an SQL injection).
-	constexpr int BOUND_PARAM = 1;
 	static const std::string query = fmt::format(
-		R"(SELECT [{}] FROM [{}] WHERE [{}] = (
-			SELECT [{}] FROM [{}] WHERE [{}] = ?{:d}
+		R"(SELECT [{}], [{}] FROM [{}] WHERE [{}] = (
+			SELECT [{}] FROM [{}] WHERE [{}] = ?1
 		) ORDER BY [{}] ASC;)",
-		Tab::Files::NAME, Tab::FILES, Tab::Files::PLAYLIST_ID,
-		Tab::Playlists::ID, Tab::PLAYLISTS, Tab::Playlists::NAME, BOUND_PARAM,
+		Tab::Files::INDEX, Tab::Files::NAME, Tab::FILES, Tab::Files::PLAYLIST_ID,
+		Tab::Playlists::ID, Tab::PLAYLISTS, Tab::Playlists::NAME,
 		Tab::Files::INDEX
 	);
+	return query;
+}
+
+/* #Appends at most `limit` of the `(index, name)` rows of `stmt` to `batch`.
+! @return: the `sqlite3_step()` code which ended the loop, `SQLITE_DONE` once all rows were
+read and `SQLITE_ROW` when `limit` was reached first.
+*/
+[[nodiscard]] static
+int read_media_rows(
+	SqliteStmt &stmt, sqlite3 *handle, MediaBatch &batch,
+	const size_t limit = std::numeric_limits<size_t>::max()
+) {
+	constexpr int INDEX_COLUMN = 0;
+	constexpr int NAME_COLUMN = 1;
 	
-	SqliteStmt stmt;
-	if (const int rc = stmt.prepare(_handle, query); rc != SQLITE_OK) {
-		SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
-		return -1;
+	batch.offsets.push_back(0);
+	int rcode = SQLITE_ROW;
+	for (size_t rows = 0; rows < limit && (rcode = stmt.step()) == SQLITE_ROW; ++rows) {
+		ASSERT_SQLITE_COLUMN(stmt, INDEX_COLUMN, SQLITE_INTEGER, Tab::Files::INDEX);
+		ASSERT_SQLITE_COLUMN(stmt, NAME_COLUMN, SQLITE3_TEXT, Tab::Files::NAME);
+		
+		const char *filename = stmt.column_text(NAME_COLUMN);
+		if (filename == nullptr && sqlite3_errcode(handle) == SQLITE_NOMEM) {
+			throw std::bad_alloc();
+		}
+		const int len = stmt.column_bytes(NAME_COLUMN);
+		
+		batch.arena.append(filename, static_cast<size_t>(len));
+		batch.offsets.push_back(batch.arena.size());
+		batch.indexes.push_back(stmt.column_int64(INDEX_COLUMN));
 	}
-	if (stmt.bind_text(BOUND_PARAM, playlist) == SQLITE_NOMEM) { throw std::bad_alloc(); }
-	
-	const fs::path base = this->get_database_location() / Directory::PLAYLISTS / playlist;
 	
-	int rcode = 0, iterations = 0;
+	if (rcode != SQLITE_DONE && rcode != SQLITE_ROW) {
+		SPDLOG_ERROR("sqlite3_step() failed ({:d}): {:s}", rcode, sqlite3_errstr(rcode));
+		batch.clear();
+	}
+	else if (batch.offsets.size() == 1) {
+		batch.offsets.clear();
+	}
+	return rcode;
+}
+
+int Sqlite3::get_media_paths(const std::string &playlist, sigc::slot<IterFlag(fs::path)> callback)
+{
+	// rows are read in chunks between the callbacks, stopping early skips the remaining ones
+	constexpr size_t CHUNK_ROWS = 256;
+	
+	const std::string &query = playlist_media_query();
+	
+	const ReadLease conn(m_pool.get(), _handle, m_stmtCache);
+	SqliteStmt stmt;
+	if (const int rc = stmt.prepare(conn._stmtCache, conn._handle, query); rc != SQLITE_OK) {
+		SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return -1;
+	}
+	if (stmt.bind_text(1, playlist) == SQLITE_NOMEM) { throw std::bad_alloc(); }
+	
+	const fs::path base = this->get_playlist_location(playlist);
+	MediaBatch batch;
+	int iterations = 0;
+	int rcode = SQLITE_ROW;
+	while (rcode == SQLITE_ROW) {
+		batch.clear();
+		rcode = read_media_rows(stmt, conn._handle, batch, CHUNK_ROWS);
+		if (rcode != SQLITE_ROW && rcode != SQLITE_DONE) {
+			return -1;
+		}
+		for (size_t i = 0; i < batch.size(); ++i) {
+			++iterations;
+			const IterFlag res = callback(base / batch[i]);
+			if (res == IterFlag::STOP) { return iterations; }
+		}
+	}
+	return iterations;
+}
+
+int Sqlite3::get_media_names(const std::string &playlist, MediaBatch &batch)
+{
+	batch.clear();
+	
+	const std::string &query = playlist_media_query();
+	
+	const ReadLease conn(m_pool.get(), _handle, m_stmtCache);
+	SqliteStmt stmt;
+	if (const int rc = stmt.prepare(conn._stmtCache, conn._handle, query); rc != SQLITE_OK) {
+		SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return -1;
+	}
+	if (stmt.bind_text(1, playlist) == SQLITE_NOMEM) { throw std::bad_alloc(); }
+	
+	if (read_media_rows(stmt, conn._handle, batch) != SQLITE_DONE) {
+		return -1;
+	}
+	return static_cast<int>(batch.size());
+}
+
+const std::string& Sqlite3::media_window_query(void)
+{
+	// the range seeks in `files_by_playlist` instead of skipping rows like `OFFSET` does
+	static const std::string query = fmt::format(
+		R"(SELECT [{}], [{}] FROM [{}] WHERE [{}] = (
+			SELECT [{}] FROM [{}] WHERE [{}] = ?1
+		) AND [{}] >= ?2 ORDER BY [{}] ASC LIMIT ?3;)",
+		Tab::Files::INDEX, Tab::Files::NAME, Tab::FILES, Tab::Files::PLAYLIST_ID,
+		Tab::Playlists::ID, Tab::PLAYLISTS, Tab::Playlists::NAME,
+		Tab::Files::INDEX, Tab::Files::INDEX
+	);
+	return query;
+}
+
+int Sqlite3::get_media_window(
+	const std::string &playlist, const int64_t fromIndex, const int limit, MediaBatch &batch
+) {
+	const std::string &query = media_window_query();
+	batch.clear();
+	if (limit <= 0) {
+		return 0;
+	}
+	
+	const ReadLease conn(m_pool.get(), _handle, m_stmtCache);
+	SqliteStmt stmt;
+	if (const int rc = stmt.prepare(conn._stmtCache, conn._handle, query); rc != SQLITE_OK) {
+		SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return -1;
+	}
+	if (stmt.bind_text(1, playlist) == SQLITE_NOMEM) { throw std::bad_alloc(); }
+	[[maybe_unused]] int rc = stmt.bind_int64(2, fromIndex);
+	assert(rc == SQLITE_OK);
+	rc = stmt.bind_int64(3, limit);
+	assert(rc == SQLITE_OK);
+	
+	if (read_media_rows(stmt, conn._handle, batch) != SQLITE_DONE) {
+		return -1;
+	}
+	return static_cast<int>(batch.size());
+}
+
+int Sqlite3::search_media(const std::string &text, const int limit, std::vector<SearchHit> &hits)
+{
+	// `?1` is the full-text query, `?2` the maximum number of hits.
+	// The limit is applied inside of the full-text query, which only keeps the best hits.
+	static const std::string query = fmt::format(
+		R"(SELECT p.[{}], f.[{}], f.[{}] FROM (
+			SELECT [rowid], [rank] FROM [{}] WHERE [{}] MATCH ?1 ORDER BY [rank] LIMIT ?2
+		) AS m
+		JOIN [{}] AS f ON f.[rowid] = m.[rowid]
+		JOIN [{}] AS p ON p.[{}] = f.[{}]
+		ORDER BY m.[rank];)",
+		Tab::Playlists::NAME, Tab::Files::NAME, Tab::Files::INDEX,
+		Tab::FILES_FTS, Tab::FILES_FTS,
+		Tab::FILES,
+		Tab::PLAYLISTS, Tab::Playlists::ID, Tab::Files::PLAYLIST_ID
+	);
+	hits.clear();
+	const std::optional<std::string> phrase = make_fts_phrase(text);
+	if (!phrase.has_value() || limit <= 0) {
+		return 0;
+	}
+	if (!this->index_deferred_files()) {
+		return -1;
+	}
+	
+	const ReadLease conn(m_pool.get(), _handle, m_stmtCache);
+	SqliteStmt stmt;
+	if (const int rc = stmt.prepare(conn._stmtCache, conn._handle, query); rc != SQLITE_OK) {
+		SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return -1;
+	}
+	if (stmt.bind_text(1, *phrase) == SQLITE_NOMEM) { throw std::bad_alloc(); }
+	[[maybe_unused]] const int bindRc = stmt.bind_int64(2, limit);
+	assert(bindRc == SQLITE_OK);
+	
+	int rcode = 0;
+	while ((rcode = stmt.step()) == SQLITE_ROW) {
+		ASSERT_SQLITE_COLUMN(stmt, 0, SQLITE3_TEXT, Tab::Playlists::NAME);
+		ASSERT_SQLITE_COLUMN(stmt, 1, SQLITE3_TEXT, Tab::Files::NAME);
+		ASSERT_SQLITE_COLUMN(stmt, 2, SQLITE_INTEGER, Tab::Files::INDEX);
+		
+		const char *playlist = stmt.column_text(0);
+		const char *name = stmt.column_text(1);
+		if ((playlist == nullptr || name == nullptr)
+			&& sqlite3_errcode(conn._handle) == SQLITE_NOMEM
+		) {
+			throw std::bad_alloc();
+		}
+		hits.push_back({
+			.playlist = std::string(playlist, static_cast<size_t>(stmt.column_bytes(0))),
+			.name = std::string(name, static_cast<size_t>(stmt.column_bytes(1))),
+			.index = stmt.column_int64(2),
+		});
+	}
+	
+	if (rcode != SQLITE_DONE) {
+		SPDLOG_ERROR("sqlite3_step() failed ({:d}): {:s}", rcode, sqlite3_errstr(rcode));
+		hits.clear();
+		return -1;
+	}
+	return static_cast<int>(hits.size());
+}
+
+int Sqlite3::search_playlists(
+	const std::string &text, const int limit, std::vector<std::string> &playlists
+) {
+	static const std::string query = fmt::format(
+		R"(SELECT [{}] FROM [{}] WHERE [{}] MATCH ?1 ORDER BY [rank] LIMIT ?2;)",
+		Tab::Playlists::NAME, Tab::PLAYLISTS_FTS, Tab::PLAYLISTS_FTS
+	);
+	playlists.clear();
+	const std::optional<std::string> phrase = make_fts_phrase(text);
+	if (!phrase.has_value() || limit <= 0) {
+		return 0;
+	}
+	
+	const ReadLease conn(m_pool.get(), _handle, m_stmtCache);
+	SqliteStmt stmt;
+	if (const int rc = stmt.prepare(conn._stmtCache, conn._handle, query); rc != SQLITE_OK) {
+		SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return -1;
+	}
+	if (stmt.bind_text(1, *phrase) == SQLITE_NOMEM) { throw std::bad_alloc(); }
+	[[maybe_unused]] const int bindRc = stmt.bind_int64(2, limit);
+	assert(bindRc == SQLITE_OK);
+	
+	int rcode = 0;
 	while ((rcode = stmt.step()) == SQLITE_ROW) {
 		constexpr int COLUMN = 0;
-		ASSERT_SQLITE_COLUMN(stmt, COLUMN, SQLITE3_TEXT, Tab::Files::NAME);
+		ASSERT_SQLITE_COLUMN(stmt, COLUMN, SQLITE3_TEXT, Tab::Playlists::NAME);
 		
-		const char *filename = stmt.column_text(COLUMN);
-		if (filename == nullptr && sqlite3_errcode(_handle) == SQLITE_NOMEM) {
+		const char *name = stmt.column_text(COLUMN);
+		if (name == nullptr && sqlite3_errcode(conn._handle) == SQLITE_NOMEM) {
 			throw std::bad_alloc();
 		}
-		const int len = stmt.column_bytes(COLUMN);
+		playlists.emplace_back(name, static_cast<size_t>(stmt.column_bytes(COLUMN)));
+	}
+	
+	if (rcode != SQLITE_DONE) {
+		SPDLOG_ERROR("sqlite3_step() failed ({:d}): {:s}", rcode, sqlite3_errstr(rcode));
+		playlists.clear();
+		return -1;
+	}
+	return static_cast<int>(playlists.size());
+}
+
+bool Sqlite3::set_playlist_data(const std::string &playlist, const std::vector<fs::path> &paths)
+{
+	// rows per `INSERT`, kept well below `SQLITE_MAX_VARIABLE_NUMBER` of old builds (999)
+	constexpr int BATCH_ROWS = 128;
+	static const std::string deleteQuery = fmt::format(
+		R"(DELETE FROM [{}] WHERE [{}] = ?1;)",
+		Tab::FILES, Tab::Files::PLAYLIST_ID
+	);
+	// Deferring the playlist disables the per-row triggers of `files_fts` for its files, they're
+	// indexed in one query by the next search instead. An indexed playlist leaves the index first.
+	static const std::string deferQuery = fmt::format(
+		R"(INSERT OR IGNORE INTO [{}] ([{}]) VALUES (?1);)",
+		Tab::FILES_FTS_DEFERRED, Tab::FilesFtsDeferred::PLAYLIST_ID
+	);
+	static const std::string unindexQuery = fmt::format(
+		R"(INSERT INTO [{0}] ([{0}], [rowid], [{1}])
+		SELECT 'delete', [rowid], [{1}] FROM [{2}] WHERE [{3}] = ?1;)",
+		Tab::FILES_FTS, Tab::Files::NAME, Tab::FILES, Tab::Files::PLAYLIST_ID
+	);
+	static const std::string batchQuery = make_files_insert_query(BATCH_ROWS);
+	static const std::string rowQuery = make_files_insert_query(1);
+	
+	const auto lock = this->lock_writer();
+	SqliteTransaction transaction(_handle);
+	if (const int rc = transaction.begin(); rc != SQLITE_OK) {
+		SPDLOG_ERROR("BEGIN failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return false;
+	}
+	
+	const std::optional<int64_t> playlistId = this->get_playlist_id(playlist);
+	if (!playlistId.has_value()) {
+		SPDLOG_ERROR("Playlist '{}' doesn't exist", playlist);
+		return false;
+	}
+	
+	// runs `query`, which only binds the playlist's id
+	const auto run_for_playlist = [&](const std::string &query) -> bool
+	{
+		SqliteStmt stmt;
+		if (const int rc = stmt.prepare(m_stmtCache, _handle, query); rc != SQLITE_OK) {
+			SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+			return false;
+		}
+		[[maybe_unused]] const int rc = stmt.bind_int64(1, *playlistId);
+		assert(rc == SQLITE_OK);
+		if (const int rcode = stmt.step(); rcode != SQLITE_DONE) {
+			SPDLOG_ERROR("sqlite3_step() failed ({:d}): {:s}", rcode, sqlite3_errstr(rcode));
+			return false;
+		}
+		return true;
+	};
+	
+	if (!run_for_playlist(deferQuery)) {
+		return false;
+	}
+	const bool indexed = sqlite3_changes(_handle) > 0;
+	if ((indexed && !run_for_playlist(unindexQuery)) || !run_for_playlist(deleteQuery)) {
+		return false;
+	}
+	
+	const fs::path base = this->get_playlist_location(playlist);
+	std::array<std::string, BATCH_ROWS> names;
+	
+	// binds and inserts `rows` paths starting at `first` using an `INSERT` of as many rows
+	const auto insert_rows = [&](SqliteStmt &stmt, const size_t first, const int rows) -> bool
+	{
+		[[maybe_unused]] int rc = stmt.bind_int64(1, *playlistId);
+		assert(rc == SQLITE_OK);
+		for (int row = 0; row < rows; ++row) {
+			const size_t index = first + static_cast<size_t>(row);
+			names[static_cast<size_t>(row)] = to_stored_name(base, paths[index]).native();
+			
+			rc = stmt.bind_int64(2 + 2 * row, static_cast<int64_t>(index));
+			assert(rc == SQLITE_OK);
+			rc = stmt.bind_text_static(3 + 2 * row, names[static_cast<size_t>(row)]);
+			if (rc == SQLITE_NOMEM) { throw std::bad_alloc(); }
+		}
 		
-		++iterations;
-		const IterFlag res = callback(base / fs::path(&filename[0], &filename[len]));
-		if (res == IterFlag::STOP) { return iterations; }
+		const int rcode = stmt.step();
+		(void)stmt.reset();
+		if (rcode != SQLITE_DONE) {
+			SPDLOG_ERROR("sqlite3_step() failed ({:d}): {:s}", rcode, sqlite3_errstr(rcode));
+			return false;
+		}
+		return true;
+	};
+	
+	size_t inserted = 0;
+	if (paths.size() >= BATCH_ROWS) {
+		SqliteStmt stmt;
+		if (const int rc = stmt.prepare(m_stmtCache, _handle, batchQuery); rc != SQLITE_OK) {
+			SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+			return false;
+		}
+		for (; paths.size() - inserted >= BATCH_ROWS; inserted += BATCH_ROWS) {
+			if (!insert_rows(stmt, inserted, BATCH_ROWS)) { return false; }
+		}
+	}
+	if (inserted < paths.size()) {
+		SqliteStmt stmt;
+		if (const int rc = stmt.prepare(m_stmtCache, _handle, rowQuery); rc != SQLITE_OK) {
+			SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+			return false;
+		}
+		for (; inserted < paths.size(); ++inserted) {
+			if (!insert_rows(stmt, inserted, 1)) { return false; }
+		}
+	}
+	
+	if (const int rc = transaction.commit(); rc != SQLITE_OK) {
+		SPDLOG_ERROR("COMMIT failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return false;
+	}
+	SPDLOG_DEBUG("Stored {:d} media paths in playlist '{}'", paths.size(), playlist);
+	return true;
+}
+
+bool Sqlite3::apply_file_changes(const std::vector<FileChange> &changes)
+{
+	using Kind = FileChange::Kind;
+	// every query binds the playlist's name to `?1`
+	static const std::string playlistId = fmt::format(
+		R"((SELECT [{}] FROM [{}] WHERE [{}] = ?1))",
+		Tab::Playlists::ID, Tab::PLAYLISTS, Tab::Playlists::NAME
+	);
+	static const std::string addFile = fmt::format(
+		R"(INSERT INTO [{0}] ([{1}], [{2}], [{3}])
+		SELECT p.[{5}], (SELECT IFNULL(MAX([{2}]) + 1, 0) FROM [{0}] WHERE [{1}] = p.[{5}]), ?2
+		FROM [{4}] AS p WHERE p.[{6}] = ?1 AND NOT EXISTS (
+			SELECT 1 FROM [{0}] WHERE [{1}] = p.[{5}] AND [{3}] = ?2
+		);)",
+		Tab::FILES, Tab::Files::PLAYLIST_ID, Tab::Files::INDEX, Tab::Files::NAME,
+		Tab::PLAYLISTS, Tab::Playlists::ID, Tab::Playlists::NAME
+	);
+	static const std::string removeFile = fmt::format(
+		R"(DELETE FROM [{}] WHERE [{}] = {} AND [{}] = ?2;)",
+		Tab::FILES, Tab::Files::PLAYLIST_ID, playlistId, Tab::Files::NAME
+	);
+	// a file moved over another one replaces it
+	static const std::string removeRenameTarget = fmt::format(
+		R"(DELETE FROM [{}] WHERE [{}] = {} AND [{}] = ?3 AND ?3 != ?2;)",
+		Tab::FILES, Tab::Files::PLAYLIST_ID, playlistId, Tab::Files::NAME
+	);
+	static const std::string renameFile = fmt::format(
+		R"(UPDATE [{0}] SET [{3}] = ?3 WHERE [{1}] = {2} AND [{3}] = ?2;)",
+		Tab::FILES, Tab::Files::PLAYLIST_ID, playlistId, Tab::Files::NAME
+	);
+	static const std::string addPlaylist = fmt::format(
+		R"(INSERT OR IGNORE INTO [{}] ([{}]) VALUES(?1);)",
+		Tab::PLAYLISTS, Tab::Playlists::NAME
+	);
+	static const std::string removePlaylistFiles = fmt::format(
+		R"(DELETE FROM [{}] WHERE [{}] = {};)",
+		Tab::FILES, Tab::Files::PLAYLIST_ID, playlistId
+	);
+	static const std::string removePlaylist = fmt::format(
+		R"(DELETE FROM [{}] WHERE [{}] = ?1;)",
+		Tab::PLAYLISTS, Tab::Playlists::NAME
+	);
+	static const std::string renamePlaylist = fmt::format(
+		R"(UPDATE [{}] SET [{}] = ?3 WHERE [{}] = ?1;)",
+		Tab::PLAYLISTS, Tab::Playlists::NAME, Tab::Playlists::NAME
+	);
+	
+	const auto run = [this](const std::string &query, const FileChange &change) -> bool
+	{
+		SqliteStmt stmt;
+		if (const int rc = stmt.prepare(m_stmtCache, _handle, query); rc != SQLITE_OK) {
+			SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+			return false;
+		}
+		// unused parameters are simply left unbound
+		const int paramCount = sqlite3_bind_parameter_count(stmt._p);
+		if (stmt.bind_text_static(1, change.playlist) == SQLITE_NOMEM) { throw std::bad_alloc(); }
+		if (paramCount >= 2 && stmt.bind_text_static(2, change.name.native()) == SQLITE_NOMEM) {
+			throw std::bad_alloc();
+		}
+		if (paramCount >= 3 && stmt.bind_text_static(3, change.newName.native()) == SQLITE_NOMEM) {
+			throw std::bad_alloc();
+		}
+		
+		if (const int rcode = stmt.step(); rcode != SQLITE_DONE) {
+			SPDLOG_ERROR("sqlite3_step() failed ({:d}): {:s}", rcode, sqlite3_errstr(rcode));
+			return false;
+		}
+		return true;
+	};
+	
+	const auto lock = this->lock_writer();
+	SqliteTransaction transaction(_handle);
+	if (const int rc = transaction.begin(); rc != SQLITE_OK) {
+		SPDLOG_ERROR("BEGIN failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return false;
+	}
+	
+	for (const FileChange &change : changes) {
+		bool ok = false;
+		switch (change.kind)
+		{
+		case Kind::ADD_FILE:
+			ok = run(addFile, change);
+			break;
+		case Kind::REMOVE_FILE:
+			ok = run(removeFile, change);
+			break;
+		case Kind::RENAME_FILE:
+			ok = run(removeRenameTarget, change) && run(renameFile, change);
+			break;
+		case Kind::ADD_PLAYLIST:
+			ok = run(addPlaylist, change);
+			break;
+		case Kind::REMOVE_PLAYLIST:
+			ok = run(removePlaylistFiles, change) && run(removePlaylist, change);
+			break;
+		case Kind::RENAME_PLAYLIST:
+			ok = run(renamePlaylist, change);
+			break;
+		}
+		if (!ok) { return false; }
+	}
+	
+	if (const int rc = transaction.commit(); rc != SQLITE_OK) {
+		SPDLOG_ERROR("COMMIT failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return false;
+	}
+	SPDLOG_TRACE("Applied {:d} file changes", changes.size());
+	return true;
+}
+
+std::vector<std::optional<chrono::microseconds>>
+Sqlite3::get_cached_durations(const std::vector<FileStamp> &files)
+{
+	static const std::string query = fmt::format(
+		R"(SELECT [{}] FROM [{}] WHERE [{}] = ?1 AND [{}] = ?2 AND [{}] = ?3;)",
+		Tab::MediaInfo::DURATION, Tab::MEDIA_INFO,
+		Tab::MediaInfo::PATH, Tab::MediaInfo::SIZE, Tab::MediaInfo::MTIME
+	);
+	std::vector<std::optional<chrono::microseconds>> durations(files.size());
+	
+	const ReadLease conn(m_pool.get(), _handle, m_stmtCache);
+	SqliteStmt stmt;
+	if (const int rc = stmt.prepare(conn._stmtCache, conn._handle, query); rc != SQLITE_OK) {
+		SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return durations;
+	}
+	
+	for (size_t i = 0; i < files.size(); ++i) {
+		const FileStamp &file = files[i];
+		if (stmt.bind_text_static(1, file.path.native()) == SQLITE_NOMEM) {
+			throw std::bad_alloc();
+		}
+		[[maybe_unused]] int rc = stmt.bind_int64(2, file.size);
+		assert(rc == SQLITE_OK);
+		rc = stmt.bind_int64(3, file.mtime);
+		assert(rc == SQLITE_OK);
+		
+		const int rcode = stmt.step();
+		if (rcode == SQLITE_ROW) {
+			constexpr int COLUMN = 0;
+			ASSERT_SQLITE_COLUMN(stmt, COLUMN, SQLITE_INTEGER, Tab::MediaInfo::DURATION);
+			durations[i] = chrono::microseconds(stmt.column_int64(COLUMN));
+		}
+		else if (rcode != SQLITE_DONE) {
+			SPDLOG_ERROR("sqlite3_step() failed ({:d}): {:s}", rcode, sqlite3_errstr(rcode));
+		}
+		(void)stmt.reset();
+	}
+	return durations;
+}
+
+bool Sqlite3::set_cached_durations(
+	const std::vector<std::pair<FileStamp, chrono::microseconds>> &entries
+) {
+	static const std::string query = fmt::format(
+		R"(INSERT OR REPLACE INTO [{}] ([{}], [{}], [{}], [{}]) VALUES(?1, ?2, ?3, ?4);)",
+		Tab::MEDIA_INFO,
+		Tab::MediaInfo::PATH, Tab::MediaInfo::SIZE, Tab::MediaInfo::MTIME, Tab::MediaInfo::DURATION
+	);
+	
+	const auto lock = this->lock_writer();
+	SqliteTransaction transaction(_handle);
+	if (const int rc = transaction.begin(); rc != SQLITE_OK) {
+		SPDLOG_ERROR("BEGIN failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return false;
+	}
+	
+	SqliteStmt stmt;
+	if (const int rc = stmt.prepare(m_stmtCache, _handle, query); rc != SQLITE_OK) {
+		SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return false;
+	}
+	for (const auto &[file, duration] : entries) {
+		if (stmt.bind_text_static(1, file.path.native()) == SQLITE_NOMEM) {
+			throw std::bad_alloc();
+		}
+		[[maybe_unused]] int rc = stmt.bind_int64(2, file.size);
+		assert(rc == SQLITE_OK);
+		rc = stmt.bind_int64(3, file.mtime);
+		assert(rc == SQLITE_OK);
+		rc = stmt.bind_int64(4, duration.count());
+		assert(rc == SQLITE_OK);
+		
+		const int rcode = stmt.step();
+		(void)stmt.reset();
+		if (rcode != SQLITE_DONE) {
+			SPDLOG_ERROR("sqlite3_step() failed ({:d}): {:s}", rcode, sqlite3_errstr(rcode));
+			return false;
+		}
+	}
+	
+	if (const int rc = transaction.commit(); rc != SQLITE_OK) {
+		SPDLOG_ERROR("COMMIT failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return false;
+	}
+	return true;
+}
+
+std::optional<chrono::microseconds> Sqlite3::get_resume_point(const fs::path &media)
+{
+	static const std::string query = fmt::format(
+		R"(SELECT [{}] FROM [{}] WHERE [{}] = ?1;)",
+		Tab::ResumePoints::POSITION, Tab::RESUME_POINTS, Tab::ResumePoints::PATH
+	);
+	
+	const ReadLease conn(m_pool.get(), _handle, m_stmtCache);
+	SqliteStmt stmt;
+	if (const int rc = stmt.prepare(conn._stmtCache, conn._handle, query); rc != SQLITE_OK) {
+		SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return std::nullopt;
+	}
+	if (stmt.bind_text_static(1, media.native()) == SQLITE_NOMEM) {
+		throw std::bad_alloc();
+	}
+	
+	const int rcode = stmt.step();
+	if (rcode == SQLITE_ROW) {
+		constexpr int COLUMN = 0;
+		ASSERT_SQLITE_COLUMN(stmt, COLUMN, SQLITE_INTEGER, Tab::ResumePoints::POSITION);
+		return chrono::microseconds(stmt.column_int64(COLUMN));
+	}
+	else if (rcode != SQLITE_DONE) {
+		SPDLOG_ERROR("sqlite3_step() failed ({:d}): {:s}", rcode, sqlite3_errstr(rcode));
+	}
+	return std::nullopt;
+}
+
+bool Sqlite3::set_resume_points(
+	const std::vector<std::pair<fs::path, chrono::microseconds>> &entries
+) {
+	static const std::string insertQuery = fmt::format(
+		R"(INSERT OR REPLACE INTO [{}] ([{}], [{}]) VALUES(?1, ?2);)",
+		Tab::RESUME_POINTS, Tab::ResumePoints::PATH, Tab::ResumePoints::POSITION
+	);
+	static const std::string deleteQuery = fmt::format(
+		R"(DELETE FROM [{}] WHERE [{}] = ?1;)",
+		Tab::RESUME_POINTS, Tab::ResumePoints::PATH
+	);
+	
+	const auto lock = this->lock_writer();
+	SqliteTransaction transaction(_handle);
+	if (const int rc = transaction.begin(); rc != SQLITE_OK) {
+		SPDLOG_ERROR("BEGIN failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return false;
+	}
+	
+	SqliteStmt insertStmt, deleteStmt;
+	if (const int rc = insertStmt.prepare(m_stmtCache, _handle, insertQuery); rc != SQLITE_OK) {
+		SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return false;
+	}
+	if (const int rc = deleteStmt.prepare(m_stmtCache, _handle, deleteQuery); rc != SQLITE_OK) {
+		SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return false;
+	}
+	for (const auto &[path, position] : entries) {
+		SqliteStmt &stmt = (position < position.zero()) ? deleteStmt : insertStmt;
+		if (stmt.bind_text_static(1, path.native()) == SQLITE_NOMEM) {
+			throw std::bad_alloc();
+		}
+		if (position >= position.zero()) {
+			[[maybe_unused]] const int rc = stmt.bind_int64(2, position.count());
+			assert(rc == SQLITE_OK);
+		}
+		
+		const int rcode = stmt.step();
+		(void)stmt.reset();
+		if (rcode != SQLITE_DONE) {
+			SPDLOG_ERROR("sqlite3_step() failed ({:d}): {:s}", rcode, sqlite3_errstr(rcode));
+			return false;
+		}
+	}
+	
+	if (const int rc = transaction.commit(); rc != SQLITE_OK) {
+		SPDLOG_ERROR("COMMIT failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return false;
+	}
+	return true;
+}
+
+// Times of the play history, stored as microseconds since the unix epoch.
+[[nodiscard]] static inline int64_t to_stored_time(const chrono::system_clock::time_point time)
+{
+	return chrono::duration_cast<chrono::microseconds>(time.time_since_epoch()).count();
+}
+
+[[nodiscard]] static inline chrono::system_clock::time_point from_stored_time(const int64_t time)
+{
+	return chrono::system_clock::time_point(
+		chrono::duration_cast<chrono::system_clock::duration>(chrono::microseconds(time))
+	);
+}
+
+bool Sqlite3::add_play_events(const std::vector<PlayEvent> &events)
+{
+	static const std::string historyQuery = fmt::format(
+		R"(INSERT INTO [{}] ([{}], [{}], [{}], [{}]) VALUES(?1, ?2, ?3, ?4);)",
+		Tab::PLAY_HISTORY, Tab::PlayHistory::PATH,
+		Tab::PlayHistory::KIND, Tab::PlayHistory::TIME, Tab::PlayHistory::POSITION
+	);
+	// `?4` is null for skips, which don't change `last_played`
+	static const std::string statsQuery = fmt::format(
+		R"(INSERT INTO [{0}] ([{1}], [{2}], [{3}], [{4}]) VALUES(?1, ?2, ?3, ?4)
+		ON CONFLICT([{1}]) DO UPDATE SET
+			[{2}] = [{2}] + excluded.[{2}], [{3}] = [{3}] + excluded.[{3}],
+			[{4}] = MAX(IFNULL([{4}], excluded.[{4}]), IFNULL(excluded.[{4}], [{4}]));)",
+		Tab::PLAY_STATS, Tab::PlayStats::PATH,
+		Tab::PlayStats::PLAY_COUNT, Tab::PlayStats::SKIP_COUNT, Tab::PlayStats::LAST_PLAYED
+	);
+	
+	const auto lock = this->lock_writer();
+	SqliteTransaction transaction(_handle);
+	if (const int rc = transaction.begin(); rc != SQLITE_OK) {
+		SPDLOG_ERROR("BEGIN failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return false;
+	}
+	
+	SqliteStmt historyStmt, statsStmt;
+	if (const int rc = historyStmt.prepare(m_stmtCache, _handle, historyQuery); rc != SQLITE_OK) {
+		SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return false;
+	}
+	if (const int rc = statsStmt.prepare(m_stmtCache, _handle, statsQuery); rc != SQLITE_OK) {
+		SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return false;
+	}
+	for (const PlayEvent &event : events) {
+		const bool played = event.kind == PlayEvent::Kind::PLAYED;
+		const int64_t time = to_stored_time(event.time);
+		
+		if (historyStmt.bind_text_static(1, event.path.native()) == SQLITE_NOMEM) {
+			throw std::bad_alloc();
+		}
+		[[maybe_unused]] int rc = historyStmt.bind_int64(2, static_cast<int64_t>(event.kind));
+		assert(rc == SQLITE_OK);
+		rc = historyStmt.bind_int64(3, time);
+		assert(rc == SQLITE_OK);
+		rc = historyStmt.bind_int64(4, event.position.count());
+		assert(rc == SQLITE_OK);
+		
+		if (statsStmt.bind_text_static(1, event.path.native()) == SQLITE_NOMEM) {
+			throw std::bad_alloc();
+		}
+		rc = statsStmt.bind_int64(2, played ? 1 : 0);
+		assert(rc == SQLITE_OK);
+		rc = statsStmt.bind_int64(3, played ? 0 : 1);
+		assert(rc == SQLITE_OK);
+		rc = played ? statsStmt.bind_int64(4, time) : statsStmt.bind_null(4);
+		assert(rc == SQLITE_OK);
+		
+		for (SqliteStmt *stmt : { &historyStmt, &statsStmt }) {
+			const int rcode = stmt->step();
+			(void)stmt->reset();
+			if (rcode != SQLITE_DONE) {
+				SPDLOG_ERROR("sqlite3_step() failed ({:d}): {:s}", rcode, sqlite3_errstr(rcode));
+				return false;
+			}
+		}
+	}
+	
+	if (const int rc = transaction.commit(); rc != SQLITE_OK) {
+		SPDLOG_ERROR("COMMIT failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return false;
+	}
+	return true;
+}
+
+std::vector<PlayStats> Sqlite3::get_play_stats(const std::vector<fs::path> &files)
+{
+	static const std::string query = fmt::format(
+		R"(SELECT [{}], [{}], [{}] FROM [{}] WHERE [{}] = ?1;)",
+		Tab::PlayStats::PLAY_COUNT, Tab::PlayStats::SKIP_COUNT, Tab::PlayStats::LAST_PLAYED,
+		Tab::PLAY_STATS, Tab::PlayStats::PATH
+	);
+	std::vector<PlayStats> stats(files.size());
+	
+	const ReadLease conn(m_pool.get(), _handle, m_stmtCache);
+	SqliteStmt stmt;
+	if (const int rc = stmt.prepare(conn._stmtCache, conn._handle, query); rc != SQLITE_OK) {
+		SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return stats;
+	}
+	
+	for (size_t i = 0; i < files.size(); ++i) {
+		if (stmt.bind_text_static(1, files[i].native()) == SQLITE_NOMEM) {
+			throw std::bad_alloc();
+		}
+		
+		const int rcode = stmt.step();
+		if (rcode == SQLITE_ROW) {
+			ASSERT_SQLITE_COLUMN(stmt, 0, SQLITE_INTEGER, Tab::PlayStats::PLAY_COUNT);
+			ASSERT_SQLITE_COLUMN(stmt, 1, SQLITE_INTEGER, Tab::PlayStats::SKIP_COUNT);
+			stats[i].playCount = stmt.column_int64(0);
+			stats[i].skipCount = stmt.column_int64(1);
+			if (stmt.column_type(2) == SQLITE_INTEGER) {
+				stats[i].lastPlayed = from_stored_time(stmt.column_int64(2));
+			}
+		}
+		else if (rcode != SQLITE_DONE) {
+			SPDLOG_ERROR("sqlite3_step() failed ({:d}): {:s}", rcode, sqlite3_errstr(rcode));
+		}
+		(void)stmt.reset();
+	}
+	return stats;
+}
+
+int Sqlite3::get_play_history(const int limit, std::vector<PlayEvent> &events)
+{
+	static const std::string query = fmt::format(
+		R"(SELECT [{}], [{}], [{}], [{}] FROM [{}] ORDER BY [{}] DESC LIMIT ?1;)",
+		Tab::PlayHistory::PATH, Tab::PlayHistory::KIND,
+		Tab::PlayHistory::TIME, Tab::PlayHistory::POSITION,
+		Tab::PLAY_HISTORY, Tab::PlayHistory::ID
+	);
+	events.clear();
+	if (limit <= 0) {
+		return 0;
+	}
+	
+	const ReadLease conn(m_pool.get(), _handle, m_stmtCache);
+	SqliteStmt stmt;
+	if (const int rc = stmt.prepare(conn._stmtCache, conn._handle, query); rc != SQLITE_OK) {
+		SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return -1;
+	}
+	[[maybe_unused]] const int bindRc = stmt.bind_int64(1, limit);
+	assert(bindRc == SQLITE_OK);
+	
+	int rcode = 0;
+	while ((rcode = stmt.step()) == SQLITE_ROW) {
+		ASSERT_SQLITE_COLUMN(stmt, 0, SQLITE3_TEXT, Tab::PlayHistory::PATH);
+		ASSERT_SQLITE_COLUMN(stmt, 1, SQLITE_INTEGER, Tab::PlayHistory::KIND);
+		ASSERT_SQLITE_COLUMN(stmt, 2, SQLITE_INTEGER, Tab::PlayHistory::TIME);
+		ASSERT_SQLITE_COLUMN(stmt, 3, SQLITE_INTEGER, Tab::PlayHistory::POSITION);
+		
+		const char *path = stmt.column_text(0);
+		if (path == nullptr && sqlite3_errcode(conn._handle) == SQLITE_NOMEM) {
+			throw std::bad_alloc();
+		}
+		events.push_back(PlayEvent {
+			.path = std::string(path, static_cast<size_t>(stmt.column_bytes(0))),
+			.kind = (stmt.column_int64(1) == static_cast<int64_t>(PlayEvent::Kind::PLAYED))
+				? PlayEvent::Kind::PLAYED : PlayEvent::Kind::SKIPPED,
+			.time = from_stored_time(stmt.column_int64(2)),
+			.position = chrono::microseconds(stmt.column_int64(3)),
+		});
 	}
 	
 	if (rcode != SQLITE_DONE) {
 		SPDLOG_ERROR("sqlite3_step() failed ({:d}): {:s}", rcode, sqlite3_errstr(rcode));
+		events.clear();
 		return -1;
 	}
-	return iterations;
+	return static_cast<int>(events.size());
+}
+
+std::vector<std::optional<StoredTags>>
+Sqlite3::get_media_tags(const std::vector<FileStamp> &files)
+{
+	static const std::string query = fmt::format(
+		R"(SELECT t.[{}], a.[{}], aa.[{}], al.[{}], g.[{}], t.[{}], t.[{}] FROM [{}] AS t
+		LEFT JOIN [{}] AS a ON a.[{}] = t.[{}]
+		LEFT JOIN [{}] AS al ON al.[{}] = t.[{}]
+		LEFT JOIN [{}] AS aa ON aa.[{}] = al.[{}]
+		LEFT JOIN [{}] AS g ON g.[{}] = t.[{}]
+		WHERE t.[{}] = ?1 AND t.[{}] = ?2 AND t.[{}] = ?3;)",
+		Tab::MediaTags::TITLE, Tab::Artists::NAME, Tab::Artists::NAME, Tab::Albums::NAME,
+		Tab::Genres::NAME, Tab::MediaTags::TRACK, Tab::MediaTags::YEAR, Tab::MEDIA_TAGS,
+		Tab::ARTISTS, Tab::Artists::ID, Tab::MediaTags::ARTIST_ID,
+		Tab::ALBUMS, Tab::Albums::ID, Tab::MediaTags::ALBUM_ID,
+		Tab::ARTISTS, Tab::Artists::ID, Tab::Albums::ARTIST_ID,
+		Tab::GENRES, Tab::Genres::ID, Tab::MediaTags::GENRE_ID,
+		Tab::MediaTags::PATH, Tab::MediaTags::SIZE, Tab::MediaTags::MTIME
+	);
+	std::vector<std::optional<StoredTags>> tags(files.size());
+	
+	const ReadLease conn(m_pool.get(), _handle, m_stmtCache);
+	SqliteStmt stmt;
+	if (const int rc = stmt.prepare(conn._stmtCache, conn._handle, query); rc != SQLITE_OK) {
+		SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return tags;
+	}
+	
+	// unknown fields are `NULL`, read as empty
+	const auto read_text = [&stmt, &conn](const int column) -> std::string
+	{
+		const char *text = stmt.column_text(column);
+		if (text == nullptr) {
+			if (sqlite3_errcode(conn._handle) == SQLITE_NOMEM) { throw std::bad_alloc(); }
+			return {};
+		}
+		return std::string(text, static_cast<size_t>(stmt.column_bytes(column)));
+	};
+	
+	for (size_t i = 0; i < files.size(); ++i) {
+		const FileStamp &file = files[i];
+		if (stmt.bind_text_static(1, file.path.native()) == SQLITE_NOMEM) {
+			throw std::bad_alloc();
+		}
+		[[maybe_unused]] int rc = stmt.bind_int64(2, file.size);
+		assert(rc == SQLITE_OK);
+		rc = stmt.bind_int64(3, file.mtime);
+		assert(rc == SQLITE_OK);
+		
+		const int rcode = stmt.step();
+		if (rcode == SQLITE_ROW) {
+			tags[i] = StoredTags {
+				.title = read_text(0),
+				.artist = read_text(1),
+				.albumArtist = read_text(2),
+				.album = read_text(3),
+				.genre = read_text(4),
+				.track = stmt.column_int64(5),
+				.year = stmt.column_int64(6),
+			};
+		}
+		else if (rcode != SQLITE_DONE) {
+			SPDLOG_ERROR("sqlite3_step() failed ({:d}): {:s}", rcode, sqlite3_errstr(rcode));
+		}
+		(void)stmt.reset();
+	}
+	return tags;
 }
 
-bool Sqlite3::set_playlist_data(const std::string&, const std::vector<fs::path>&)
+bool Sqlite3::set_media_tags(const std::vector<std::pair<FileStamp, MediaTags>> &entries)
 {
-	assert(!bool("Not implemented"));
-	return false;
+	// `?1` is the name, `?2` the artist of an album
+	static const std::string selectArtist = fmt::format(
+		R"(SELECT [{}] FROM [{}] WHERE [{}] = ?1;)",
+		Tab::Artists::ID, Tab::ARTISTS, Tab::Artists::NAME
+	);
+	static const std::string insertArtist = fmt::format(
+		R"(INSERT INTO [{}] ([{}]) VALUES(?1);)",
+		Tab::ARTISTS, Tab::Artists::NAME
+	);
+	static const std::string selectAlbum = fmt::format(
+		R"(SELECT [{}] FROM [{}] WHERE [{}] = ?1 AND [{}] = ?2;)",
+		Tab::Albums::ID, Tab::ALBUMS, Tab::Albums::NAME, Tab::Albums::ARTIST_ID
+	);
+	static const std::string insertAlbum = fmt::format(
+		R"(INSERT INTO [{}] ([{}], [{}]) VALUES(?1, ?2);)",
+		Tab::ALBUMS, Tab::Albums::NAME, Tab::Albums::ARTIST_ID
+	);
+	static const std::string selectGenre = fmt::format(
+		R"(SELECT [{}] FROM [{}] WHERE [{}] = ?1;)",
+		Tab::Genres::ID, Tab::GENRES, Tab::Genres::NAME
+	);
+	static const std::string insertGenre = fmt::format(
+		R"(INSERT INTO [{}] ([{}]) VALUES(?1);)",
+		Tab::GENRES, Tab::Genres::NAME
+	);
+	static const std::string insertTags = fmt::format(
+		R"(INSERT OR REPLACE INTO [{}] ([{}], [{}], [{}], [{}], [{}], [{}], [{}], [{}], [{}])
+		VALUES(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9);)",
+		Tab::MEDIA_TAGS, Tab::MediaTags::PATH, Tab::MediaTags::SIZE, Tab::MediaTags::MTIME,
+		Tab::MediaTags::TITLE, Tab::MediaTags::ARTIST_ID, Tab::MediaTags::ALBUM_ID,
+		Tab::MediaTags::GENRE_ID, Tab::MediaTags::TRACK, Tab::MediaTags::YEAR
+	);
+	// `?1` is the path of a file whose tags are replaced
+	static const std::string selectReplaced = fmt::format(
+		R"(SELECT [{}], [{}], [{}] FROM [{}] WHERE [{}] = ?1;)",
+		Tab::MediaTags::ARTIST_ID, Tab::MediaTags::ALBUM_ID, Tab::MediaTags::GENRE_ID,
+		Tab::MEDIA_TAGS, Tab::MediaTags::PATH
+	);
+	// `?1` is the id of a name which may not be used anymore, removed albums return their artist
+	static const std::string deleteAlbum = fmt::format(
+		R"(DELETE FROM [{}] WHERE [{}] = ?1
+		AND NOT EXISTS (SELECT 1 FROM [{}] WHERE [{}] = ?1) RETURNING [{}];)",
+		Tab::ALBUMS, Tab::Albums::ID,
+		Tab::MEDIA_TAGS, Tab::MediaTags::ALBUM_ID, Tab::Albums::ARTIST_ID
+	);
+	static const std::string deleteArtist = fmt::format(
+		R"(DELETE FROM [{}] WHERE [{}] = ?1
+		AND NOT EXISTS (SELECT 1 FROM [{}] WHERE [{}] = ?1)
+		AND NOT EXISTS (SELECT 1 FROM [{}] WHERE [{}] = ?1);)",
+		Tab::ARTISTS, Tab::Artists::ID,
+		Tab::MEDIA_TAGS, Tab::MediaTags::ARTIST_ID,
+		Tab::ALBUMS, Tab::Albums::ARTIST_ID
+	);
+	static const std::string deleteGenre = fmt::format(
+		R"(DELETE FROM [{}] WHERE [{}] = ?1
+		AND NOT EXISTS (SELECT 1 FROM [{}] WHERE [{}] = ?1);)",
+		Tab::GENRES, Tab::Genres::ID,
+		Tab::MEDIA_TAGS, Tab::MediaTags::GENRE_ID
+	);
+	
+	// ids of the names used in this call, a library shares few of them between many files
+	std::unordered_map<std::string_view, int64_t> artists, genres;
+	std::map<std::pair<int64_t, std::string_view>, int64_t> albums;
+	// ids used by the replaced tags, removed at the end if no file uses them anymore
+	std::set<int64_t> replacedArtists, replacedAlbums, replacedGenres;
+	
+	/* #Returns the id of `name` in a table of names, inserting it if it's missing.
+	! @param owner: bound to `?2`, for albums.
+	! @return: nothing on failure.
+	*/
+	const auto find_or_insert = [this](
+		const std::string &select, const std::string &insert,
+		const std::string_view name, const int64_t owner
+	) -> std::optional<int64_t> {
+		for (const std::string *query : { &select, &insert }) {
+			SqliteStmt stmt;
+			if (const int rc = stmt.prepare(m_stmtCache, _handle, *query); rc != SQLITE_OK) {
+				SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+				return std::nullopt;
+			}
+			if (stmt.bind_text_static(1, name) == SQLITE_NOMEM) { throw std::bad_alloc(); }
+			if (sqlite3_bind_parameter_count(stmt._p) >= 2) {
+				[[maybe_unused]] const int rc = stmt.bind_int64(2, owner);
+				assert(rc == SQLITE_OK);
+			}
+			
+			const int rcode = stmt.step();
+			if (rcode == SQLITE_ROW) {
+				return stmt.column_int64(0);
+			}
+			if (rcode != SQLITE_DONE) {
+				SPDLOG_ERROR("sqlite3_step() failed ({:d}): {:s}", rcode, sqlite3_errstr(rcode));
+				return std::nullopt;
+			}
+			if (query == &insert) {
+				return sqlite3_last_insert_rowid(_handle);
+			}
+		}
+		return std::nullopt;
+	};
+	
+	// #@return: the id of `name`, `0` if it's empty, nothing on failure.
+	const auto get_id = [&find_or_insert](
+		auto &ids, const auto &key, const std::string_view name,
+		const std::string &select, const std::string &insert, const int64_t owner = 0
+	) -> std::optional<int64_t> {
+		if (name.empty()) { return 0; }
+		if (const auto it = ids.find(key); it != ids.end()) { return it->second; }
+		
+		const std::optional<int64_t> id = find_or_insert(select, insert, name, owner);
+		if (id.has_value()) { ids.emplace(key, *id); }
+		return id;
+	};
+	
+	const auto lock = this->lock_writer();
+	SqliteTransaction transaction(_handle);
+	if (const int rc = transaction.begin(); rc != SQLITE_OK) {
+		SPDLOG_ERROR("BEGIN failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return false;
+	}
+	
+	SqliteStmt stmt, replaced;
+	if (const int rc = stmt.prepare(m_stmtCache, _handle, insertTags); rc != SQLITE_OK) {
+		SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return false;
+	}
+	if (const int rc = replaced.prepare(m_stmtCache, _handle, selectReplaced); rc != SQLITE_OK) {
+		SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return false;
+	}
+	
+	// unknown values are stored as `NULL`
+	const auto bind_int_or_null = [&stmt](const int param, const int64_t value) {
+		[[maybe_unused]] const int rc = (value == 0)
+			? stmt.bind_null(param) : stmt.bind_int64(param, value);
+		assert(rc == SQLITE_OK);
+	};
+	
+	// #Adds the ids used by the tags stored for `path` to the `replaced*` sets.
+	const auto collect_replaced = [&](const fs::path &path) {
+		if (replaced.bind_text_static(1, path.native()) == SQLITE_NOMEM) {
+			throw std::bad_alloc();
+		}
+		const int rcode = replaced.step();
+		if (rcode == SQLITE_ROW) {
+			const std::array columns = { &replacedArtists, &replacedAlbums, &replacedGenres };
+			for (int column = 0; column < static_cast<int>(columns.size()); ++column) {
+				if (replaced.column_type(column) != SQLITE_NULL) {
+					columns[column]->insert(replaced.column_int64(column));
+				}
+			}
+		}
+		(void)replaced.reset();
+		if (rcode != SQLITE_ROW && rcode != SQLITE_DONE) {
+			SPDLOG_ERROR("sqlite3_step() failed ({:d}): {:s}", rcode, sqlite3_errstr(rcode));
+			return false;
+		}
+		return true;
+	};
+	
+	/* #Deletes the names of `ids` which aren't used anymore, with `query`.
+	! @param removed: called with the first column returned by the query for each removed name.
+	! @return: `false` on failure.
+	*/
+	const auto remove_unused = [this](
+		const std::string &query, const std::set<int64_t> &ids,
+		const std::function<void(int64_t)> &removed = {}
+	) {
+		SqliteStmt remove;
+		if (const int rc = remove.prepare(m_stmtCache, _handle, query); rc != SQLITE_OK) {
+			SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+			return false;
+		}
+		for (const int64_t id : ids) {
+			[[maybe_unused]] const int rc = remove.bind_int64(1, id);
+			assert(rc == SQLITE_OK);
+			const int rcode = remove.step();
+			if (rcode == SQLITE_ROW && removed) {
+				removed(remove.column_int64(0));
+			}
+			(void)remove.reset();
+			if (rcode != SQLITE_ROW && rcode != SQLITE_DONE) {
+				SPDLOG_ERROR("sqlite3_step() failed ({:d}): {:s}", rcode, sqlite3_errstr(rcode));
+				return false;
+			}
+		}
+		return true;
+	};
+	
+	for (const auto &[file, tags] : entries) {
+		const std::optional<int64_t> artistId = get_id(artists, tags.artist, tags.artist,
+			selectArtist, insertArtist
+		);
+		// compilations are grouped under their album artist instead of each track's artist
+		const std::optional<int64_t> albumArtistId = tags.albumArtist.empty() ? artistId
+			: get_id(artists, tags.albumArtist, tags.albumArtist, selectArtist, insertArtist);
+		const std::optional<int64_t> albumId = (artistId.has_value() && albumArtistId.has_value())
+			? get_id(albums, std::pair(*albumArtistId, tags.album), tags.album,
+				selectAlbum, insertAlbum, *albumArtistId)
+			: std::nullopt;
+		const std::optional<int64_t> genreId = get_id(genres, tags.genre, tags.genre,
+			selectGenre, insertGenre
+		);
+		if (!albumId.has_value() || !genreId.has_value() || !collect_replaced(file.path)) {
+			return false;
+		}
+		
+		if (stmt.bind_text_static(1, file.path.native()) == SQLITE_NOMEM) {
+			throw std::bad_alloc();
+		}
+		[[maybe_unused]] int rc = stmt.bind_int64(2, file.size);
+		assert(rc == SQLITE_OK);
+		rc = stmt.bind_int64(3, file.mtime);
+		assert(rc == SQLITE_OK);
+		rc = tags.title.empty() ? stmt.bind_null(4) : stmt.bind_text_static(4, tags.title);
+		if (rc == SQLITE_NOMEM) { throw std::bad_alloc(); }
+		bind_int_or_null(5, *artistId);
+		bind_int_or_null(6, *albumId);
+		bind_int_or_null(7, *genreId);
+		bind_int_or_null(8, tags.track);
+		bind_int_or_null(9, tags.year);
+		
+		const int rcode = stmt.step();
+		(void)stmt.reset();
+		if (rcode != SQLITE_DONE) {
+			SPDLOG_ERROR("sqlite3_step() failed ({:d}): {:s}", rcode, sqlite3_errstr(rcode));
+			return false;
+		}
+	}
+	
+	// albums go first, the artists of the removed ones may not be used anymore either
+	const auto add_artist = [&replacedArtists](const int64_t id) { replacedArtists.insert(id); };
+	if (!remove_unused(deleteAlbum, replacedAlbums, add_artist)
+		|| !remove_unused(deleteArtist, replacedArtists)
+		|| !remove_unused(deleteGenre, replacedGenres)
+	) {
+		return false;
+	}
+	
+	if (const int rc = transaction.commit(); rc != SQLITE_OK) {
+		SPDLOG_ERROR("COMMIT failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return false;
+	}
+	SPDLOG_TRACE("Stored the tags of {:d} files", entries.size());
+	return true;
+}
+
+bool Sqlite3::index_deferred_files(void)
+{
+	static const std::string pendingQuery = fmt::format(
+		R"(SELECT EXISTS (SELECT 1 FROM [{}]);)",
+		Tab::FILES_FTS_DEFERRED
+	);
+	static const std::string indexQuery = fmt::format(
+		R"(INSERT INTO [{0}] ([rowid], [{1}])
+		SELECT f.[rowid], f.[{1}] FROM [{2}] AS f JOIN [{3}] AS d ON d.[{4}] = f.[{5}];)",
+		Tab::FILES_FTS, Tab::Files::NAME, Tab::FILES,
+		Tab::FILES_FTS_DEFERRED, Tab::FilesFtsDeferred::PLAYLIST_ID, Tab::Files::PLAYLIST_ID
+	);
+	static const std::string clearQuery = fmt::format(
+		R"(DELETE FROM [{}];)",
+		Tab::FILES_FTS_DEFERRED
+	);
+	
+	// most searches find nothing to index, which doesn't need the writer
+	{
+		const ReadLease conn(m_pool.get(), _handle, m_stmtCache);
+		SqliteStmt stmt;
+		const int rc = stmt.prepare(conn._stmtCache, conn._handle, pendingQuery);
+		if (rc != SQLITE_OK) {
+			SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+			return false;
+		}
+		if (const int rcode = stmt.step(); rcode != SQLITE_ROW) {
+			SPDLOG_ERROR("sqlite3_step() failed ({:d}): {:s}", rcode, sqlite3_errstr(rcode));
+			return false;
+		}
+		if (stmt.column_int64(0) == 0) {
+			return true;
+		}
+	}
+	
+	const auto lock = this->lock_writer();
+	SqliteTransaction transaction(_handle);
+	if (const int rc = transaction.begin(); rc != SQLITE_OK) {
+		SPDLOG_ERROR("BEGIN failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return false;
+	}
+	for (const std::string *query : { &indexQuery, &clearQuery }) {
+		SqliteStmt stmt;
+		if (const int rc = stmt.prepare(m_stmtCache, _handle, *query); rc != SQLITE_OK) {
+			SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+			return false;
+		}
+		if (const int rcode = stmt.step(); rcode != SQLITE_DONE) {
+			SPDLOG_ERROR("sqlite3_step() failed ({:d}): {:s}", rcode, sqlite3_errstr(rcode));
+			return false;
+		}
+	}
+	if (const int rc = transaction.commit(); rc != SQLITE_OK) {
+		SPDLOG_ERROR("COMMIT failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return false;
+	}
+	return true;
+}
+
+std::optional<int64_t> Sqlite3::get_playlist_id(const std::string &playlist)
+{
+	constexpr int BOUND_PARAM = 1;
+	static const std::string query = fmt::format(
+		R"(SELECT [{}] FROM [{}] WHERE [{}] = ?{:d};)",
+		Tab::Playlists::ID, Tab::PLAYLISTS, Tab::Playlists::NAME, BOUND_PARAM
+	);
+	
+	SqliteStmt stmt;
+	if (const int rc = stmt.prepare(m_stmtCache, _handle, query); rc != SQLITE_OK) {
+		SPDLOG_ERROR("sqlite3_prepare() failed ({:d}): {:s}", rc, sqlite3_errstr(rc));
+		return std::nullopt;
+	}
+	if (stmt.bind_text(BOUND_PARAM, playlist) == SQLITE_NOMEM) { throw std::bad_alloc(); }
+	
+	const int rcode = stmt.step();
+	if (rcode == SQLITE_ROW) {
+		constexpr int COLUMN = 0;
+		ASSERT_SQLITE_COLUMN(stmt, COLUMN, SQLITE_INTEGER, Tab::Playlists::ID);
+		return stmt.column_int64(COLUMN);
+	}
+	if (rcode != SQLITE_DONE) {
+		SPDLOG_ERROR("sqlite3_step() failed ({:d}): {:s}", rcode, sqlite3_errstr(rcode));
+	}
+	return std::nullopt;
+}
+
+std::unique_lock<std::recursive_mutex> Sqlite3::lock_writer(void)
+{
+	if (m_pool == nullptr) { return {}; }
+	return std::unique_lock(m_pool->_writeMutex);
 }
 
 int Sqlite3::close_handle(void)
 {
+	if (m_pool != nullptr) {
+		m_pool->close();
+	}
+	// cached statements would keep the connection open as a "zombie"
+	m_stmtCache.clear();
 	const int err = sqlite3_close_v2(_handle);
 	if (err == SQLITE_OK) {
 		_handle = nullptr;
@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <array>
+#include <string_view>
+
+#include "DurationReader.h"
+#include "misc.h"
+#include "momuma/spdlog.h"
+
+
+namespace Momuma
+{
+
+namespace
+{
+
+using Bytes = std::span<const uint8_t>;
+using Duration = std::optional<chrono::microseconds>;
+
+// `samples / rate` seconds, without overflowing for large sample counts
+[[nodiscard]] chrono::microseconds to_duration(const uint64_t samples, const uint32_t rate)
+{
+	constexpr uint64_t US = 1'000'000;
+	return chrono::microseconds(samples / rate * US + samples % rate * US / rate);
+}
+
+// #@return: offset of the data following the ID3v2 tags at the beginning of `data`, if any.
+[[nodiscard]] size_t skip_id3v2(const Bytes data)
+{
+	// "ID3", version (2), flags, size as a 28-bit "syncsafe" integer (7 bits per byte)
+	size_t offset = 0;
+	while (has_magic(data, offset, "ID3") && data.size() - offset >= 10) {
+		const size_t size = offset + 6;
+		if ((data[size] | data[size + 1] | data[size + 2] | data[size + 3]) & 0x80) {
+			break;
+		}
+		const bool footer = data[offset + 5] & 0x10;
+		offset += 10 + (footer ? 10 : 0) + (size_t(data[size]) << 21 | size_t(data[size + 1]) << 14
+			| size_t(data[size + 2]) << 7 | size_t(data[size + 3]));
+	}
+	return std::min(offset, data.size());
+}
+
+struct MpegFrame
+{
+	uint32_t stream; // header bits shared by all the frames of a stream
+	uint32_t bitrate; // bits per second
+	uint32_t sampleRate;
+	uint32_t samples; // per frame
+	size_t size; // in bytes, including the header
+	size_t sideInfo; // size of the layer III side information following the header
+};
+
+[[nodiscard]] std::optional<MpegFrame> parse_mpeg_frame(const Bytes data, const size_t offset)
+{
+	// kbps, by table (below) and bitrate index, 0 is "free format"
+	constexpr std::array<std::array<uint16_t, 15>, 5> BITRATES = {{
+		{ 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 }, // V1 L1
+		{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 }, // V1 L2
+		{ 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 }, // V1 L3
+		{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 }, // V2 L1
+		{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 }, // V2 L2 & L3
+	}};
+	constexpr std::array<uint32_t, 3> SAMPLE_RATES = { 44100, 48000, 32000 };
+	
+	if (offset > data.size() || data.size() - offset < 4) {
+		return std::nullopt;
+	}
+	const uint32_t header = read_be32(data, offset);
+	const unsigned version = (header >> 19) & 3; // 0: MPEG 2.5, 2: MPEG 2, 3: MPEG 1
+	const unsigned layer = (header >> 17) & 3; // 1: layer III, 2: layer II, 3: layer I
+	const unsigned bitrateIndex = (header >> 12) & 15;
+	const unsigned rateIndex = (header >> 10) & 3;
+	
+	if ((header >> 21) != 0x7FF || version == 1 || layer == 0
+		|| bitrateIndex == 0 || bitrateIndex == 15 || rateIndex == 3
+	) {
+		return std::nullopt;
+	}
+	
+	const bool mpeg1 = (version == 3);
+	const size_t table = mpeg1 ? (3 - layer) : (layer == 3 ? 3 : 4);
+	const bool padding = (header >> 9) & 1;
+	const bool mono = ((header >> 6) & 3) == 3;
+	
+	MpegFrame frame;
+	frame.stream = header & 0xFFFE0C00;
+	frame.bitrate = BITRATES[table][bitrateIndex] * 1000;
+	frame.sampleRate = SAMPLE_RATES[rateIndex] >> (mpeg1 ? 0 : (version == 2 ? 1 : 2));
+	frame.samples = (layer == 3) ? 384 : ((layer == 1 && !mpeg1) ? 576 : 1152);
+	frame.size = (layer == 3)
+		? (12 * frame.bitrate / frame.sampleRate + padding) * 4
+		: frame.samples / 8 * frame.bitrate / frame.sampleRate + padding;
+	frame.sideInfo = mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17);
+	return frame;
+}
+
+[[nodiscard]] Duration mp3_duration(const Bytes data, const size_t offset, const MpegFrame &first)
+{
+	// "Xing" (VBR) or "Info" (CBR) after the side information: id, flags, frame count
+	const size_t xing = offset + 4 + first.sideInfo;
+	if ((has_magic(data, xing, "Xing") || has_magic(data, xing, "Info"))
+		&& data.size() - xing >= 12 && (read_be32(data, xing + 4) & 1)
+	) {
+		const uint32_t frames = read_be32(data, xing + 8);
+		if (frames == 0) {
+			return std::nullopt;
+		}
+		return to_duration(uint64_t(frames) * first.samples, first.sampleRate);
+	}
+	
+	// "VBRI" at a fixed offset: id, version, delay, quality, byte count, frame count
+	const size_t vbri = offset + 4 + 32;
+	if (has_magic(data, vbri, "VBRI") && data.size() - vbri >= 18) {
+		const uint32_t frames = read_be32(data, vbri + 14);
+		if (frames == 0) {
+			return std::nullopt;
+		}
+		return to_duration(uint64_t(frames) * first.samples, first.sampleRate);
+	}
+	
+	// constant bitrate, without the trailing ID3v1 tag
+	size_t audioEnd = data.size();
+	if (audioEnd - offset >= 128 && has_magic(data, audioEnd - 128, "TAG")) {
+		audioEnd -= 128;
+	}
+	return to_duration(uint64_t(audioEnd - offset) * 8, first.bitrate);
+}
+
+[[nodiscard]] Duration parse_mp3(const Bytes data, const size_t start)
+{
+	// random bytes can look like a frame header, a real one is followed by consistent frames
+	constexpr size_t SEARCH_LIMIT = 64 * 1024;
+	constexpr int CHECKED_FRAMES = 3;
+	
+	const size_t end = std::min(data.size(), start + SEARCH_LIMIT);
+	for (size_t offset = start; offset < end; ++offset) {
+		const std::optional<MpegFrame> first = parse_mpeg_frame(data, offset);
+		if (!first.has_value()) {
+			continue;
+		}
+		
+		size_t next = offset + first->size;
+		int checked = 1;
+		for (; checked < CHECKED_FRAMES; ++checked) {
+			const std::optional<MpegFrame> frame = parse_mpeg_frame(data, next);
+			if (!frame.has_value() || frame->stream != first->stream) {
+				break;
+			}
+			next += frame->size;
+		}
+		if (checked == CHECKED_FRAMES) {
+			return mp3_duration(data, offset, *first);
+		}
+	}
+	return std::nullopt;
+}
+
+[[nodiscard]] Duration parse_flac(const Bytes data, const size_t start)
+{
+	// "fLaC", then the mandatory STREAMINFO block: type (0), 24-bit size (34), data
+	const size_t info = start + 8;
+	if (data.size() - start < 8 + 34 || (data[start + 4] & 0x7F) != 0) {
+		return std::nullopt;
+	}
+	
+	// 20 bits of sample rate, 3 of channels, 5 of sample size, 36 of sample count
+	const uint32_t sampleRate = uint32_t(data[info + 10]) << 12 | uint32_t(data[info + 11]) << 4
+		| uint32_t(data[info + 12]) >> 4;
+	const uint64_t samples = uint64_t(data[info + 13] & 0x0F) << 32 | read_be32(data, info + 14);
+	if (sampleRate == 0 || samples == 0) {
+		return std::nullopt; // the encoder didn't know the length
+	}
+	return to_duration(samples, sampleRate);
+}
+
+[[nodiscard]] Duration parse_ogg(const Bytes data)
+{
+	// page header: "OggS", version, flags, granule position (LE 64), serial number (LE 32),
+	// sequence number, checksum, segment count, segment sizes
+	constexpr size_t HEADER_SIZE = 27;
+	constexpr size_t SEARCH_LIMIT = 256 * 1024; // pages are shorter than 64 KiB
+	if (data.size() < HEADER_SIZE) {
+		return std::nullopt;
+	}
+	
+	// the identification header is the first packet of the first page
+	const uint32_t serial = read_le32(data, 14);
+	const size_t packet = HEADER_SIZE + data[26];
+	uint32_t sampleRate;
+	uint64_t preSkip = 0;
+	if (has_magic(data, packet, "\x01" "vorbis") && data.size() - packet >= 16) {
+		sampleRate = read_le32(data, packet + 12);
+	}
+	else if (has_magic(data, packet, "OpusHead") && data.size() - packet >= 12) {
+		sampleRate = 48000; // granule positions of Opus streams are always at 48 kHz
+		preSkip = read_le16(data, packet + 10);
+	}
+	else {
+		return std::nullopt;
+	}
+	if (sampleRate == 0) {
+		return std::nullopt;
+	}
+	
+	// the last page of the stream holds its final granule position, -1 when no packet ends in it
+	const size_t lowest = (data.size() > SEARCH_LIMIT) ? data.size() - SEARCH_LIMIT : 0;
+	for (size_t offset = data.size() - HEADER_SIZE; offset >= lowest && offset > 0; --offset) {
+		if (!has_magic(data, offset, "OggS") || read_le32(data, offset + 14) != serial) {
+			continue;
+		}
+		const uint64_t granule = read_le64(data, offset + 6);
+		if (granule == UINT64_MAX) {
+			continue;
+		}
+		if (granule <= preSkip) {
+			return std::nullopt;
+		}
+		return to_duration(granule - preSkip, sampleRate);
+	}
+	return std::nullopt;
+}
+
+[[nodiscard]] Duration parse_wav(const Bytes data)
+{
+	// "RIFF", size, "WAVE", then chunks: id, size (LE 32), data padded to an even size
+	constexpr uint16_t FORMAT_PCM = 1;
+	constexpr uint16_t FORMAT_FLOAT = 3;
+	constexpr uint16_t FORMAT_EXTENSIBLE = 0xFFFE;
+	if (!has_magic(data, 8, "WAVE")) {
+		return std::nullopt;
+	}
+	
+	uint32_t byteRate = 0;
+	for (size_t offset = 12; offset + 8 <= data.size();) {
+		const uint32_t size = read_le32(data, offset + 4);
+		const size_t body = offset + 8;
+		
+		if (has_magic(data, offset, "fmt ")) {
+			if (size < 16 || data.size() - body < 16) {
+				return std::nullopt;
+			}
+			// compressed formats only store an average byte rate
+			const uint16_t format = read_le16(data, body);
+			if (format != FORMAT_PCM && format != FORMAT_FLOAT && format != FORMAT_EXTENSIBLE) {
+				return std::nullopt;
+			}
+			byteRate = read_le32(data, body + 8);
+		}
+		else if (has_magic(data, offset, "data")) {
+			if (byteRate == 0) {
+				return std::nullopt;
+			}
+			// streamed files may leave the size unset, their data then lasts until the end
+			const uint64_t bytes = std::min<uint64_t>(size, data.size() - body);
+			return to_duration(bytes, byteRate);
+		}
+		offset = body + size + (size & 1);
+	}
+	return std::nullopt;
+}
+
+}
+
+std::optional<chrono::microseconds> parse_header_duration(const std::span<const uint8_t> data)
+{
+	if (has_magic(data, 0, "RIFF")) {
+		return parse_wav(data);
+	}
+	if (has_magic(data, 0, "OggS")) {
+		return parse_ogg(data);
+	}
+	
+	const size_t start = skip_id3v2(data);
+	if (has_magic(data, start, "fLaC")) {
+		return parse_flac(data, start);
+	}
+	return parse_mp3(data, start);
+}
+
+std::optional<chrono::microseconds> read_header_duration(const fs::path &media)
+{
+	const MappedFile file(media);
+	if (!file) {
+		return std::nullopt;
+	}
+	return parse_header_duration(file.data());
+}
+
+chrono::microseconds read_duration(const fs::path &media, const chrono::microseconds timeout)
+{
+	if (const std::optional<chrono::microseconds> duration = read_header_duration(media)) {
+		return *duration;
+	}
+	SPDLOG_DEBUG("No duration in the headers of {:s}, probing it with mpv", media);
+	return MpvPlayer::query_duration(media, timeout);
+}
+
+}
@@ -0,0 +1,163 @@
+#include <algorithm>
+
+#include "DurationReader.h"
+#include "DurationScanner.h"
+#include "momuma/spdlog.h"
+
+
+namespace Momuma
+{
+
+DurationScanner::DurationScanner(unsigned workers, const chrono::microseconds timeout) :
+	m_timeout { timeout }
+{
+	if (workers == 0) {
+		workers = std::max(1u, std::thread::hardware_concurrency());
+	}
+	
+	m_workers.reserve(workers);
+	for (unsigned i = 0; i < workers; ++i) {
+		m_workers.emplace_back(&DurationScanner::run_worker, this);
+	}
+	SPDLOG_DEBUG("Started {:d} duration scanner workers", workers);
+}
+
+DurationScanner::~DurationScanner(void)
+{
+	{
+		const std::lock_guard lock(m_mutex);
+		m_stop = true;
+		// the dropped files won't have a result, their waiters return
+		for (const Job &job : m_queue) {
+			--job.channel->pending;
+			job.channel->cond.notify_all();
+		}
+		m_queue.clear();
+	}
+	m_stopSource.request_stop();
+	m_workCond.notify_all();
+	
+	for (std::thread &worker : m_workers) {
+		worker.join();
+	}
+}
+
+unsigned DurationScanner::worker_count(void) const
+{
+	return static_cast<unsigned>(m_workers.size());
+}
+
+void DurationScanner::submit(std::vector<fs::path> media)
+{
+	this->enqueue(std::move(media), m_submitted);
+}
+
+std::optional<DurationScanner::Result> DurationScanner::wait_result(const chrono::microseconds timeout)
+{
+	return this->take_result(m_submitted, timeout);
+}
+
+size_t DurationScanner::pending(void) const
+{
+	const std::lock_guard lock(m_mutex);
+	return m_submitted.pending;
+}
+
+size_t DurationScanner::scan(std::vector<fs::path> media, sigc::slot<void(const Result&)> callback)
+{
+	// lives until every file got its result or was dropped, workers never outlive it
+	Channel channel;
+	this->enqueue(std::move(media), channel);
+	
+	size_t count = 0;
+	while (std::optional<Result> result = this->take_result(channel, chrono::microseconds(-1))) {
+		callback(*result);
+		++count;
+	}
+	return count;
+}
+
+chrono::microseconds DurationScanner::scan_file(
+	const fs::path &media,
+	std::optional<MpvPlayer> &player
+) {
+	constexpr chrono::microseconds FAIL_VALUE(-1);
+	if (const std::optional<chrono::microseconds> duration = read_header_duration(media)) {
+		return *duration;
+	}
+	
+	// most files don't need mpv, its instance is only created once needed
+	if (!player.has_value()) {
+		mpv_error err;
+		player.emplace(err, MpvPlayer::Mode::PROBE);
+		if (err != MPV_ERROR_SUCCESS) {
+			SPDLOG_ERROR("Scanner player construction failed: ({}) {}", err, mpv_error_string(err));
+		}
+	}
+	if (!*player) {
+		return FAIL_VALUE;
+	}
+	return player->probe_duration(media, m_timeout, m_stopSource.get_token());
+}
+
+void DurationScanner::run_worker(void)
+{
+	std::optional<MpvPlayer> player;
+	
+	std::unique_lock lock(m_mutex);
+	while (true) {
+		m_workCond.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+		if (m_stop) {
+			return;
+		}
+		
+		Job job = std::move(m_queue.front());
+		m_queue.pop_front();
+		
+		lock.unlock();
+		const chrono::microseconds duration = this->scan_file(job.media, player);
+		lock.lock();
+		
+		job.channel->results.push_back({ std::move(job.media), duration });
+		job.channel->cond.notify_one();
+	}
+}
+
+void DurationScanner::enqueue(std::vector<fs::path> media, Channel &channel)
+{
+	{
+		const std::lock_guard lock(m_mutex);
+		if (m_stop) {
+			return;
+		}
+		channel.pending += media.size();
+		for (fs::path &path : media) {
+			m_queue.push_back({ std::move(path), &channel });
+		}
+	}
+	m_workCond.notify_all();
+}
+
+std::optional<DurationScanner::Result> DurationScanner::take_result(
+	Channel &channel, const chrono::microseconds timeout
+) {
+	std::unique_lock lock(m_mutex);
+	const auto ready = [&channel] { return !channel.results.empty() || channel.pending == 0; };
+	
+	if (timeout < timeout.zero()) {
+		channel.cond.wait(lock, ready);
+	}
+	else if (!channel.cond.wait_for(lock, timeout, ready)) {
+		return std::nullopt;
+	}
+	
+	if (channel.results.empty()) {
+		return std::nullopt;
+	}
+	Result result = std::move(channel.results.front());
+	channel.results.pop_front();
+	--channel.pending;
+	return result;
+}
+
+}
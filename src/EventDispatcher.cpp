@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "EventDispatcher.h"
+#include "momuma/spdlog.h"
+
+
+namespace Momuma
+{
+
+EventDispatcher::EventDispatcher(MpvPlayer &player) :
+	d_player { player }
+{
+	m_notifyFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (m_notifyFd < 0) {
+		SPDLOG_ERROR("eventfd() failed: {:s}", strerror(errno));
+		return;
+	}
+	
+	// the thread drains the events queued before the callback was set
+	mpv_set_wakeup_callback(d_player._ctx, &EventDispatcher::on_wakeup, this);
+	m_thread = std::thread(&EventDispatcher::run, this);
+}
+
+EventDispatcher::~EventDispatcher(void)
+{
+	if (m_thread.joinable()) {
+		// no callback is running anymore once this returns
+		mpv_set_wakeup_callback(d_player._ctx, nullptr, nullptr);
+		m_stop = true;
+		on_wakeup(this);
+		m_thread.join();
+	}
+	
+	if (m_notifyFd >= 0) { close(m_notifyFd); }
+}
+
+EventDispatcher::operator bool(void) const
+{
+	return m_thread.joinable();
+}
+
+int EventDispatcher::notify_fd(void) const
+{
+	return m_notifyFd;
+}
+
+bool EventDispatcher::wait(const chrono::milliseconds timeout)
+{
+	if (m_ring.size() > 0) {
+		return true;
+	}
+	
+	pollfd fd = { .fd = m_notifyFd, .events = POLLIN, .revents = 0 };
+	int ready = 0;
+	do {
+		ready = poll(&fd, 1, (timeout.count() < 0) ? -1 : static_cast<int>(timeout.count()));
+	} while (ready < 0 && errno == EINTR);
+	return ready > 0;
+}
+
+size_t EventDispatcher::drain(sigc::slot<void(const Record&)> callback, const size_t max)
+{
+	// reset before popping, a batch pushed meanwhile makes it readable again
+	uint64_t value;
+	[[maybe_unused]] const ssize_t length = read(m_notifyFd, &value, sizeof(value));
+	
+	std::array<Record, 64> batch;
+	size_t drained = 0;
+	while (drained < max) {
+		const size_t count = m_ring.pop_batch(batch.data(), std::min(batch.size(), max - drained));
+		if (count == 0) {
+			break;
+		}
+		for (size_t i = 0; i < count; ++i) {
+			callback(batch[i]);
+		}
+		drained += count;
+	}
+	return drained;
+}
+
+void EventDispatcher::on_wakeup(void *self)
+{
+	auto &dispatcher = *static_cast<EventDispatcher*>(self);
+	dispatcher.m_wakeups.fetch_add(1, std::memory_order_release);
+	dispatcher.m_wakeups.notify_one();
+}
+
+void EventDispatcher::run(void)
+{
+	bool overflowed = false; // records were dropped since the last successful push
+	bool shutdown = false; // libmpv only returns `MPV_EVENT_SHUTDOWN` after it
+	
+	const auto push = [&](const Record &record) {
+		if (overflowed) {
+			Record overflow = record;
+			overflow.id = MPV_EVENT_QUEUE_OVERFLOW;
+			overflow.error = 0;
+			overflow.replyUserdata = 0;
+			overflow.entryId = -1;
+			overflow.endReason = -1;
+			if (!m_ring.try_push(overflow)) {
+				return;
+			}
+			overflowed = false;
+		}
+		overflowed = !m_ring.try_push(record);
+	};
+	
+	while (!m_stop) {
+		const uint64_t wakeups = m_wakeups.load(std::memory_order_acquire);
+		
+		size_t pushed = 0;
+		while (!shutdown) {
+			mpv_event &event = *mpv_wait_event(d_player._ctx, 0);
+			if (event.event_id == MPV_EVENT_NONE) {
+				break;
+			}
+			
+			Record record = {
+				.id = event.event_id, .error = event.error,
+				.replyUserdata = event.reply_userdata,
+				.entryId = -1, .endReason = -1,
+				.state = d_player.handle_event(event),
+			};
+			if (event.event_id == MPV_EVENT_START_FILE) {
+				record.entryId = static_cast<mpv_event_start_file*>(event.data)->playlist_entry_id;
+			}
+			else if (event.event_id == MPV_EVENT_END_FILE) {
+				const auto &data = *static_cast<mpv_event_end_file*>(event.data);
+				record.entryId = data.playlist_entry_id;
+				record.endReason = data.reason;
+				record.error = data.error;
+			}
+			else if (event.event_id == MPV_EVENT_SHUTDOWN) {
+				shutdown = true;
+			}
+			
+			push(record);
+			++pushed;
+			// the record was pushed, the coroutines resolved by the event may wait for the next ones
+			(void)d_player.resume_ready();
+		}
+		
+		if (pushed > 0) {
+			const uint64_t one = 1;
+			[[maybe_unused]] const ssize_t written = write(m_notifyFd, &one, sizeof(one));
+			assert(written == sizeof(one));
+		}
+		m_wakeups.wait(wakeups, std::memory_order_acquire);
+	}
+}
+
+}
@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <string_view>
+
+#include "HistoryRecorder.h"
+#include "momuma/spdlog.h"
+
+
+namespace Momuma
+{
+
+HistoryRecorder::HistoryRecorder(
+	Database::Sqlite3 &database, const size_t capacity, const chrono::milliseconds commitDelay
+) :
+	d_database { database },
+	m_capacity { capacity },
+	m_commitDelay { commitDelay }
+{
+	m_thread = std::thread(&HistoryRecorder::write_loop, this);
+}
+
+HistoryRecorder::~HistoryRecorder(void)
+{
+	while (!m_players.empty()) {
+		this->detach(*m_players.begin()->first);
+	}
+	{
+		const std::lock_guard lock(m_mutex);
+		m_stop = true;
+	}
+	m_queueCond.notify_one();
+	m_thread.join();
+}
+
+bool HistoryRecorder::record(Database::PlayEvent event)
+{
+	{
+		const std::lock_guard lock(m_mutex);
+		if (m_stop || m_queue.size() >= m_capacity) {
+			++m_dropped;
+			return false;
+		}
+		m_queue.push_back(std::move(event));
+		++m_queued;
+	}
+	m_queueCond.notify_one();
+	return true;
+}
+
+bool HistoryRecorder::flush(const chrono::milliseconds timeout)
+{
+	std::unique_lock lock(m_mutex);
+	const uint64_t target = m_queued;
+	// an empty queue would leave the flag set, committing the next event without waiting
+	if (!m_queue.empty()) {
+		m_flush = true;
+		m_queueCond.notify_one();
+	}
+	return m_writtenCond.wait_for(lock, timeout, [this, target] { return m_written >= target; });
+}
+
+uint64_t HistoryRecorder::dropped(void) const
+{
+	return m_dropped;
+}
+
+void HistoryRecorder::attach(MpvPlayer &player)
+{
+	if (m_players.contains(&player)) {
+		return;
+	}
+	auto tracking = std::make_unique<Tracking>();
+	Tracking &state = *tracking;
+	
+	state.connections.push_back(player.signal_eventFileLoaded.connect([&player, &state] {
+		const auto [pathErr, path] = player.get<Prop::Path>();
+		const auto [durationErr, duration] = player.get<Prop::Duration>();
+		state.media = (pathErr == MPV_ERROR_SUCCESS) ? fs::path(path) : fs::path();
+		state.duration = (durationErr == MPV_ERROR_SUCCESS) ? duration : chrono::microseconds(0);
+		state.position = chrono::microseconds(0);
+	}));
+	
+	// `playback-time` is observed by every player, the last value is kept when it's unavailable
+	state.connections.push_back(player.signal_eventPropertyChange.connect(
+		[&state](uint64_t, mpv_event_property &property) {
+			if (property.format == Prop::PlaybackTime::FORMAT
+				&& std::string_view(property.name) == Prop::PlaybackTime::NAME
+			) {
+				state.position = MpvFormat<chrono::microseconds>::read(property.data);
+			}
+		}
+	));
+	state.connections.push_back(player.signal_eventEndFile.connect(
+		[this, &state](mpv_event_end_file &data) { this->on_end_file(state, data); }
+	));
+	
+	player.set_event_mask(player.get_event_mask()
+		| mpv_event_bit(MPV_EVENT_FILE_LOADED) | mpv_event_bit(MPV_EVENT_END_FILE));
+	m_players.emplace(&player, std::move(tracking));
+}
+
+void HistoryRecorder::detach(MpvPlayer &player)
+{
+	const auto it = m_players.find(&player);
+	if (it == m_players.end()) {
+		return;
+	}
+	for (sigc::connection &connection : it->second->connections) {
+		connection.disconnect();
+	}
+	m_players.erase(it);
+}
+
+
+
+// Private:
+// -----------------------------------------------------------------------------
+
+void HistoryRecorder::write_loop(void)
+{
+	std::vector<Database::PlayEvent> batch;
+	std::unique_lock lock(m_mutex);
+	while (true) {
+		m_queueCond.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+		if (m_queue.empty()) {
+			break;
+		}
+		
+		// group commit: the events following the first one share its transaction
+		m_queueCond.wait_for(lock, m_commitDelay, [this] {
+			return m_stop || m_flush || m_queue.size() >= m_capacity;
+		});
+		m_flush = false;
+		batch.swap(m_queue);
+		lock.unlock();
+		
+		if (!d_database.add_play_events(batch)) {
+			SPDLOG_ERROR("Failed to write {:d} play events", batch.size());
+			m_dropped += batch.size();
+		}
+		const size_t count = batch.size();
+		batch.clear();
+		
+		lock.lock();
+		m_written += count;
+		m_writtenCond.notify_all();
+	}
+}
+
+void HistoryRecorder::on_end_file(Tracking &state, const mpv_event_end_file &data)
+{
+	using Kind = Database::PlayEvent::Kind;
+	if (state.media.empty()) {
+		return;
+	}
+	
+	Kind kind;
+	switch (data.reason)
+	{
+	case MPV_END_FILE_REASON_EOF:
+		kind = Kind::PLAYED;
+		break;
+	case MPV_END_FILE_REASON_STOP:
+	case MPV_END_FILE_REASON_QUIT: {
+		const chrono::microseconds played = std::min<chrono::microseconds>(
+			PLAYED_POSITION, state.duration / 2
+		);
+		kind = (state.position >= played) ? Kind::PLAYED : Kind::SKIPPED;
+		break;
+	}
+	default:
+		// errors and redirections
+		state.media.clear();
+		return;
+	}
+	
+	(void)this->record(Database::PlayEvent {
+		.path = std::move(state.media),
+		.kind = kind,
+		.time = chrono::system_clock::now(),
+		.position = state.position,
+	});
+	state.media.clear();
+}
+
+}
@@ -0,0 +1,395 @@
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <poll.h>
+#include <set>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <unordered_map>
+
+#include "Indexer.h"
+#include "momuma/spdlog.h"
+
+
+namespace Momuma
+{
+
+// changes are written at the latest once this many were collected
+constexpr size_t MAX_BATCH = 256;
+
+// an `IN_MOVED_TO` following its `IN_MOVED_FROM` later than this is another file
+constexpr chrono::milliseconds MOVE_PAIR_DELAY { 10 };
+
+constexpr uint32_t WATCH_EVENTS = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+
+// hidden files are mostly temporary files of other programs
+[[nodiscard]] static inline
+bool is_hidden(const std::string_view name)
+{
+	return name.empty() || name.front() == '.';
+}
+
+/* #Appends the changes which make the stored files of `playlist` match its folder.
+! Only files stored relative to the playlist's folder are removed, other paths aren't
+part of the folder.
+*/
+static void diff_playlist(
+	Database::Sqlite3 &db, const fs::path &folder, const std::string &playlist,
+	std::vector<Database::FileChange> &changes
+) {
+	using Kind = Database::FileChange::Kind;
+	
+	std::set<fs::path> onDisk;
+	std::error_code err;
+	for (const fs::directory_entry &entry : fs::directory_iterator(folder / playlist, err)) {
+		if (entry.is_directory(err) || is_hidden(entry.path().filename().native())) {
+			continue;
+		}
+		onDisk.insert(entry.path().filename());
+	}
+	
+	std::set<fs::path> stored;
+	Database::MediaBatch batch;
+	(void)db.get_media_names(playlist, batch);
+	for (size_t i = 0; i < batch.size(); ++i) {
+		fs::path name = fs::path(batch[i]).lexically_normal();
+		if (name.empty() || name.is_absolute() || *name.begin() == "..") {
+			continue;
+		}
+		if (!onDisk.contains(name)) {
+			changes.push_back({
+				.kind = Kind::REMOVE_FILE, .playlist = playlist, .name = name
+			});
+		}
+		stored.insert(std::move(name));
+	}
+	
+	for (const fs::path &name : onDisk) {
+		if (!stored.contains(name)) {
+			changes.push_back({ .kind = Kind::ADD_FILE, .playlist = playlist, .name = name });
+		}
+	}
+}
+
+Indexer::Indexer(Database::Sqlite3 &database, const chrono::milliseconds batchDelay) :
+	d_database { database },
+	m_folder { database.get_playlists_location() },
+	m_batchDelay { batchDelay }
+{
+	m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (m_inotifyFd < 0) {
+		SPDLOG_ERROR("inotify_init1() failed: {:s}", strerror(errno));
+		return;
+	}
+	m_stopFd = eventfd(0, EFD_CLOEXEC);
+	if (m_stopFd < 0) {
+		SPDLOG_ERROR("eventfd() failed: {:s}", strerror(errno));
+		return;
+	}
+	
+	m_thread = std::thread(&Indexer::run, this);
+}
+
+Indexer::~Indexer(void)
+{
+	if (m_thread.joinable()) {
+		const uint64_t value = 1;
+		[[maybe_unused]] const ssize_t written = write(m_stopFd, &value, sizeof(value));
+		assert(written == sizeof(value));
+		m_thread.join();
+	}
+	
+	if (m_stopFd >= 0) { close(m_stopFd); }
+	if (m_inotifyFd >= 0) { close(m_inotifyFd); }
+}
+
+Indexer::operator bool(void) const
+{
+	return m_thread.joinable();
+}
+
+bool Indexer::wait_crawled(const chrono::milliseconds timeout)
+{
+	std::unique_lock lock(m_mutex);
+	return m_crawledCond.wait_for(lock, timeout, [this] { return m_crawled; });
+}
+
+void Indexer::run(void)
+{
+	using Database::FileChange;
+	using Kind = FileChange::Kind;
+	
+	std::vector<FileChange> batch;
+	auto batchStart = chrono::steady_clock::now();
+	
+	// makes the stored files of `playlist` match its folder again, without going through `batch`
+	const auto resync = [&](const std::string &playlist) {
+		std::error_code err;
+		std::vector<FileChange> changes;
+		if (!fs::is_directory(m_folder / playlist, err)) {
+			changes.push_back({ .kind = Kind::REMOVE_PLAYLIST, .playlist = playlist });
+		}
+		else if (d_database.apply_file_changes({
+			{ .kind = Kind::ADD_PLAYLIST, .playlist = playlist }
+		})) {
+			diff_playlist(d_database, m_folder, playlist, changes);
+		}
+		for (const FileChange &change : changes) {
+			if (!d_database.apply_file_changes({ change })) {
+				SPDLOG_ERROR("Failed to resync playlist '{}' with '{}'", playlist, m_folder);
+				return;
+			}
+		}
+	};
+	const auto flush = [&] {
+		if (batch.empty()) { return; }
+		if (!d_database.apply_file_changes(batch)) {
+			// one failing change rolls back the whole batch, the others are applied on their own
+			SPDLOG_WARN("Failed to apply {:d} changes of '{}', applying them one by one",
+				batch.size(), m_folder);
+			std::set<std::string> stale;
+			for (const FileChange &change : batch) {
+				if (d_database.apply_file_changes({ change })) { continue; }
+				stale.insert(change.playlist);
+				if (change.kind == Kind::RENAME_PLAYLIST) {
+					stale.insert(change.newName.string());
+				}
+			}
+			for (const std::string &playlist : stale) {
+				SPDLOG_WARN("Failed to apply a change of playlist '{}', resyncing it", playlist);
+				resync(playlist);
+			}
+		}
+		batch.clear();
+	};
+	const auto push = [&](FileChange change) {
+		if (batch.empty()) {
+			batchStart = chrono::steady_clock::now();
+		}
+		batch.push_back(std::move(change));
+		if (batch.size() >= MAX_BATCH) { flush(); }
+	};
+	
+	// watch descriptor -> name of the playlist whose folder it watches
+	std::unordered_map<int, std::string> playlists;
+	const int rootWd = inotify_add_watch(m_inotifyFd, m_folder.c_str(), WATCH_EVENTS);
+	if (rootWd < 0) {
+		SPDLOG_ERROR("Failed to watch '{}': {:s}", m_folder, strerror(errno));
+	}
+	
+	// starts following a playlist's folder and queues the changes found inside of it
+	const auto add_playlist = [&](const std::string &playlist) {
+		const int wd = inotify_add_watch(
+			m_inotifyFd, (m_folder / playlist).c_str(), WATCH_EVENTS
+		);
+		if (wd < 0) {
+			SPDLOG_ERROR("Failed to watch playlist '{}': {:s}", playlist, strerror(errno));
+			return;
+		}
+		playlists[wd] = playlist;
+		
+		push({ .kind = Kind::ADD_PLAYLIST, .playlist = playlist });
+		flush(); // the diff is computed against the stored files
+		std::vector<FileChange> changes;
+		diff_playlist(d_database, m_folder, playlist, changes);
+		for (FileChange &change : changes) { push(std::move(change)); }
+	};
+	const auto remove_playlist = [&](const std::string &playlist) {
+		for (const auto &[wd, name] : playlists) {
+			if (name == playlist) {
+				(void)inotify_rm_watch(m_inotifyFd, wd);
+				break;
+			}
+		}
+		push({ .kind = Kind::REMOVE_PLAYLIST, .playlist = playlist });
+	};
+	const auto crawl = [&] {
+		std::error_code err;
+		for (const fs::directory_entry &entry : fs::directory_iterator(m_folder, err)) {
+			if (entry.is_directory(err) && !is_hidden(entry.path().filename().native())) {
+				add_playlist(entry.path().filename().string());
+			}
+		}
+		flush();
+	};
+	
+	crawl();
+	{
+		const std::lock_guard lock(m_mutex);
+		m_crawled = true;
+	}
+	m_crawledCond.notify_all();
+	SPDLOG_DEBUG("Crawled '{}', following {:d} playlists", m_folder, playlists.size());
+	
+	// the first half of a rename, resolved by the next event, which may come with the next read
+	struct MovedFrom
+	{
+		uint32_t cookie;
+		int wd;
+		std::string name;
+		chrono::steady_clock::time_point time;
+	};
+	std::optional<MovedFrom> movedFrom;
+	
+	// a `IN_MOVED_FROM` without its `IN_MOVED_TO` was moved out of the watched folders
+	const auto resolve_moved_out = [&] {
+		if (!movedFrom.has_value()) { return; }
+		if (movedFrom->wd == rootWd) {
+			remove_playlist(movedFrom->name);
+		}
+		else if (auto it = playlists.find(movedFrom->wd); it != playlists.end()) {
+			push({
+				.kind = Kind::REMOVE_FILE, .playlist = it->second, .name = movedFrom->name
+			});
+		}
+		movedFrom.reset();
+	};
+	
+	const auto handle_root_event = [&](const inotify_event &event, std::string name) {
+		if ((event.mask & IN_ISDIR) == 0 || is_hidden(name)) { return; }
+		
+		if (event.mask & IN_CREATE) {
+			add_playlist(name);
+		}
+		else if (event.mask & IN_DELETE) {
+			push({ .kind = Kind::REMOVE_PLAYLIST, .playlist = std::move(name) });
+		}
+		else if (event.mask & IN_MOVED_FROM) {
+			movedFrom = { event.cookie, event.wd, std::move(name), chrono::steady_clock::now() };
+		}
+		else if (event.mask & IN_MOVED_TO) {
+			if (movedFrom.has_value() && movedFrom->cookie == event.cookie) {
+				for (auto &[wd, playlist] : playlists) {
+					if (playlist == movedFrom->name) { playlist = name; }
+				}
+				push({
+					.kind = Kind::RENAME_PLAYLIST,
+					.playlist = std::move(movedFrom->name), .newName = name
+				});
+				movedFrom.reset();
+			}
+			else {
+				add_playlist(name);
+			}
+		}
+	};
+	
+	const auto handle_playlist_event = [&](const inotify_event &event, std::string name) {
+		const auto it = playlists.find(event.wd);
+		if (it == playlists.end() || (event.mask & IN_ISDIR) || is_hidden(name)) { return; }
+		const std::string &playlist = it->second;
+		
+		if (event.mask & IN_CREATE) {
+			push({ .kind = Kind::ADD_FILE, .playlist = playlist, .name = std::move(name) });
+		}
+		else if (event.mask & IN_DELETE) {
+			push({ .kind = Kind::REMOVE_FILE, .playlist = playlist, .name = std::move(name) });
+		}
+		else if (event.mask & IN_MOVED_FROM) {
+			movedFrom = { event.cookie, event.wd, std::move(name), chrono::steady_clock::now() };
+		}
+		else if (event.mask & IN_MOVED_TO) {
+			if (movedFrom.has_value() && movedFrom->cookie == event.cookie) {
+				if (movedFrom->wd == event.wd) {
+					push({
+						.kind = Kind::RENAME_FILE, .playlist = playlist,
+						.name = std::move(movedFrom->name), .newName = std::move(name)
+					});
+					movedFrom.reset();
+					return;
+				}
+				resolve_moved_out(); // moved between playlists
+			}
+			push({ .kind = Kind::ADD_FILE, .playlist = playlist, .name = std::move(name) });
+		}
+	};
+	
+	std::array<pollfd, 2> fds = {{
+		{ .fd = m_inotifyFd, .events = POLLIN, .revents = 0 },
+		{ .fd = m_stopFd, .events = POLLIN, .revents = 0 },
+	}};
+	alignas(inotify_event) std::array<char, 64 * 1024> buffer;
+	
+	while (true) {
+		// woken up for the batch's delay, and for the other half of a rename
+		std::optional<chrono::steady_clock::time_point> deadline;
+		if (!batch.empty()) {
+			deadline = batchStart + m_batchDelay;
+		}
+		if (movedFrom.has_value()) {
+			deadline = std::min(
+				deadline.value_or(chrono::steady_clock::time_point::max()),
+				movedFrom->time + MOVE_PAIR_DELAY
+			);
+		}
+		int timeout = -1;
+		if (deadline.has_value()) {
+			const auto left = chrono::ceil<chrono::milliseconds>(
+				*deadline - chrono::steady_clock::now()
+			);
+			timeout = std::max(0, static_cast<int>(left.count()));
+		}
+		
+		const int ready = poll(fds.data(), fds.size(), timeout);
+		if (ready < 0) {
+			if (errno == EINTR) { continue; }
+			SPDLOG_ERROR("poll() failed: {:s}", strerror(errno));
+			break;
+		}
+		if (fds[1].revents & POLLIN) {
+			break;
+		}
+		if (ready == 0) {
+			const auto now = chrono::steady_clock::now();
+			if (movedFrom.has_value() && now >= movedFrom->time + MOVE_PAIR_DELAY) {
+				resolve_moved_out();
+			}
+			if (!batch.empty() && now >= batchStart + m_batchDelay) {
+				flush();
+			}
+			continue;
+		}
+		
+		const ssize_t length = read(m_inotifyFd, buffer.data(), buffer.size());
+		if (length <= 0) {
+			continue;
+		}
+		
+		for (ssize_t offset = 0; offset < length;) {
+			const auto &event = *reinterpret_cast<const inotify_event*>(
+				&buffer[static_cast<size_t>(offset)]
+			);
+			offset += static_cast<ssize_t>(sizeof(inotify_event) + event.len);
+			std::string name = (event.len > 0) ? event.name : "";
+			
+			const bool isMovedTo = (event.mask & IN_MOVED_TO) != 0;
+			if (movedFrom.has_value() && !(isMovedTo && event.cookie == movedFrom->cookie)) {
+				resolve_moved_out();
+			}
+			
+			if (event.mask & IN_Q_OVERFLOW) {
+				// events were lost, playlists whose folder was removed meanwhile are kept
+				SPDLOG_WARN("inotify queue overflow, crawling '{}' again", m_folder);
+				crawl();
+			}
+			else if (event.mask & IN_IGNORED) {
+				playlists.erase(event.wd);
+			}
+			else if (event.wd == rootWd) {
+				handle_root_event(event, std::move(name));
+			}
+			else {
+				handle_playlist_event(event, std::move(name));
+			}
+		}
+	}
+	
+	resolve_moved_out();
+	flush();
+}
+
+}
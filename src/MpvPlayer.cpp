@@ -1,8 +1,18 @@
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <cctype>
+#include <optional>
 #include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "MpvPlayer.h"
+#include "PlayerReactor.h"
+#include "momuma/bitset.h"
 #include "momuma/spdlog.h"
 
 
@@ -17,180 +27,138 @@ mpv_error command(mpv_handle &ctx, const std::span<const char*> args)
 	return static_cast<mpv_error>(mpv_command(&ctx, args.data()));
 }
 
-//a thin and type-safe wrapper for `mpv_set_property()` and `mpv_get_property()`.
-struct Property
+// #Integer at `key` of the map `node`, nothing if `node` isn't a map or doesn't have it.
+[[nodiscard]] static
+std::optional<int64_t> map_int64(const mpv_node &node, const std::string_view key)
 {
-	mpv_handle &_ctx;
-	const char *const _name;
-	
-	/*
-	! `PropertyProxy` should be constructed with a string literal for the `name` param.
-	! @param ctx: reference to a valid `mpv_handle`.
-	! @param name: a C-string representing the name of the mpv property.
-	*/
-	inline Property(mpv_handle &ctx, const char *name) :
-		_ctx { ctx }, _name { name }
-	{}
-	
-	[[nodiscard]] mpv_error observe(uint64_t replyUserdata, mpv_format format);
-	
-	[[nodiscard]] mpv_error set(mpv_format format, const void *value);
-	[[nodiscard]] mpv_error get(mpv_format format, void *value) const;
-	
-	// Equivalent to using `Property::set(MPV_FORMAT_NONE, nullptr)`.
-	[[nodiscard]] mpv_error set(void);
-	
-	[[nodiscard]] mpv_error set_str(const std::string &value);
-	[[nodiscard]] mpv_error set_flag(bool value);
-	[[nodiscard]] mpv_error set_int(int64_t value);
-	[[nodiscard]] mpv_error set_float(double value);
-	[[nodiscard]] mpv_error set_time(chrono::microseconds value);
-	
-	[[nodiscard]] mpv_error get_str(std::string &value) const;
-	[[nodiscard]] mpv_error get_flag(bool &value) const;
-	[[nodiscard]] mpv_error get_int(int64_t &value) const;
-	[[nodiscard]] mpv_error get_float(double &value) const;
-	[[nodiscard]] mpv_error get_time(chrono::microseconds &value) const;
-};
-
-mpv_error Property::observe(uint64_t replyUserdata, mpv_format format)
-{
-	return static_cast<mpv_error>(mpv_observe_property(&_ctx, replyUserdata, _name, format));
-}
-
-mpv_error Property::set(mpv_format format, const void *value)
-{
-	return static_cast<mpv_error>(
-		mpv_set_property(&_ctx, _name, format, const_cast<void*>(value))
-	);
-}
-
-mpv_error Property::get(mpv_format format, void *value) const
-{
-	return static_cast<mpv_error>(mpv_get_property(&_ctx, _name, format, value));
+	if (node.format != MPV_FORMAT_NODE_MAP) {
+		return std::nullopt;
+	}
+	const mpv_node_list &map = *node.u.list;
+	for (int i = 0; i < map.num; ++i) {
+		if (map.keys[i] == key && map.values[i].format == MPV_FORMAT_INT64) {
+			return map.values[i].u.int64;
+		}
+	}
+	return std::nullopt;
 }
 
-mpv_error Property::set(void)
-{
-	return this->set(MPV_FORMAT_NONE, nullptr);
 }
 
-mpv_error Property::set_str(const std::string &value)
-{
-	const char *s = value.c_str();
-	return this->set(MPV_FORMAT_STRING, &s);
-}
 
-mpv_error Property::set_flag(const bool value)
-{
-	const int flag = value;
-	return this->set(MPV_FORMAT_FLAG, &flag);
-}
 
-mpv_error Property::set_int(int64_t value)
+namespace Momuma
 {
-	return this->set(MPV_FORMAT_INT64, &value);
-}
 
-mpv_error Property::set_float(double value)
-{
-	return this->set(MPV_FORMAT_DOUBLE, &value);
-}
+// properties observed by every player, their values are cached by `wait_event()`
+using ObservedProperties = PropertyList<
+	Prop::Pause, Prop::PlaylistCount, Prop::PlaylistPos, Prop::PlaybackTime
+>;
 
-mpv_error Property::set_time(chrono::microseconds value)
+// `reply_userdata` of the observed properties, unlikely to collide with ids
+// chosen by users of `signal_eventPropertyChange`
+namespace ObservedId
 {
-	double data = chrono::duration<double>(value).count();
-	return this->set_float(data);
+	constexpr uint64_t BASE = 0x4d4f4d554d410000; // "MOMUMA"
+	constexpr uint64_t PAUSE = BASE + ObservedProperties::index_of<Prop::Pause>();
+	constexpr uint64_t PLAYLIST_COUNT = BASE + ObservedProperties::index_of<Prop::PlaylistCount>();
+	constexpr uint64_t PLAYLIST_POS = BASE + ObservedProperties::index_of<Prop::PlaylistPos>();
+	constexpr uint64_t PLAYBACK_TIME = BASE + ObservedProperties::index_of<Prop::PlaybackTime>();
 }
 
-mpv_error Property::get_str(std::string &value) const
+// #Value of an observed property as stored by the cache, nothing if `property` has no value.
+template<MpvProperty P>
+[[nodiscard]] static std::optional<int64_t> cached_value(const mpv_event_property &property)
 {
-	char *s = nullptr;
-	mpv_error err = this->get(MPV_FORMAT_STRING, &s);
-	if (err == MPV_ERROR_SUCCESS) {
-		value = s;
-		mpv_free(s);
+	if (property.format != P::FORMAT) {
+		return std::nullopt;
+	}
+	const auto value = MpvFormat<typename P::Type>::read(property.data);
+	if constexpr (std::is_same_v<typename P::Type, chrono::microseconds>) {
+		return value.count();
+	}
+	else {
+		return static_cast<int64_t>(value);
 	}
-	return err;
-}
-
-mpv_error Property::get_flag(bool &value) const
-{
-	int flag = 0;
-	mpv_error err = this->get(MPV_FORMAT_FLAG, &flag);
-	value = flag;
-	return err;
 }
 
-mpv_error Property::get_int(int64_t &value) const
-{
-	return this->get(MPV_FORMAT_INT64, &value);
-}
+// `reply_userdata` of asynchronous requests start after this value
+constexpr uint64_t ASYNC_ID_BASE = 0x4d4f4d5541000000; // "MOMUA"
 
-mpv_error Property::get_float(double &value) const
+PlaylistDiff PlaylistSnapshot::diff(const PlaylistSnapshot &previous) const
 {
-	return this->get(MPV_FORMAT_DOUBLE, &value);
-}
-
-mpv_error Property::get_time(chrono::microseconds &value) const
-{
-	double data;
-	const mpv_error err = this->get_float(data);
-	value = chrono::duration_cast<chrono::microseconds>(chrono::duration<double>(data));
-	return err;
-}
-
+	const std::vector<Entry> &prev = previous.entries;
+	const size_t common = std::min(prev.size(), entries.size());
+	
+	size_t prefix = 0;
+	while (prefix < common && prev[prefix].id == entries[prefix].id) {
+		++prefix;
+	}
+	size_t suffix = 0;
+	while (suffix < common - prefix
+		&& prev[prev.size() - 1 - suffix].id == entries[entries.size() - 1 - suffix].id
+	) {
+		++suffix;
+	}
+	
+	PlaylistDiff result;
+	result.position = prefix;
+	result.removed = prev.size() - prefix - suffix;
+	result.added = entries.size() - prefix - suffix;
+	
+	// the same entry, `i` in this snapshot and `j` in `previous`
+	const auto compare = [&](const size_t i, const size_t j) {
+		if (entries[i].current != prev[j].current || entries[i].playing != prev[j].playing
+			|| this->filename(i) != previous.filename(j)
+		) {
+			result.updated.push_back(i);
+		}
+	};
+	for (size_t i = 0; i < prefix; ++i) {
+		compare(i, i);
+	}
+	for (size_t k = suffix; k > 0; --k) {
+		compare(entries.size() - k, prev.size() - k);
+	}
+	return result;
 }
 
-
-
-namespace Momuma
-{
-
 // Public:
 // -----------------------------------------------------------------------------
 
-chrono::microseconds MpvPlayer::query_duration(const fs::path &media)
-{
+const MpvEventMask MpvPlayer::REQUIRED_EVENTS = mpv_event_bit(MPV_EVENT_SHUTDOWN)
+	| mpv_event_bit(MPV_EVENT_PROPERTY_CHANGE)
+	| mpv_event_bit(MPV_EVENT_GET_PROPERTY_REPLY)
+	| mpv_event_bit(MPV_EVENT_COMMAND_REPLY);
+
+chrono::microseconds MpvPlayer::query_duration(
+	const fs::path &media,
+	const chrono::microseconds timeout
+) {
 	constexpr chrono::microseconds FAIL_VALUE(-1);
 	static mpv_error initErr;
-	static MpvPlayer player(initErr);
+	static MpvPlayer player(initErr, Mode::PROBE);
 	if (!player) {
 		SPDLOG_CRITICAL("Construction failed: ({}) {}", initErr, mpv_error_string(initErr));
 		return FAIL_VALUE;
 	}
-	
-	if (mpv_error e = player.set_media(media); e != MPV_ERROR_SUCCESS) {
-		SPDLOG_ERROR("Failure to player.set_media(): {:s}", mpv_error_string(e));
-		return FAIL_VALUE;
-	}
-	
-	static bool loaded = false;
-	while (true) {
-		const mpv_event_id event = player.wait_event(chrono::seconds(-1))->event_id;
-		
-		if (event == MPV_EVENT_FILE_LOADED) {
-			loaded = true;
-			mpv_error err;
-			return player.get_duration(err);
-		}
-		else if (event == MPV_EVENT_END_FILE) {
-			if (!loaded) { return FAIL_VALUE; }
-			loaded = false;
-		}
-	}
+	return player.probe_duration(media, timeout);
 }
 
 MpvPlayer::MpvPlayer(void) :
-	_ctx { mpv_create() }
+	_ctx { mpv_create() },
+	m_cache { std::make_unique<PropertyCache>() },
+	m_pending { std::make_unique<PendingReplies>() }
 {
 	(void)this->initialize();
 }
 
-MpvPlayer::MpvPlayer(mpv_error &err) :
-	_ctx { mpv_create() }
+MpvPlayer::MpvPlayer(mpv_error &err, const Mode mode) :
+	_ctx { mpv_create() },
+	m_cache { std::make_unique<PropertyCache>() },
+	m_pending { std::make_unique<PendingReplies>() }
 {
-	err = this->initialize();
+	err = this->initialize(mode);
 }
 
 MpvPlayer::~MpvPlayer(void)
@@ -198,6 +166,54 @@ MpvPlayer::~MpvPlayer(void)
 	this->destroy();
 }
 
+MpvPlayer::MpvPlayer(MpvPlayer &&other) noexcept :
+	_ctx { nullptr }
+{
+	*this = std::move(other);
+}
+
+MpvPlayer& MpvPlayer::operator=(MpvPlayer &&other) noexcept
+{
+	if (this == &other) {
+		return *this;
+	}
+	this->destroy();
+	
+	// the handle has a single owner, destroying `other` must not destroy it again
+	_ctx = std::exchange(other._ctx, nullptr);
+	m_lastState = other.m_lastState;
+	m_endFileTime = other.m_endFileTime;
+	m_fileLoadedTime = other.m_fileLoadedTime;
+	m_transition = std::exchange(other.m_transition, std::nullopt);
+	m_eventMask = other.m_eventMask;
+	m_cache = std::move(other.m_cache);
+	m_pending = std::move(other.m_pending);
+	
+	signal_streamStarted = std::move(other.signal_streamStarted);
+	signal_streamEnded = std::move(other.signal_streamEnded);
+	signal_stateChanged = std::move(other.signal_stateChanged);
+	signal_transition = std::move(other.signal_transition);
+	signal_eventNone = std::move(other.signal_eventNone);
+	signal_eventShutdown = std::move(other.signal_eventShutdown);
+	signal_eventLogMessage = std::move(other.signal_eventLogMessage);
+	signal_eventGetPropertyReply = std::move(other.signal_eventGetPropertyReply);
+	signal_eventSetPropertyReply = std::move(other.signal_eventSetPropertyReply);
+	signal_eventCommandReply = std::move(other.signal_eventCommandReply);
+	signal_eventStartFile = std::move(other.signal_eventStartFile);
+	signal_eventEndFile = std::move(other.signal_eventEndFile);
+	signal_eventFileLoaded = std::move(other.signal_eventFileLoaded);
+	signal_eventClientMessage = std::move(other.signal_eventClientMessage);
+	signal_eventVideoReconfig = std::move(other.signal_eventVideoReconfig);
+	signal_eventAudioReconfig = std::move(other.signal_eventAudioReconfig);
+	signal_eventSeek = std::move(other.signal_eventSeek);
+	signal_eventPlaybackRestart = std::move(other.signal_eventPlaybackRestart);
+	signal_eventPropertyChange = std::move(other.signal_eventPropertyChange);
+	signal_eventQueueOverflow = std::move(other.signal_eventQueueOverflow);
+	signal_eventHook = std::move(other.signal_eventHook);
+	signal_eventUnknown = std::move(other.signal_eventUnknown);
+	return *this;
+}
+
 MpvPlayer::operator bool(void) const
 {
 	return _ctx != nullptr;
@@ -210,10 +226,163 @@ MpvPlayer MpvPlayer::create_client(void)
 
 void MpvPlayer::destroy(void)
 {
+	// the wakeup pipe is closed with the handle
+	if (m_reactor != nullptr) {
+		m_reactor->remove(*this);
+	}
 	if (_ctx != nullptr) {
 		mpv_destroy(_ctx);
 		_ctx = nullptr;
 	}
+	if (m_pending == nullptr) {
+		return;
+	}
+	
+	// no reply will arrive anymore
+	std::unordered_map<uint64_t, PendingReplies::Resolver> resolvers;
+	{
+		const std::lock_guard lock(m_pending->mutex);
+		resolvers.swap(m_pending->resolvers);
+	}
+	for (auto &[id, resolver] : resolvers) {
+		if (const auto waiter = resolver(MPV_ERROR_GENERIC, nullptr)) {
+			const std::lock_guard lock(m_pending->mutex);
+			m_pending->ready.push_back(waiter);
+		}
+	}
+	// no event is dispatched anymore
+	(void)this->resume_ready();
+}
+
+MpvRequest<mpv_error> MpvPlayer::command_async(const std::span<const char *const> args)
+{
+	using Request = MpvRequest<mpv_error>;
+	auto state = std::make_shared<Request::State>();
+	
+	std::vector<const char*> argv(args.begin(), args.end());
+	argv.push_back(MpvUtil::STR_NULL);
+	(void)this->send_async(
+		[state](const int error, void*) {
+			return Request::resolve(*state, static_cast<mpv_error>(error));
+		},
+		[this, &argv](const uint64_t id) {
+			return mpv_command_async(_ctx, id, argv.data());
+		}
+	);
+	return Request(std::move(state));
+}
+
+template<typename T>
+MpvRequest<PropertyReply<T>> MpvPlayer::get_property_async(const char *name)
+{
+	using Format = MpvFormat<T>;
+	using Request = MpvRequest<PropertyReply<T>>;
+	auto state = std::make_shared<typename Request::State>();
+	
+	(void)this->send_async(
+		[state](const int error, void *data) {
+			PropertyReply<T> reply { static_cast<mpv_error>(error), T{} };
+			const auto *property = static_cast<const mpv_event_property*>(data);
+			if (error >= 0 && property != nullptr && property->format == Format::FORMAT) {
+				reply.value = Format::read(property->data);
+			}
+			else if (error >= 0) {
+				reply.error = MPV_ERROR_PROPERTY_FORMAT;
+			}
+			return Request::resolve(*state, std::move(reply));
+		},
+		[this, name](const uint64_t id) {
+			return mpv_get_property_async(_ctx, id, name, Format::FORMAT);
+		}
+	);
+	return Request(std::move(state));
+}
+
+template MpvRequest<PropertyReply<bool>> MpvPlayer::get_property_async(const char*);
+template MpvRequest<PropertyReply<int64_t>> MpvPlayer::get_property_async(const char*);
+template MpvRequest<PropertyReply<double>> MpvPlayer::get_property_async(const char*);
+template MpvRequest<PropertyReply<std::string>> MpvPlayer::get_property_async(const char*);
+template MpvRequest<PropertyReply<chrono::microseconds>> MpvPlayer::get_property_async(const char*);
+
+chrono::microseconds MpvPlayer::probe_duration(
+	const fs::path &media,
+	const chrono::microseconds timeout,
+	const std::stop_token stop
+) {
+	constexpr chrono::microseconds FAIL_VALUE(-1);
+	const auto deadline = chrono::steady_clock::now() + timeout;
+	
+	// like `set_media()`, the reply names the playlist entry of `media`
+	std::array cmd = { "loadfile", media.c_str(), MpvUtil::STR_NULL };
+	mpv_node result;
+	if (const auto e = static_cast<mpv_error>(mpv_command_ret(_ctx, cmd.data(), &result));
+		e != MPV_ERROR_SUCCESS
+	) {
+		SPDLOG_ERROR("Failure to load {:s}: {:s}", media, mpv_error_string(e));
+		return FAIL_VALUE;
+	}
+	this->invalidate_playlist();
+	
+	/* events of files loaded by earlier calls, which gave up before they started or ended,
+	may still be waiting: only those of this entry count. mpv older than 0.33 doesn't reply
+	with the id, the first file starting is taken instead */
+	int64_t entryId = MpvUtil::map_int64(result, "playlist_entry_id").value_or(-1);
+	mpv_free_node_contents(&result);
+	bool started = false;
+	
+	// interrupts `wait_event()`, which then returns `MPV_EVENT_NONE`
+	const std::stop_callback onStop(stop, [this] { mpv_wakeup(_ctx); });
+	
+	while (true) {
+		chrono::microseconds remaining(-1);
+		if (timeout >= timeout.zero()) {
+			remaining = chrono::duration_cast<chrono::microseconds>(
+				deadline - chrono::steady_clock::now()
+			);
+			remaining = std::max(remaining, remaining.zero());
+		}
+		if (stop.stop_requested() || remaining == remaining.zero()) {
+			break;
+		}
+		
+		const mpv_event &event = *this->wait_event(remaining);
+		
+		switch (event.event_id)
+		{
+		case MPV_EVENT_START_FILE: {
+			const int64_t id = static_cast<mpv_event_start_file*>(event.data)->playlist_entry_id;
+			if (entryId < 0) {
+				entryId = id;
+			}
+			started = (id == entryId);
+			break;
+		}
+		case MPV_EVENT_FILE_LOADED:
+			// only the file which started last can be loaded
+			if (started) {
+				mpv_error err;
+				const chrono::microseconds duration = this->get_duration(err);
+				return (err == MPV_ERROR_SUCCESS) ? duration : FAIL_VALUE;
+			}
+			break;
+		case MPV_EVENT_END_FILE:
+			if (entryId >= 0
+				&& static_cast<mpv_event_end_file*>(event.data)->playlist_entry_id == entryId
+			) {
+				return FAIL_VALUE;
+			}
+			break;
+		case MPV_EVENT_SHUTDOWN:
+			return FAIL_VALUE;
+		default:
+			break;
+		}
+	}
+	
+	// the file may still be opening, its `END_FILE` is skipped by the next call
+	SPDLOG_WARN("Gave up probing the duration of {:s}", media);
+	(void)this->command_async(std::array { "stop" });
+	return FAIL_VALUE;
 }
 
 void MpvPlayer::stop_playback(void)
@@ -228,6 +397,7 @@ void MpvPlayer::stop_playback(void)
 	std::array cmd2 { "playlist-remove", "0", MpvUtil::STR_NULL };
 	err = MpvUtil::command(*_ctx, cmd2);
 	SPDLOG_INFO("Playlist-remove: ({}) {}", err, mpv_error_string(err));
+	this->invalidate_playlist();
 	
 	this->set_play(false);
 }
@@ -235,7 +405,9 @@ void MpvPlayer::stop_playback(void)
 mpv_error MpvPlayer::set_media(const fs::path &media)
 {
 	std::array cmd = { "loadfile", media.c_str(), MpvUtil::STR_NULL };
-	return MpvUtil::command(*_ctx, cmd);
+	const mpv_error err = MpvUtil::command(*_ctx, cmd);
+	this->invalidate_playlist();
+	return err;
 }
 
 mpv_error MpvPlayer::append_media(const fs::path &media, const bool play)
@@ -248,32 +420,111 @@ mpv_error MpvPlayer::append_media(const fs::path &media, const bool play)
 		((count > 0) ? (play ? "append-play" : "append") : MpvUtil::STR_NULL),
 		MpvUtil::STR_NULL
 	};
-	return MpvUtil::command(*_ctx, cmd);
+	const mpv_error err = MpvUtil::command(*_ctx, cmd);
+	this->invalidate_playlist();
+	return err;
+}
+
+mpv_error MpvPlayer::append_media(const std::span<const fs::path> media, const bool play)
+{
+	// the playlist is parsed by mpv as m3u, from a `memory://` URL holding its content
+	static constexpr std::string_view HEADER = "memory://#EXTM3U\n";
+	
+	// m3u lines are stripped of surrounding spaces, and skipped if they start with '#'
+	const auto fits_line = [](const std::string_view path) {
+		return !path.empty() && path.front() != '#'
+			&& !isspace(static_cast<unsigned char>(path.front()))
+			&& !isspace(static_cast<unsigned char>(path.back()))
+			&& path.find_first_of("\r\n") == std::string_view::npos;
+	};
+	
+	const char *mode = (this->playlist_size() > 0) ? (play ? "append-play" : "append") : "replace";
+	std::string list(HEADER);
+	mpv_error err = MPV_ERROR_SUCCESS;
+	
+	const auto load = [this, &mode](const char *cmdName, const char *url) {
+		std::array cmd = { cmdName, url, mode, MpvUtil::STR_NULL };
+		const mpv_error e = MpvUtil::command(*_ctx, cmd);
+		mode = "append";
+		return e;
+	};
+	const auto flush_list = [&] {
+		if (list.size() > HEADER.size()) {
+			err = load("loadlist", list.c_str());
+			list.resize(HEADER.size());
+		}
+	};
+	
+	for (const fs::path &path : media) {
+		std::error_code ec;
+		const bool isUrl = path.native().find("://") != std::string::npos;
+		const fs::path full = (isUrl || path.is_absolute()) ? path : fs::absolute(path, ec);
+		
+		if (ec || !fits_line(full.native())) {
+			flush_list();
+			if (err == MPV_ERROR_SUCCESS) {
+				err = load("loadfile", path.c_str());
+			}
+		}
+		else {
+			list += full.native();
+			list += '\n';
+		}
+		if (err != MPV_ERROR_SUCCESS) {
+			break;
+		}
+	}
+	if (err == MPV_ERROR_SUCCESS) {
+		flush_list();
+	}
+	
+	this->invalidate_playlist();
+	return err;
 }
 
 mpv_error MpvPlayer::set_position(const chrono::microseconds position)
 {
-	return MpvUtil::Property(*_ctx, "playback-time").set_time(position);
+	const uint64_t generation = m_cache->position.invalidate();
+	const mpv_error err = this->set<Prop::PlaybackTime>(position);
+	this->resync<Prop::PlaybackTime>(m_cache->position, generation);
+	return err;
 }
 
 chrono::microseconds MpvPlayer::get_position(mpv_error &err) const
 {
-	chrono::microseconds data;
-	err = MpvUtil::Property(*_ctx, "playback-time").get_time(data);
-	return data;
+	const int64_t cached = m_cache->position.load();
+	if (cached == PropertyCache::UNAVAILABLE) {
+		err = MPV_ERROR_PROPERTY_UNAVAILABLE;
+		return chrono::microseconds(0);
+	}
+	else if (cached != PropertyCache::INVALID) {
+		err = MPV_ERROR_SUCCESS;
+		return chrono::microseconds(cached);
+	}
+	
+	const auto reply = this->get<Prop::PlaybackTime>();
+	err = reply.error;
+	return reply.value;
 }
 
 int64_t MpvPlayer::get_index(void) const
 {
-	int64_t index;
-	mpv_error err = MpvUtil::Property(*_ctx, "playlist-pos").get_int(index);
+	if (const int64_t cached = m_cache->index.load(); cached != PropertyCache::INVALID) {
+		return cached;
+	}
+	
+	[[maybe_unused]] const auto [err, index] = this->get<Prop::PlaylistPos>();
 	assert(err == MPV_ERROR_SUCCESS);
 	return index;
 }
 
 void MpvPlayer::set_index(const int64_t index)
 {
-	mpv_error err = MpvUtil::Property(*_ctx, "playlist-pos").set_int(index);
+	const uint64_t indexGeneration = m_cache->index.invalidate();
+	const uint64_t positionGeneration = m_cache->position.invalidate();
+	mpv_error err = this->set<Prop::PlaylistPos>(index);
+	this->resync<Prop::PlaylistPos>(m_cache->index, indexGeneration);
+	this->resync<Prop::PlaybackTime>(m_cache->position, positionGeneration);
 	if (err != MPV_ERROR_SUCCESS) {
 		SPDLOG_ERROR("Items = {} | ({:d}): {:s}", this->playlist_size(), err, mpv_error_string(err));
 	}
@@ -282,59 +533,123 @@ void MpvPlayer::set_index(const int64_t index)
 
 void MpvPlayer::set_volume(const double volume)
 {
-	[[maybe_unused]] mpv_error err = MpvUtil::Property(*_ctx, "volume").set_float(volume);
+	[[maybe_unused]] mpv_error err = this->set<Prop::Volume>(volume);
 	assert(err == MPV_ERROR_SUCCESS);
 }
 
 void MpvPlayer::set_mute(const bool mute)
 {
-	[[maybe_unused]] mpv_error err = MpvUtil::Property(*_ctx, "mute").set_flag(mute);
+	[[maybe_unused]] mpv_error err = this->set<Prop::Mute>(mute);
 	assert(err == MPV_ERROR_SUCCESS);
 }
 
 void MpvPlayer::set_play(const bool play)
 {
 	assert(!play || (play && this->playlist_size() > 0));
-	[[maybe_unused]] mpv_error err = MpvUtil::Property(*_ctx, "pause").set_flag(!play);
+	const uint64_t generation = m_cache->paused.invalidate();
+	[[maybe_unused]] mpv_error err = this->set<Prop::Pause>(!play);
 	assert(err == MPV_ERROR_SUCCESS);
+	this->resync<Prop::Pause>(m_cache->paused, generation);
 }
 
 bool MpvPlayer::is_paused(void) const
 {
-	bool paused;
-	[[maybe_unused]] mpv_error err = MpvUtil::Property(*_ctx, "pause").get_flag(paused);
+	if (const int64_t cached = m_cache->paused.load(); cached != PropertyCache::INVALID) {
+		return cached != 0;
+	}
+	
+	[[maybe_unused]] const auto [err, paused] = this->get<Prop::Pause>();
 	assert(err == MPV_ERROR_SUCCESS);
 	return paused;
 }
 
 chrono::microseconds MpvPlayer::get_duration(mpv_error &err) const
 {
-	chrono::microseconds data;
-	err = MpvUtil::Property(*_ctx, "duration").get_time(data);
-	return data;
+	const auto reply = this->get<Prop::Duration>();
+	err = reply.error;
+	return reply.value;
 }
 
 fs::path MpvPlayer::get_current_media(void) const
 {
-	std::string path;
-	const mpv_error err = MpvUtil::Property(*_ctx, "path").get_str(path);
+	[[maybe_unused]] const auto [err, path] = this->get<Prop::Path>();
 	assert(err == MPV_ERROR_SUCCESS);
 	return path;
 }
 
 int64_t MpvPlayer::playlist_size(void) const
 {
-	int64_t count;
-	mpv_error err = MpvUtil::Property(*_ctx, "playlist-count").get_int(count);
+	if (const int64_t cached = m_cache->count.load(); cached != PropertyCache::INVALID) {
+		return cached;
+	}
+	
+	[[maybe_unused]] const auto [err, count] = this->get<Prop::PlaylistCount>();
 	assert(err == MPV_ERROR_SUCCESS);
 	return count;
 }
 
+uint64_t MpvPlayer::playlist_generation(void) const
+{
+	return m_cache->playlistGeneration;
+}
+
 bool MpvPlayer::playlist_empty(void) const
 {
 	return this->playlist_size() <= 0;
 }
 
+mpv_error MpvPlayer::get_playlist(PlaylistSnapshot &snapshot) const
+{
+	snapshot.clear();
+	mpv_node node;
+	const auto err = static_cast<mpv_error>(
+		mpv_get_property(_ctx, "playlist", MPV_FORMAT_NODE, &node)
+	);
+	if (err != MPV_ERROR_SUCCESS) {
+		return err;
+	}
+	if (node.format != MPV_FORMAT_NODE_ARRAY) {
+		mpv_free_node_contents(&node);
+		return MPV_ERROR_PROPERTY_FORMAT;
+	}
+	
+	// one map per entry, `current` and `playing` are only present when set
+	const std::span items(node.u.list->values, static_cast<size_t>(node.u.list->num));
+	snapshot.entries.reserve(items.size());
+	for (const mpv_node &item : items) {
+		if (item.format != MPV_FORMAT_NODE_MAP) {
+			continue;
+		}
+		PlaylistSnapshot::Entry entry {
+			.id = -1, .offset = static_cast<uint32_t>(snapshot.arena.size()), .length = 0,
+			.current = false, .playing = false,
+		};
+		const mpv_node_list &map = *item.u.list;
+		for (size_t i = 0; i < static_cast<size_t>(map.num); ++i) {
+			const std::string_view key = map.keys[i];
+			const mpv_node &value = map.values[i];
+			if (key == "filename" && value.format == MPV_FORMAT_STRING) {
+				const std::string_view name = value.u.string;
+				snapshot.arena += name;
+				entry.length = static_cast<uint32_t>(name.size());
+			}
+			else if (key == "id" && value.format == MPV_FORMAT_INT64) {
+				entry.id = value.u.int64;
+			}
+			else if (key == "current" && value.format == MPV_FORMAT_FLAG) {
+				entry.current = value.u.flag != 0;
+			}
+			else if (key == "playing" && value.format == MPV_FORMAT_FLAG) {
+				entry.playing = value.u.flag != 0;
+			}
+		}
+		snapshot.entries.push_back(entry);
+	}
+	
+	mpv_free_node_contents(&node);
+	return MPV_ERROR_SUCCESS;
+}
+
 MpvPlayer::State MpvPlayer::get_state(void) const
 {
 	const bool paused = this->is_paused();
@@ -347,17 +662,182 @@ MpvPlayer::State MpvPlayer::get_state(void) const
 	return State::STOP;
 }
 
+mpv_error MpvPlayer::set_tuning(const PlaybackTuning &tuning)
+{
+	constexpr std::array GAPLESS = { "no", "yes", "weak" };
+	
+	// previous values of the options set so far, restored if a later one fails
+	std::vector<std::function<void()>> restore;
+	const auto apply = [this, &restore]<MpvProperty P>(P, const typename P::Type &value) {
+		auto previous = this->get<P>();
+		const mpv_error err = (previous.error != MPV_ERROR_SUCCESS)
+			? previous.error : this->set<P>(value);
+		if (err != MPV_ERROR_SUCCESS) {
+			SPDLOG_ERROR("Failed to set '{:s}' ({:d}): {:s}", P::NAME, err, mpv_error_string(err));
+			return err;
+		}
+		restore.emplace_back([this, value = std::move(previous.value)] {
+			(void)this->set<P>(value);
+		});
+		return err;
+	};
+	mpv_error err = apply(Prop::GaplessAudio{}, GAPLESS[static_cast<size_t>(tuning.gapless)]);
+	if (err == MPV_ERROR_SUCCESS) {
+		err = apply(Prop::PrefetchPlaylist{}, tuning.prefetchPlaylist);
+	}
+	if (err == MPV_ERROR_SUCCESS) {
+		err = apply(Prop::Cache{}, tuning.cache ? "yes" : "no");
+	}
+	if (err == MPV_ERROR_SUCCESS) {
+		// byte sizes have no numeric format, they're parsed from strings with suffixes
+		err = apply(Prop::DemuxerMaxBytes{}, std::to_string(tuning.demuxerMaxBytes));
+	}
+	if (err == MPV_ERROR_SUCCESS) {
+		err = apply(Prop::DemuxerReadaheadSecs{}, tuning.demuxerReadahead.count());
+	}
+	
+	if (err != MPV_ERROR_SUCCESS) {
+		std::for_each(restore.rbegin(), restore.rend(), [](const auto &undo) { undo(); });
+	}
+	return err;
+}
+
+MpvEventMask MpvPlayer::get_event_mask(void) const
+{
+	return m_eventMask;
+}
+
+void MpvPlayer::set_event_mask(const MpvEventMask mask)
+{
+	const Bitset<MpvEventMask> enabled(mask | REQUIRED_EVENTS);
+	const Bitset<MpvEventMask> current(m_eventMask);
+	
+	// event ids which are unknown or deprecated make `mpv_request_event()` fail, they stay off
+	MpvEventMask result = MpvEventMask::NONE;
+	for (size_t id = 1; id < enabled.size(); ++id) {
+		const auto eventId = static_cast<mpv_event_id>(id);
+		if (enabled[id] != current[id]) {
+			const int err = mpv_request_event(_ctx, eventId, enabled[id]);
+			if (err < 0) {
+				continue;
+			}
+		}
+		if (enabled[id]) {
+			result |= mpv_event_bit(eventId);
+		}
+	}
+	m_eventMask = result;
+}
+
+MpvEventMask MpvPlayer::connected_events(void) const
+{
+	if (!signal_eventUnknown.empty()) {
+		return MpvEventMask::ALL;
+	}
+	
+	MpvEventMask mask = REQUIRED_EVENTS;
+	const auto add = [&mask](const bool connected, const mpv_event_id id) {
+		if (connected) { mask |= mpv_event_bit(id); }
+	};
+	add(!signal_eventLogMessage.empty(), MPV_EVENT_LOG_MESSAGE);
+	add(!signal_eventSetPropertyReply.empty(), MPV_EVENT_SET_PROPERTY_REPLY);
+	add(!signal_eventStartFile.empty(), MPV_EVENT_START_FILE);
+	add(!signal_eventEndFile.empty() || !signal_streamEnded.empty(), MPV_EVENT_END_FILE);
+	add(!signal_eventFileLoaded.empty() || !signal_streamStarted.empty(), MPV_EVENT_FILE_LOADED);
+	add(!signal_eventClientMessage.empty(), MPV_EVENT_CLIENT_MESSAGE);
+	add(!signal_eventVideoReconfig.empty(), MPV_EVENT_VIDEO_RECONFIG);
+	add(!signal_eventAudioReconfig.empty(), MPV_EVENT_AUDIO_RECONFIG);
+	add(!signal_eventSeek.empty(), MPV_EVENT_SEEK);
+	add(!signal_eventPlaybackRestart.empty(), MPV_EVENT_PLAYBACK_RESTART);
+	add(!signal_eventQueueOverflow.empty(), MPV_EVENT_QUEUE_OVERFLOW);
+	add(!signal_eventHook.empty(), MPV_EVENT_HOOK);
+	if (!signal_transition.empty()) {
+		mask |= mpv_event_bit(MPV_EVENT_END_FILE) | mpv_event_bit(MPV_EVENT_FILE_LOADED)
+			| mpv_event_bit(MPV_EVENT_PLAYBACK_RESTART);
+	}
+	return mask;
+}
+
 mpv_event* MpvPlayer::wait_event(const chrono::microseconds timeout)
 {
+	// the previous event was dispatched, the caller may be waiting for the resumed coroutines
+	const bool resumed = this->resume_ready();
 	const auto t = chrono::duration_cast<chrono::duration<double>>(timeout);
-	mpv_event &event = *mpv_wait_event(_ctx, t.count());
+	mpv_event &event = *mpv_wait_event(_ctx, resumed ? 0.0 : t.count());
 	
-	const State currState = this->get_state();
-	if (currState != m_lastState) {
-		signal_stateChanged.emit(*this, m_lastState, currState);
-		m_lastState = currState;
+	const State prevState = m_lastState;
+	const State currState = this->handle_event(event);
+	if (currState != prevState) {
+		signal_stateChanged.emit(*this, prevState, currState);
+	}
+	this->emit_event(event);
+	return &event;
+}
+
+
+
+// Private:
+// -----------------------------------------------------------------------------
+
+MpvPlayer::State MpvPlayer::handle_event(mpv_event &event)
+{
+	switch (event.event_id)
+	{
+	case MPV_EVENT_PROPERTY_CHANGE:
+		this->update_cache(event.reply_userdata, *static_cast<mpv_event_property*>(event.data));
+		// the playlist ended or was stopped, loading another media isn't a transition
+		if (event.reply_userdata == ObservedId::PLAYLIST_POS && m_cache->index.load() == -1) {
+			m_endFileTime = {};
+			m_fileLoadedTime = {};
+		}
+		break;
+	case MPV_EVENT_GET_PROPERTY_REPLY:
+	case MPV_EVENT_COMMAND_REPLY:
+		this->resolve_reply(event);
+		break;
+	case MPV_EVENT_END_FILE:
+		// only the entries ending on their own are followed by an automatic transition
+		switch (static_cast<mpv_event_end_file*>(event.data)->reason)
+		{
+		case MPV_END_FILE_REASON_EOF:
+		case MPV_END_FILE_REASON_ERROR:
+			m_endFileTime = chrono::steady_clock::now();
+			break;
+		default:
+			m_endFileTime = {};
+			break;
+		}
+		m_fileLoadedTime = {};
+		break;
+	case MPV_EVENT_FILE_LOADED:
+		if (m_endFileTime != chrono::steady_clock::time_point()) {
+			m_fileLoadedTime = chrono::steady_clock::now();
+		}
+		break;
+	case MPV_EVENT_PLAYBACK_RESTART:
+		// seeks restart the playback too, without ending a file
+		if (m_fileLoadedTime != chrono::steady_clock::time_point()) {
+			using chrono::microseconds;
+			m_transition = TransitionTiming {
+				.loading = chrono::duration_cast<microseconds>(m_fileLoadedTime - m_endFileTime),
+				.starting = chrono::duration_cast<microseconds>(
+					chrono::steady_clock::now() - m_fileLoadedTime
+				),
+			};
+			m_endFileTime = {};
+			m_fileLoadedTime = {};
+		}
+		break;
+	default:
+		break;
 	}
 	
+	m_lastState = this->get_state();
+	return m_lastState;
+}
+
+void MpvPlayer::emit_event(mpv_event &event)
+{
 	switch (event.event_id)
 	{
 	case MPV_EVENT_NONE:
@@ -409,6 +889,10 @@ mpv_event* MpvPlayer::wait_event(const chrono::microseconds timeout)
 		break;
 	case MPV_EVENT_PLAYBACK_RESTART:
 		signal_eventPlaybackRestart.emit();
+		if (m_transition.has_value()) {
+			signal_transition.emit(*this, *m_transition);
+			m_transition.reset();
+		}
 		break;
 	case MPV_EVENT_PROPERTY_CHANGE:
 		signal_eventPropertyChange.emit(
@@ -430,37 +914,214 @@ mpv_event* MpvPlayer::wait_event(const chrono::microseconds timeout)
 	//SPDLOG_TRACE("event: ({:d}, {:d}) {:s}",
 	//	event.event_id, event.reply_userdata, mpv_event_name(event.event_id)
 	//);
-	return &event;
 }
 
-
-
-// Private:
-// -----------------------------------------------------------------------------
-
 MpvPlayer::MpvPlayer(mpv_handle &ctx, const char *name) :
-	_ctx { mpv_create_client(&ctx, name) }
+	_ctx { mpv_create_client(&ctx, name) },
+	m_cache { std::make_unique<PropertyCache>() },
+	m_pending { std::make_unique<PendingReplies>() }
 {
 	if (_ctx == nullptr || this->initialize() != MPV_ERROR_SUCCESS) {
 		this->destroy();
 	}
 }
 
-mpv_error MpvPlayer::initialize(void)
+mpv_error MpvPlayer::initialize(const Mode mode)
 {
-	(void)MpvUtil::Property(*_ctx, "keep-open").set_flag(true);
-	(void)MpvUtil::Property(*_ctx, "keep-open-pause").set_flag(false);
+	(void)this->set<Prop::KeepOpen>(true);
+	(void)this->set<Prop::KeepOpenPause>(false);
 	this->set_play(false);
-	return static_cast<mpv_error>(mpv_initialize(_ctx));
+	
+	if (mode == Mode::PROBE) {
+		// read before `mpv_initialize()`, files stay paused on their first frame
+		constexpr std::array<std::pair<const char*, const char*>, 11> PROBE_OPTIONS = {{
+			{ "ao", "null" },
+			{ "vo", "null" },
+			{ "vid", "no" },
+			{ "sid", "no" },
+			{ "audio-display", "no" },
+			{ "config", "no" },
+			{ "load-scripts", "no" },
+			{ "ytdl", "no" },
+			{ "cache", "no" },
+			{ "demuxer-readahead-secs", "0" },
+			{ "audio-file-auto", "no" },
+		}};
+		for (const auto &[name, value] : PROBE_OPTIONS) {
+			if (const int err = mpv_set_option_string(_ctx, name, value); err < 0) {
+				SPDLOG_ERROR("Failed to set '{:s}': {:s}", name, mpv_error_string(err));
+			}
+		}
+	}
+	
+	// the current values are sent as the first change
+	if (const mpv_error e = this->observe(ObservedProperties(), ObservedId::BASE); e < 0) {
+		SPDLOG_ERROR("Failed to observe the cached properties: {:s}", mpv_error_string(e));
+	}
+	
+	const auto err = static_cast<mpv_error>(mpv_initialize(_ctx));
+	if (mode == Mode::PROBE && err == MPV_ERROR_SUCCESS) {
+		this->set_event_mask(mpv_event_bit(MPV_EVENT_START_FILE)
+			| mpv_event_bit(MPV_EVENT_FILE_LOADED) | mpv_event_bit(MPV_EVENT_END_FILE));
+	}
+	return err;
+}
+
+void MpvPlayer::update_cache(const uint64_t replyUserdata, const mpv_event_property &property)
+{
+	// properties without a value are queried again, the getters report their errors
+	switch (replyUserdata)
+	{
+	case ObservedId::PAUSE:
+		m_cache->paused.store_change(
+			cached_value<Prop::Pause>(property).value_or(PropertyCache::INVALID)
+		);
+		break;
+	case ObservedId::PLAYLIST_COUNT:
+		m_cache->count.store_change(
+			cached_value<Prop::PlaylistCount>(property).value_or(PropertyCache::INVALID)
+		);
+		break;
+	case ObservedId::PLAYLIST_POS:
+		m_cache->index.store_change(
+			cached_value<Prop::PlaylistPos>(property).value_or(PropertyCache::INVALID)
+		);
+		break;
+	case ObservedId::PLAYBACK_TIME:
+		m_cache->position.store_change(
+			cached_value<Prop::PlaybackTime>(property).value_or(PropertyCache::UNAVAILABLE)
+		);
+		break;
+	default:
+		break;
+	}
+}
+
+void MpvPlayer::invalidate_playlist(void)
+{
+	++m_cache->playlistGeneration;
+	const uint64_t countGeneration = m_cache->count.invalidate();
+	const uint64_t indexGeneration = m_cache->index.invalidate();
+	const uint64_t positionGeneration = m_cache->position.invalidate();
+	this->resync<Prop::PlaylistCount>(m_cache->count, countGeneration);
+	this->resync<Prop::PlaylistPos>(m_cache->index, indexGeneration);
+	this->resync<Prop::PlaybackTime>(m_cache->position, positionGeneration);
+}
+
+template<MpvProperty P>
+void MpvPlayer::resync(PropertyCache::Value &cached, const uint64_t generation)
+{
+	// the reply is read by mpv after the set, unlike the change events queued before it
+	(void)this->send_async(
+		[&cached, generation](const int error, void *data) {
+			// on failure the getter queries mpv, reporting the error
+			std::optional<int64_t> value;
+			if (const auto *property = static_cast<const mpv_event_property*>(data);
+				error >= 0 && property != nullptr
+			) {
+				value = cached_value<P>(*property);
+			}
+			cached.store_reply(value.value_or(PropertyCache::INVALID), generation);
+			return std::coroutine_handle<>();
+		},
+		[this](const uint64_t id) {
+			return mpv_get_property_async(_ctx, id, P::NAME, P::FORMAT);
+		}
+	);
+}
+
+uint64_t MpvPlayer::PropertyCache::Value::invalidate(void)
+{
+	const uint64_t newGeneration = ++generation;
+	value = INVALID;
+	return newGeneration;
+}
+
+void MpvPlayer::PropertyCache::Value::store_reply(const int64_t newValue, const uint64_t setGeneration)
+{
+	if (generation != setGeneration) {
+		return; // another set is waiting for its own reply
+	}
+	value = newValue;
+	synced = setGeneration;
+	// a set which started meanwhile may have been overwritten
+	if (generation != setGeneration) {
+		value = INVALID;
+	}
+}
+
+void MpvPlayer::PropertyCache::Value::store_change(const int64_t newValue)
+{
+	const uint64_t current = generation;
+	if (synced != current) {
+		return; // may be older than the set
+	}
+	value = newValue;
+	if (generation != current) {
+		value = INVALID;
+	}
 }
 
 bool MpvPlayer::is_idle(void) const
 {
-	bool isIdle;
-	const MpvUtil::Property property(*_ctx, "core-idle");
-	[[maybe_unused]] mpv_error err = property.get_flag(isIdle);
+	[[maybe_unused]] const auto [err, isIdle] = this->get<Prop::CoreIdle>();
 	assert(err == MPV_ERROR_SUCCESS);
 	return isIdle;
 }
 
+bool MpvPlayer::send_async(
+	PendingReplies::Resolver resolver, const std::function<int(uint64_t id)> &send
+) {
+	uint64_t id;
+	{
+		const std::lock_guard lock(m_pending->mutex);
+		id = ASYNC_ID_BASE + ++m_pending->lastId;
+		m_pending->resolvers.emplace(id, std::move(resolver));
+	}
+	
+	const int err = send(id);
+	if (err >= 0) {
+		return true;
+	}
+	SPDLOG_ERROR("Failed to send an asynchronous request ({:d}): {:s}", err, mpv_error_string(err));
+	
+	auto node = [this, id] {
+		const std::lock_guard lock(m_pending->mutex);
+		return m_pending->resolvers.extract(id);
+	}();
+	// nothing can await the request yet
+	[[maybe_unused]] const auto waiter = node.mapped()(err, nullptr);
+	assert(!waiter);
+	return false;
+}
+
+void MpvPlayer::resolve_reply(const mpv_event &event)
+{
+	auto node = [this, &event] {
+		const std::lock_guard lock(m_pending->mutex);
+		return m_pending->resolvers.extract(event.reply_userdata);
+	}();
+	if (node.empty()) {
+		return;
+	}
+	if (const auto waiter = node.mapped()(event.error, event.data)) {
+		const std::lock_guard lock(m_pending->mutex);
+		m_pending->ready.push_back(waiter);
+	}
+}
+
+bool MpvPlayer::resume_ready(void)
+{
+	std::vector<std::coroutine_handle<>> ready;
+	{
+		const std::lock_guard lock(m_pending->mutex);
+		ready.swap(m_pending->ready);
+	}
+	// the coroutines may send more requests, or wait for events
+	for (const auto waiter : ready) {
+		waiter.resume();
+	}
+	return !ready.empty();
+}
+
 }
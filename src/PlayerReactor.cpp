@@ -0,0 +1,173 @@
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <utility>
+
+#include "PlayerReactor.h"
+#include "momuma/spdlog.h"
+
+
+namespace Momuma
+{
+
+PlayerReactor::PlayerReactor(void)
+{
+	m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (m_epollFd < 0) {
+		SPDLOG_ERROR("epoll_create1() failed: {:s}", strerror(errno));
+	}
+}
+
+PlayerReactor::~PlayerReactor(void)
+{
+	for (auto &[player, registration] : m_players) {
+		player->m_reactor = nullptr;
+	}
+	// the pipes belong to their mpv handle
+	if (m_epollFd >= 0) { close(m_epollFd); }
+}
+
+PlayerReactor::operator bool(void) const
+{
+	return m_epollFd >= 0;
+}
+
+int PlayerReactor::fd(void) const
+{
+	return m_epollFd;
+}
+
+bool PlayerReactor::add(MpvPlayer &player)
+{
+	if (m_epollFd < 0 || !player || player.m_reactor != nullptr) {
+		return false;
+	}
+	
+	const int pipe = mpv_get_wakeup_pipe(player._ctx);
+	if (pipe < 0) {
+		SPDLOG_ERROR("mpv_get_wakeup_pipe() failed");
+		return false;
+	}
+	epoll_event event = { .events = EPOLLIN, .data = { .ptr = &player } };
+	if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, pipe, &event) < 0) {
+		SPDLOG_ERROR("epoll_ctl() failed: {:s}", strerror(errno));
+		return false;
+	}
+	m_players.emplace(&player, Registration { .pipe = pipe });
+	player.m_reactor = this;
+	
+	// events queued before the pipe was created never made it readable
+	m_backlog.push_back(&player);
+	return true;
+}
+
+void PlayerReactor::remove(MpvPlayer &player)
+{
+	const auto it = m_players.find(&player);
+	if (it == m_players.end()) {
+		return;
+	}
+	if (epoll_ctl(m_epollFd, EPOLL_CTL_DEL, it->second.pipe, nullptr) < 0) {
+		SPDLOG_WARN("epoll_ctl() failed: {:s}", strerror(errno));
+	}
+	m_players.erase(it);
+	player.m_reactor = nullptr;
+	
+	// `m_ready` is being iterated, its entries are checked against `m_players` instead
+	std::erase(m_backlog, &player);
+	if (m_draining == &player) {
+		m_drainingRemoved = true;
+	}
+}
+
+size_t PlayerReactor::size(void) const
+{
+	return m_players.size();
+}
+
+int64_t PlayerReactor::dispatch(const chrono::milliseconds timeout)
+{
+	constexpr int MAX_READY = 256;
+	if (m_epollFd < 0) {
+		return -1;
+	}
+	
+	// players left with events can't wait for their pipe
+	std::array<epoll_event, MAX_READY> ready;
+	const int waitMs = !m_backlog.empty() ? 0
+		: (timeout.count() < 0) ? -1 : static_cast<int>(timeout.count());
+	int count = 0;
+	do {
+		count = epoll_wait(m_epollFd, ready.data(), MAX_READY, waitMs);
+	} while (count < 0 && errno == EINTR);
+	if (count < 0) {
+		SPDLOG_ERROR("epoll_wait() failed: {:s}", strerror(errno));
+		return -1;
+	}
+	
+	m_ready.clear();
+	for (MpvPlayer *player : std::exchange(m_backlog, {})) {
+		if (!std::exchange(m_players.at(player).queued, true)) {
+			m_ready.push_back(player);
+		}
+	}
+	for (int i = 0; i < count; ++i) {
+		auto *player = static_cast<MpvPlayer*>(ready[i].data.ptr);
+		const auto it = m_players.find(player);
+		if (it == m_players.end()) {
+			continue;
+		}
+		
+		// emptied before handling the events, those arriving meantime make it readable again
+		std::array<char, 256> bytes;
+		while (read(it->second.pipe, bytes.data(), bytes.size()) > 0) {}
+		
+		if (!std::exchange(it->second.queued, true)) {
+			m_ready.push_back(player);
+		}
+	}
+	
+	int64_t handled = 0;
+	for (MpvPlayer *player : m_ready) {
+		// removed, and possibly destroyed, by a signal of another player
+		const auto it = m_players.find(player);
+		if (it == m_players.end() || !it->second.queued) {
+			continue;
+		}
+		it->second.queued = false;
+		handled += static_cast<int64_t>(this->drain_player(*player));
+	}
+	return handled;
+}
+
+size_t PlayerReactor::drain_player(MpvPlayer &player)
+{
+	m_draining = &player;
+	m_drainingRemoved = false;
+	for (size_t count = 0; count < MAX_EVENTS_PER_PLAYER; ++count) {
+		const mpv_event *event = player.wait_event(chrono::microseconds(0));
+		
+		// the player may have been removed, and destroyed, by one of its signals
+		if (m_drainingRemoved) {
+			m_draining = nullptr;
+			return count + 1;
+		}
+		if (event->event_id == MPV_EVENT_NONE) {
+			m_draining = nullptr;
+			return count;
+		}
+		if (event->event_id == MPV_EVENT_SHUTDOWN) {
+			this->remove(player);
+			m_draining = nullptr;
+			return count + 1;
+		}
+	}
+	m_draining = nullptr;
+	
+	m_backlog.push_back(&player);
+	return MAX_EVENTS_PER_PLAYER;
+}
+
+}
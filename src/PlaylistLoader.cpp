@@ -0,0 +1,136 @@
+#include <vector>
+
+#include "PlaylistLoader.h"
+#include "momuma/spdlog.h"
+
+
+namespace Momuma
+{
+
+// Converts the stored names of `batch` to the paths given to the player.
+[[nodiscard]] static
+std::vector<fs::path> to_paths(const fs::path &base, const Database::MediaBatch &batch)
+{
+	std::vector<fs::path> paths;
+	paths.reserve(batch.size());
+	for (size_t i = 0; i < batch.size(); ++i) {
+		paths.push_back(base / batch[i]);
+	}
+	return paths;
+}
+
+PlaylistLoader::PlaylistLoader(
+	Database::Sqlite3 &database, MpvPlayer &player, const int pageSize
+) :
+	d_database { database },
+	d_player { player },
+	m_pageSize { pageSize }
+{
+}
+
+PlaylistLoader::~PlaylistLoader(void)
+{
+	this->cancel();
+}
+
+bool PlaylistLoader::load(const std::string &playlist, const bool play)
+{
+	this->cancel();
+	
+	Database::MediaBatch first;
+	if (d_database.get_media_window(playlist, 0, 1, first) <= 0) {
+		return false;
+	}
+	
+	const fs::path base = d_database.get_playlist_location(playlist);
+	const fs::path media = base / first[0];
+	
+	// paused before loading, otherwise the media could start playing for a moment
+	if (!play) {
+		d_player.set_play(false);
+	}
+	if (const mpv_error err = d_player.set_media(media); err != MPV_ERROR_SUCCESS) {
+		SPDLOG_ERROR("Failed to load '{}' ({:d}): {:s}", media, err, mpv_error_string(err));
+		return false;
+	}
+	if (play) {
+		d_player.set_play(true);
+	}
+	
+	m_queued = 1;
+	m_cancel = false;
+	{
+		const std::lock_guard lock(m_mutex);
+		m_done = false;
+	}
+	m_thread = std::thread(
+		&PlaylistLoader::fill, this, playlist, first.indexes[0] + 1, d_player.playlist_generation()
+	);
+	return true;
+}
+
+void PlaylistLoader::cancel(void)
+{
+	if (m_thread.joinable()) {
+		m_cancel = true;
+		m_thread.join();
+	}
+}
+
+bool PlaylistLoader::wait_loaded(const chrono::milliseconds timeout)
+{
+	std::unique_lock lock(m_mutex);
+	return m_doneCond.wait_for(lock, timeout, [this] { return m_done; });
+}
+
+size_t PlaylistLoader::queued(void) const
+{
+	return m_queued;
+}
+
+void PlaylistLoader::fill(const std::string playlist, int64_t fromIndex, uint64_t generation)
+{
+	// the pages are read next to the application's writes, without waiting for them
+	const Database::ReservedReader reader = d_database.reserve_reader();
+	const fs::path base = d_database.get_playlist_location(playlist);
+	Database::MediaBatch batch;
+	
+	while (!m_cancel) {
+		const int count = d_database.get_media_window(playlist, fromIndex, m_pageSize, batch);
+		if (count <= 0) {
+			break;
+		}
+		
+		// a playlist changed by someone else isn't the loaded one anymore, the rest is dropped;
+		// nothing locks the player until the append, a change made meanwhile is seen next window
+		const auto [countErr, playerCount] = d_player.get<Prop::PlaylistCount>();
+		if (d_player.playlist_generation() != generation || countErr != MPV_ERROR_SUCCESS
+			|| playerCount != static_cast<int64_t>(m_queued.load())
+		) {
+			SPDLOG_DEBUG("The player's playlist changed, stopped queueing '{}'", playlist);
+			break;
+		}
+		
+		const std::vector<fs::path> paths = to_paths(base, batch);
+		if (const mpv_error err = d_player.append_media(paths); err != MPV_ERROR_SUCCESS) {
+			SPDLOG_ERROR("Failed to queue '{}' ({:d}): {:s}", playlist, err, mpv_error_string(err));
+			break;
+		}
+		++generation; // the append itself, see `MpvPlayer::playlist_generation()`
+		m_queued += paths.size();
+		fromIndex = batch.indexes.back() + 1;
+		
+		if (count < m_pageSize) {
+			break;
+		}
+	}
+	
+	SPDLOG_DEBUG("Queued {:d} media of '{}'", m_queued.load(), playlist);
+	{
+		const std::lock_guard lock(m_mutex);
+		m_done = true;
+	}
+	m_doneCond.notify_all();
+}
+
+}
@@ -0,0 +1,179 @@
+#include "PositionStream.h"
+#include "momuma/spdlog.h"
+
+
+namespace Momuma
+{
+
+// `reply_userdata` of the observed `time-pos`, next to the ids observed by every player
+constexpr uint64_t TIME_POS_ID = 0x4d4f4d5550000000; // "MOMUP"
+using StreamProperties = PropertyList<Prop::TimePos>;
+
+PositionStream::PositionStream(MpvPlayer &player, const chrono::milliseconds interval) :
+	PositionStream(player, interval, nullptr, ResumeOptions())
+{
+}
+
+PositionStream::PositionStream(
+	MpvPlayer &player, const chrono::milliseconds interval,
+	Database::Sqlite3 &database, const ResumeOptions options
+) :
+	PositionStream(player, interval, &database, options)
+{
+}
+
+PositionStream::PositionStream(
+	MpvPlayer &player, const chrono::milliseconds interval,
+	Database::Sqlite3 *const database, const ResumeOptions options
+) :
+	d_player { player },
+	d_database { database },
+	m_interval { interval },
+	m_options { options },
+	m_lastSave { Clock::now() }
+{
+	m_connections.push_back(player.signal_eventPropertyChange.connect(
+		[this](const uint64_t id, mpv_event_property &property) {
+			if (id != TIME_POS_ID) {
+				return;
+			}
+			this->on_position((property.format == Prop::TimePos::FORMAT)
+				? std::optional(MpvFormat<chrono::microseconds>::read(property.data))
+				: std::nullopt
+			);
+		}
+	));
+	
+	// the position following a seek is emitted without waiting, the pending one is stale
+	m_connections.push_back(player.signal_eventPlaybackRestart.connect([this] {
+		m_pending = false;
+		m_lastEmit = {};
+	}));
+	m_connections.push_back(player.signal_stateChanged.connect(
+		[this](MpvPlayer&, MpvPlayer::State, MpvPlayer::State) { this->flush(); }
+	));
+	
+	MpvEventMask events = mpv_event_bit(MPV_EVENT_PLAYBACK_RESTART);
+	if (d_database != nullptr) {
+		m_connections.push_back(player.signal_eventFileLoaded.connect([this] {
+			this->on_file_loaded();
+		}));
+		m_connections.push_back(player.signal_eventEndFile.connect(
+			[this](mpv_event_end_file &data) { this->on_end_file(data); }
+		));
+		events |= mpv_event_bit(MPV_EVENT_FILE_LOADED) | mpv_event_bit(MPV_EVENT_END_FILE);
+	}
+	player.set_event_mask(player.get_event_mask() | events);
+	
+	if (const mpv_error err = player.observe(StreamProperties(), TIME_POS_ID); err < 0) {
+		SPDLOG_ERROR("Failed to observe '{:s}': {:s}", Prop::TimePos::NAME, mpv_error_string(err));
+	}
+}
+
+PositionStream::~PositionStream(void)
+{
+	d_player.unobserve(StreamProperties(), TIME_POS_ID);
+	for (sigc::connection &connection : m_connections) {
+		connection.disconnect();
+	}
+	(void)this->save();
+}
+
+chrono::microseconds PositionStream::position(void) const
+{
+	return m_position;
+}
+
+void PositionStream::flush(void)
+{
+	if (!m_pending) {
+		return;
+	}
+	m_pending = false;
+	m_lastEmit = Clock::now();
+	signal_position.emit(m_position);
+}
+
+bool PositionStream::save(void)
+{
+	m_lastSave = Clock::now();
+	if (d_database == nullptr || m_unsaved.empty()) {
+		return true;
+	}
+	
+	const std::vector<std::pair<fs::path, chrono::microseconds>> entries(
+		m_unsaved.begin(), m_unsaved.end()
+	);
+	if (!d_database->set_resume_points(entries)) {
+		SPDLOG_WARN("Failed to save {:d} resume points, retrying later", entries.size());
+		return false;
+	}
+	m_unsaved.clear();
+	return true;
+}
+
+void PositionStream::on_position(const std::optional<chrono::microseconds> position)
+{
+	m_position = position.value_or(chrono::microseconds(0));
+	m_pending = true;
+	
+	const auto now = Clock::now();
+	if (now - m_lastEmit >= m_interval) {
+		this->flush();
+	}
+	
+	// only kept in memory, until the next write
+	if (m_resumable && position.has_value()) {
+		m_unsaved[m_media] = *position;
+		if (now - m_lastSave >= m_options.saveInterval) {
+			(void)this->save();
+		}
+	}
+}
+
+void PositionStream::on_file_loaded(void)
+{
+	m_resumable = false;
+	auto [pathErr, path] = d_player.get<Prop::Path>();
+	const auto [durationErr, duration] = d_player.get<Prop::Duration>();
+	if (pathErr != MPV_ERROR_SUCCESS || durationErr != MPV_ERROR_SUCCESS
+		|| duration < m_options.minDuration
+	) {
+		return;
+	}
+	m_media = std::move(path);
+	m_duration = duration;
+	m_resumable = true;
+	
+	// an unsaved position is newer than the stored one
+	std::optional<chrono::microseconds> resume;
+	if (const auto it = m_unsaved.find(m_media); it != m_unsaved.end()) {
+		resume = it->second;
+	}
+	else {
+		resume = d_database->get_resume_point(m_media);
+	}
+	if (!resume || *resume <= resume->zero() || *resume >= duration - m_options.endMargin) {
+		return;
+	}
+	
+	// seeking right after loading skips decoding the beginning
+	if (const mpv_error err = d_player.set<Prop::TimePos>(*resume); err != MPV_ERROR_SUCCESS) {
+		SPDLOG_WARN("Failed to resume {}: {:s}", m_media, mpv_error_string(err));
+	}
+}
+
+void PositionStream::on_end_file(const mpv_event_end_file &data)
+{
+	if (!m_resumable) {
+		return;
+	}
+	m_resumable = false;
+	
+	const bool finished = data.reason == MPV_END_FILE_REASON_EOF
+		|| m_position >= m_duration - m_options.endMargin;
+	m_unsaved[m_media] = finished ? chrono::microseconds(-1) : m_position;
+	(void)this->save();
+}
+
+}
@@ -0,0 +1,592 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <optional>
+#include <string_view>
+#include <thread>
+
+#include "TagReader.h"
+#include "misc.h"
+#include "momuma/spdlog.h"
+
+
+namespace Momuma
+{
+
+namespace
+{
+
+using Bytes = std::span<const uint8_t>;
+using Database::MediaTags;
+
+enum class Field { TITLE, ARTIST, ALBUM_ARTIST, ALBUM, GENRE, TRACK, YEAR };
+
+// ID3v1 genres by number, also used by ID3v2 genres written as "(17)" or "17"
+constexpr std::array<std::string_view, 80> ID3_GENRES = {
+	"Blues", "Classic Rock", "Country", "Dance", "Disco", "Funk", "Grunge", "Hip-Hop",
+	"Jazz", "Metal", "New Age", "Oldies", "Other", "Pop", "R&B", "Rap", "Reggae", "Rock",
+	"Techno", "Industrial", "Alternative", "Ska", "Death Metal", "Pranks", "Soundtrack",
+	"Euro-Techno", "Ambient", "Trip-Hop", "Vocal", "Jazz+Funk", "Fusion", "Trance",
+	"Classical", "Instrumental", "Acid", "House", "Game", "Sound Clip", "Gospel", "Noise",
+	"AlternRock", "Bass", "Soul", "Punk", "Space", "Meditative", "Instrumental Pop",
+	"Instrumental Rock", "Ethnic", "Gothic", "Darkwave", "Techno-Industrial", "Electronic",
+	"Pop-Folk", "Eurodance", "Dream", "Southern Rock", "Comedy", "Cult", "Gangsta", "Top 40",
+	"Christian Rap", "Pop/Funk", "Jungle", "Native American", "Cabaret", "New Wave",
+	"Psychadelic", "Rave", "Showtunes", "Trailer", "Lo-Fi", "Tribal", "Acid Punk", "Acid Jazz",
+	"Polka", "Retro", "Musical", "Rock & Roll", "Hard Rock",
+};
+
+[[nodiscard]] std::string_view as_text(const Bytes data)
+{
+	return { reinterpret_cast<const char*>(data.data()), data.size() };
+}
+
+[[nodiscard]] Bytes as_bytes(const std::string_view text)
+{
+	return { reinterpret_cast<const uint8_t*>(text.data()), text.size() };
+}
+
+// #@return: the beginning of `data`, up to its first NUL byte.
+[[nodiscard]] Bytes until_nul(const Bytes data)
+{
+	return data.first(static_cast<size_t>(std::find(data.begin(), data.end(), 0) - data.begin()));
+}
+
+// #Removes the spaces and NULs used to pad fixed-size fields.
+[[nodiscard]] std::string_view trim(std::string_view text)
+{
+	const auto padding = [](const char c) { return c == ' ' || c == '\0'; };
+	while (!text.empty() && padding(text.front())) { text.remove_prefix(1); }
+	while (!text.empty() && padding(text.back())) { text.remove_suffix(1); }
+	return text;
+}
+
+// #@return: the leading number of `text` ("3/12" is 3, "2004-05-01" is 2004), `0` if none.
+[[nodiscard]] int64_t parse_number(const std::string_view text)
+{
+	int64_t value = 0;
+	const std::string_view digits = trim(text);
+	(void)std::from_chars(digits.data(), digits.data() + digits.size(), value);
+	return std::max<int64_t>(value, 0);
+}
+
+[[nodiscard]] bool iequals(const std::string_view a, const std::string_view b)
+{
+	return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const char x, const char y) {
+		const auto lower = [](const char c) { return (c >= 'A' && c <= 'Z') ? char(c + 32) : c; };
+		return lower(x) == lower(y);
+	});
+}
+
+void append_utf8(std::string &out, uint32_t codePoint)
+{
+	if (codePoint >= 0xD800 && codePoint < 0xE000) {
+		codePoint = 0xFFFD; // unpaired surrogate
+	}
+	
+	if (codePoint < 0x80) {
+		out += static_cast<char>(codePoint);
+	}
+	else if (codePoint < 0x800) {
+		out += static_cast<char>(0xC0 | codePoint >> 6);
+		out += static_cast<char>(0x80 | (codePoint & 0x3F));
+	}
+	else if (codePoint < 0x10000) {
+		out += static_cast<char>(0xE0 | codePoint >> 12);
+		out += static_cast<char>(0x80 | (codePoint >> 6 & 0x3F));
+		out += static_cast<char>(0x80 | (codePoint & 0x3F));
+	}
+	else {
+		out += static_cast<char>(0xF0 | codePoint >> 18);
+		out += static_cast<char>(0x80 | (codePoint >> 12 & 0x3F));
+		out += static_cast<char>(0x80 | (codePoint >> 6 & 0x3F));
+		out += static_cast<char>(0x80 | (codePoint & 0x3F));
+	}
+}
+
+// #ISO-8859-1 text, only copied when it isn't plain ASCII.
+[[nodiscard]] std::string_view decode_latin1(const Bytes text, TagArena &arena)
+{
+	if (std::all_of(text.begin(), text.end(), [](const uint8_t c) { return c < 0x80; })) {
+		return as_text(text);
+	}
+	std::string &out = arena.emplace_back();
+	out.reserve(text.size() * 2);
+	for (const uint8_t c : text) {
+		append_utf8(out, c);
+	}
+	return out;
+}
+
+// #UTF-16 text without its byte order mark, up to the first NUL character.
+[[nodiscard]] std::string_view decode_utf16(const Bytes text, const bool bigEndian, TagArena &arena)
+{
+	const auto unit_at = [&](const size_t i) -> uint32_t {
+		return bigEndian ? (uint32_t(text[i]) << 8 | text[i + 1]) : read_le16(text, i);
+	};
+	
+	std::string &out = arena.emplace_back();
+	for (size_t i = 0; i + 1 < text.size(); i += 2) {
+		uint32_t codePoint = unit_at(i);
+		if (codePoint == 0) {
+			break;
+		}
+		if (codePoint >= 0xD800 && codePoint < 0xDC00 && i + 3 < text.size()) {
+			const uint32_t low = unit_at(i + 2);
+			if (low >= 0xDC00 && low < 0xE000) {
+				codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+				i += 2;
+			}
+		}
+		append_utf8(out, codePoint);
+	}
+	return out;
+}
+
+// #Replaces numeric ID3 genres ("17", "(17)") by their names, "(17)Rock" is "Rock".
+[[nodiscard]] std::string_view resolve_id3_genre(std::string_view genre)
+{
+	if (genre.starts_with('(')) {
+		const size_t end = genre.find(')');
+		if (end == std::string_view::npos) {
+			return genre;
+		}
+		if (end + 1 < genre.size()) {
+			return genre.substr(end + 1);
+		}
+		genre = genre.substr(1, end - 1);
+	}
+	
+	size_t number = 0;
+	const auto [ptr, err] = std::from_chars(genre.data(), genre.data() + genre.size(), number);
+	if (err != std::errc() || ptr != genre.data() + genre.size()) {
+		return genre;
+	}
+	return (number < ID3_GENRES.size()) ? ID3_GENRES[number] : std::string_view();
+}
+
+// #Sets `field` from `text`, unless it's already known.
+void apply_field(MediaTags &tags, const Field field, const std::string_view text)
+{
+	const auto set_text = [text](std::string_view &value) {
+		if (value.empty()) { value = text; }
+	};
+	const auto set_number = [text](int64_t &value) {
+		if (value == 0) { value = parse_number(text); }
+	};
+	
+	switch (field)
+	{
+	case Field::TITLE: set_text(tags.title); break;
+	case Field::ARTIST: set_text(tags.artist); break;
+	case Field::ALBUM_ARTIST: set_text(tags.albumArtist); break;
+	case Field::ALBUM: set_text(tags.album); break;
+	case Field::GENRE: set_text(tags.genre); break;
+	case Field::TRACK: set_number(tags.track); break;
+	case Field::YEAR: set_number(tags.year); break;
+	}
+}
+
+// #Decodes an ID3v2 text frame: an encoding byte, then one or more NUL separated values.
+[[nodiscard]] std::string_view decode_id3_text(const Bytes frame, TagArena &arena)
+{
+	if (frame.empty()) {
+		return {};
+	}
+	const Bytes text = frame.subspan(1);
+	switch (frame[0])
+	{
+	case 0: // ISO-8859-1
+		return trim(decode_latin1(until_nul(text), arena));
+	case 1: // UTF-16 with a byte order mark
+		if (text.size() < 2 || (text[0] | text[1] << 8) == 0xFEFF) {
+			return trim(decode_utf16(text.subspan(std::min<size_t>(2, text.size())), false, arena));
+		}
+		if ((text[0] << 8 | text[1]) == 0xFEFF) {
+			return trim(decode_utf16(text.subspan(2), true, arena));
+		}
+		return {};
+	case 2: // UTF-16 big endian, without a byte order mark
+		return trim(decode_utf16(text, true, arena));
+	case 3: // UTF-8
+		return trim(as_text(until_nul(text)));
+	default:
+		return {};
+	}
+}
+
+// #28-bit integer stored in the low 7 bits of 4 bytes, `std::nullopt` if a high bit is set.
+[[nodiscard]] std::optional<size_t> read_syncsafe(const Bytes data, const size_t offset)
+{
+	if ((data[offset] | data[offset + 1] | data[offset + 2] | data[offset + 3]) & 0x80) {
+		return std::nullopt;
+	}
+	return size_t(data[offset]) << 21 | size_t(data[offset + 1]) << 14
+		| size_t(data[offset + 2]) << 7 | size_t(data[offset + 3]);
+}
+
+[[nodiscard]] size_t read_be24(const Bytes data, const size_t offset)
+{
+	return size_t(data[offset]) << 16 | size_t(data[offset + 1]) << 8 | size_t(data[offset + 2]);
+}
+
+/* #Parses the ID3v2 tag at `offset`.
+! @param found: set to `true` if a supported frame was found.
+! @return: offset of the data following the tag, `offset` if there's no tag.
+*/
+[[nodiscard]] size_t parse_id3v2(
+	const Bytes data, const size_t offset, MediaTags &tags, TagArena &arena, bool &found
+) {
+	// frame ids of ID3v2.2, and of ID3v2.3 and later
+	constexpr std::array<std::tuple<std::string_view, std::string_view, Field>, 8> FRAMES = {{
+		{ "TT2", "TIT2", Field::TITLE },
+		{ "TP1", "TPE1", Field::ARTIST },
+		{ "TP2", "TPE2", Field::ALBUM_ARTIST }, // "band", used for the album artist
+		{ "TAL", "TALB", Field::ALBUM },
+		{ "TCO", "TCON", Field::GENRE },
+		{ "TRK", "TRCK", Field::TRACK },
+		{ "TYE", "TYER", Field::YEAR },
+		{ "", "TDRC", Field::YEAR }, // recording time of ID3v2.4
+	}};
+	
+	// "ID3", version (2), flags, size
+	if (!has_magic(data, offset, "ID3") || data.size() - offset < 10) {
+		return offset;
+	}
+	const std::optional<size_t> size = read_syncsafe(data, offset + 6);
+	if (!size.has_value()) {
+		return offset;
+	}
+	const unsigned version = data[offset + 3];
+	const uint8_t flags = data[offset + 5];
+	const size_t end = std::min(data.size(), offset + 10 + *size + ((flags & 0x10) ? 10 : 0));
+	const Bytes tag = data.subspan(offset + 10, std::min(*size, data.size() - offset - 10));
+	
+	// older versions unsynchronise the whole tag, which would have to be decoded first
+	if (version < 2 || version > 4 || (version < 4 && (flags & 0x80))) {
+		return end;
+	}
+	
+	size_t pos = 0;
+	if (version >= 3 && (flags & 0x40) && tag.size() >= 4) {
+		// extended header, its size includes itself since ID3v2.4
+		const std::optional<size_t> extended = (version == 4)
+			? read_syncsafe(tag, 0) : std::optional<size_t>(4 + read_be32(tag, 0));
+		pos = extended.value_or(tag.size());
+	}
+	
+	const size_t headerSize = (version == 2) ? 6 : 10;
+	while (pos < tag.size() && tag.size() - pos >= headerSize && tag[pos] != 0) {
+		// id, size, then 2 bytes of flags since ID3v2.3
+		const std::string_view id = as_text(tag.subspan(pos, (version == 2) ? 3 : 4));
+		size_t frameSize;
+		uint8_t format = 0;
+		if (version == 2) {
+			frameSize = read_be24(tag, pos + 3);
+		}
+		else {
+			frameSize = (version == 4) ? read_syncsafe(tag, pos + 4).value_or(SIZE_MAX)
+				: read_be32(tag, pos + 4);
+			format = tag[pos + 9];
+		}
+		pos += headerSize;
+		if (frameSize > tag.size() - pos) {
+			break;
+		}
+		Bytes frame = tag.subspan(pos, frameSize);
+		pos += frameSize;
+		
+		// skips compressed, encrypted and unsynchronised frames, and the group id and data
+		// length which may precede the content
+		if (version == 3) {
+			if (format & 0xC0) { continue; }
+			if (format & 0x20) { frame = frame.subspan(std::min<size_t>(1, frame.size())); }
+		}
+		else if (version == 4) {
+			if (format & 0x0E) { continue; }
+			const size_t prefix = ((format & 0x40) ? 1 : 0) + ((format & 0x01) ? 4 : 0);
+			frame = frame.subspan(std::min(prefix, frame.size()));
+		}
+		
+		for (const auto &[oldId, newId, field] : FRAMES) {
+			if (id != ((version == 2) ? oldId : newId) || id.empty()) {
+				continue;
+			}
+			std::string_view text = decode_id3_text(frame, arena);
+			if (field == Field::GENRE) {
+				text = resolve_id3_genre(text);
+			}
+			apply_field(tags, field, text);
+			found = true;
+			break;
+		}
+	}
+	return end;
+}
+
+// #Parses the ID3v1 tag at the end of `data`. @return: `false` if there's none.
+[[nodiscard]] bool parse_id3v1(const Bytes data, MediaTags &tags, TagArena &arena)
+{
+	// "TAG", title (30), artist (30), album (30), year (4), comment (30), genre (1).
+	// ID3v1.1 stores the track in the last byte of the comment, preceded by a NUL.
+	if (data.size() < 128 || !has_magic(data, data.size() - 128, "TAG")) {
+		return false;
+	}
+	const Bytes tag = data.last(128);
+	const auto set_text = [&](std::string_view &value, const size_t offset, const size_t size) {
+		if (value.empty()) {
+			value = trim(decode_latin1(until_nul(tag.subspan(offset, size)), arena));
+		}
+	};
+	
+	set_text(tags.title, 3, 30);
+	set_text(tags.artist, 33, 30);
+	set_text(tags.album, 63, 30);
+	apply_field(tags, Field::YEAR, as_text(until_nul(tag.subspan(93, 4))));
+	if (tags.track == 0 && tag[125] == 0) {
+		tags.track = tag[126];
+	}
+	if (tags.genre.empty() && tag[127] < ID3_GENRES.size()) {
+		tags.genre = ID3_GENRES[tag[127]];
+	}
+	return true;
+}
+
+/* #Parses a Vorbis comment block, without the type of its packet.
+! Comments are UTF-8 "NAME=value" strings, names are case-insensitive.
+! @return: `false` if the block is invalid.
+*/
+[[nodiscard]] bool parse_vorbis_comments(const Bytes block, MediaTags &tags)
+{
+	constexpr std::array<std::pair<std::string_view, Field>, 8> NAMES = {{
+		{ "TITLE", Field::TITLE },
+		{ "ARTIST", Field::ARTIST },
+		{ "ALBUMARTIST", Field::ALBUM_ARTIST },
+		{ "ALBUM ARTIST", Field::ALBUM_ARTIST },
+		{ "ALBUM", Field::ALBUM },
+		{ "GENRE", Field::GENRE },
+		{ "TRACKNUMBER", Field::TRACK },
+		{ "DATE", Field::YEAR },
+	}};
+	
+	// vendor length (LE 32), vendor, comment count (LE 32), then length-prefixed comments
+	if (block.size() < 8 || read_le32(block, 0) > block.size() - 8) {
+		return false;
+	}
+	size_t pos = 4 + read_le32(block, 0);
+	uint32_t count = read_le32(block, pos);
+	pos += 4;
+	
+	for (; count > 0 && block.size() - pos >= 4; --count) {
+		const size_t length = read_le32(block, pos);
+		pos += 4;
+		if (length > block.size() - pos) {
+			return false;
+		}
+		const std::string_view comment = as_text(block.subspan(pos, length));
+		pos += length;
+		
+		const size_t equals = comment.find('=');
+		if (equals == std::string_view::npos) {
+			continue;
+		}
+		const std::string_view name = comment.substr(0, equals);
+		for (const auto &[known, field] : NAMES) {
+			if (iequals(name, known)) {
+				apply_field(tags, field, trim(comment.substr(equals + 1)));
+				break;
+			}
+		}
+	}
+	return true;
+}
+
+// #Parses the metadata blocks following "fLaC" at `offset`.
+[[nodiscard]] bool parse_flac(const Bytes data, size_t offset, MediaTags &tags)
+{
+	constexpr uint8_t VORBIS_COMMENT = 4;
+	
+	// block header: last block flag (1 bit), type (7 bits), size (BE 24)
+	offset += 4;
+	while (data.size() - offset >= 4) {
+		const uint8_t header = data[offset];
+		const size_t size = read_be24(data, offset + 1);
+		offset += 4;
+		if (size > data.size() - offset) {
+			return false;
+		}
+		if ((header & 0x7F) == VORBIS_COMMENT) {
+			return parse_vorbis_comments(data.subspan(offset, size), tags);
+		}
+		if (header & 0x80) {
+			break;
+		}
+		offset += size;
+	}
+	return false;
+}
+
+/* #Parses the comment header of the first Ogg Vorbis or Opus stream.
+! The header is the second packet of the stream. It's read in place when it fits in one page,
+otherwise its pieces are joined into `arena`.
+*/
+[[nodiscard]] bool parse_ogg(const Bytes data, MediaTags &tags, TagArena &arena)
+{
+	// page header: "OggS", version, flags, granule position, serial number (LE 32),
+	// sequence number, checksum, segment count, segment sizes
+	constexpr size_t HEADER_SIZE = 27;
+	constexpr size_t MAX_JOINED_SIZE = 16 * 1024 * 1024; // embedded pictures can be large
+	if (data.size() < HEADER_SIZE) {
+		return false;
+	}
+	const uint32_t serial = read_le32(data, 14);
+	
+	size_t packet = 0; // index of the packet being read
+	Bytes piece; // part of the comment header inside of the current page
+	std::string *joined = nullptr;
+	const auto parse_header = [&tags](const Bytes header) {
+		if (has_magic(header, 0, "\x03" "vorbis")) {
+			return parse_vorbis_comments(header.subspan(7), tags);
+		}
+		if (has_magic(header, 0, "OpusTags")) {
+			return parse_vorbis_comments(header.subspan(8), tags);
+		}
+		return false;
+	};
+	
+	for (size_t offset = 0; has_magic(data, offset, "OggS") && data.size() - offset >= HEADER_SIZE;) {
+		const size_t segments = data[offset + 26];
+		const bool ours = (read_le32(data, offset + 14) == serial);
+		size_t pos = offset + HEADER_SIZE + segments;
+		if (pos > data.size()) {
+			return false;
+		}
+		
+		for (size_t i = 0; i < segments; ++i) {
+			const size_t lacing = data[offset + HEADER_SIZE + i];
+			if (lacing > data.size() - pos) {
+				return false;
+			}
+			if (ours && packet == 1) {
+				piece = piece.empty() ? data.subspan(pos, lacing)
+					: Bytes(piece.data(), piece.size() + lacing);
+			}
+			pos += lacing;
+			
+			// a segment shorter than 255 bytes ends its packet
+			if (ours && lacing < 255 && packet++ == 1) {
+				if (joined == nullptr) {
+					return parse_header(piece);
+				}
+				joined->append(as_text(piece));
+				return parse_header(as_bytes(*joined));
+			}
+		}
+		
+		if (ours && packet == 1 && !piece.empty()) {
+			if (joined == nullptr) {
+				joined = &arena.emplace_back();
+			}
+			joined->append(as_text(piece));
+			piece = {};
+			if (joined->size() > MAX_JOINED_SIZE) {
+				return false;
+			}
+		}
+		offset = pos;
+	}
+	return false;
+}
+
+}
+
+bool parse_tags(const std::span<const uint8_t> data, MediaTags &tags, TagArena &arena)
+{
+	if (has_magic(data, 0, "OggS")) {
+		return parse_ogg(data, tags, arena);
+	}
+	
+	bool found = false;
+	size_t start = 0;
+	for (size_t end; (end = parse_id3v2(data, start, tags, arena, found)) != start;) {
+		start = end;
+	}
+	
+	if (has_magic(data, start, "fLaC")) {
+		found |= parse_flac(data, start, tags);
+	}
+	else {
+		found |= parse_id3v1(data, tags, arena);
+	}
+	return found;
+}
+
+int64_t scan_media_tags(Database::Sqlite3 &db, const std::vector<fs::path> &media, unsigned workers)
+{
+	// files mapped at the same time, and stored by a single transaction
+	constexpr size_t CHUNK_SIZE = 512;
+	
+	struct TaggedFile
+	{
+		std::optional<Database::FileStamp> stamp;
+		std::optional<MappedFile> file;
+		MediaTags tags;
+		TagArena arena;
+	};
+	
+	if (workers == 0) {
+		workers = std::max(1u, std::thread::hardware_concurrency());
+	}
+	
+	int64_t stored = 0;
+	std::vector<TaggedFile> chunk;
+	std::vector<std::pair<Database::FileStamp, MediaTags>> entries;
+	for (size_t first = 0; first < media.size(); first += CHUNK_SIZE) {
+		const size_t count = std::min(CHUNK_SIZE, media.size() - first);
+		chunk.clear();
+		chunk.resize(count);
+		
+		std::atomic<size_t> next = 0;
+		const auto read_files = [&] {
+			for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;) {
+				TaggedFile &tagged = chunk[i];
+				const fs::path &path = media[first + i];
+				
+				// stamped before being read, a file modified meanwhile is read again next time
+				tagged.stamp = Database::FileStamp::of(path);
+				if (!tagged.stamp.has_value()) {
+					continue;
+				}
+				tagged.file.emplace(path);
+				if (!*tagged.file && tagged.stamp->size > 0) {
+					tagged.stamp.reset();
+					continue;
+				}
+				(void)parse_tags(tagged.file->data(), tagged.tags, tagged.arena);
+			}
+		};
+		{
+			std::vector<std::jthread> threads;
+			for (size_t i = 1; i < std::min<size_t>(workers, count); ++i) {
+				threads.emplace_back(read_files);
+			}
+			read_files();
+		}
+		
+		entries.clear();
+		for (TaggedFile &tagged : chunk) {
+			if (tagged.stamp.has_value()) {
+				entries.emplace_back(std::move(*tagged.stamp), tagged.tags);
+			}
+		}
+		if (!db.set_media_tags(entries)) {
+			return -1;
+		}
+		stored += std::ssize(entries);
+	}
+	SPDLOG_DEBUG("Stored the tags of {:d} of {:d} files", stored, media.size());
+	return stored;
+}
+
+}
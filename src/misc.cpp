@@ -1,7 +1,15 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
 #include <set>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
 #include <vector>
 
 #include "misc.h"
+#include "momuma/spdlog.h"
 
 
 namespace Momuma
@@ -49,4 +57,57 @@ bool is_filename_forbidden(std::filesystem::path filename)
 	return false;
 }
 
+
+MappedFile::MappedFile(const fs::path &path)
+{
+	const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		SPDLOG_DEBUG("Failed to open {:s}: {:s}", path, std::strerror(errno));
+		return;
+	}
+	
+	// the mapping stays valid once the descriptor is closed
+	struct stat info;
+	if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+		void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			m_data = static_cast<const uint8_t*>(data);
+			m_size = static_cast<size_t>(info.st_size);
+		}
+		else {
+			SPDLOG_DEBUG("Failed to map {:s}: {:s}", path, std::strerror(errno));
+		}
+	}
+	close(fd);
+}
+
+MappedFile::~MappedFile(void)
+{
+	if (m_data != nullptr) {
+		munmap(const_cast<uint8_t*>(m_data), m_size);
+	}
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept :
+	m_data { std::exchange(other.m_data, nullptr) },
+	m_size { std::exchange(other.m_size, 0) }
+{}
+
+MappedFile& MappedFile::operator=(MappedFile &&other) noexcept
+{
+	std::swap(m_data, other.m_data);
+	std::swap(m_size, other.m_size);
+	return *this;
+}
+
+MappedFile::operator bool(void) const
+{
+	return m_data != nullptr;
+}
+
+std::span<const uint8_t> MappedFile::data(void) const
+{
+	return { m_data, m_size };
+}
+
 }
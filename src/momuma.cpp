@@ -1,4 +1,8 @@
+#include <unordered_map>
+
+#include "DurationReader.h"
 #include "momuma/momuma.h"
+#include "momuma/spdlog.h"
 
 
 namespace Momuma
@@ -16,9 +20,17 @@ void deinit(void)
 }
 
 
+// read connections of the database, one of them is reserved by the playlist loader
+constexpr unsigned DATABASE_READERS = 2;
+
 Momuma::Momuma(const fs::path &rootFolder) :
-	m_player { }, m_database { rootFolder }
+	m_player { },
+	m_database { rootFolder, Database::StorageType::DISK, DATABASE_READERS },
+	m_loader { m_database, m_player }
 {
+	if (m_player) {
+		(void)m_player.set_tuning(MpvPlayer::PlaybackTuning());
+	}
 }
 
 Momuma::operator bool(void)
@@ -31,4 +43,93 @@ fs::path Momuma::get_location(void)
 	return m_database.get_database_location();
 }
 
+bool Momuma::play_playlist(const std::string &playlist)
+{
+	return m_loader.load(playlist);
+}
+
+chrono::microseconds Momuma::query_duration(const fs::path &media)
+{
+	const std::optional<Database::FileStamp> stamp = Database::FileStamp::of(media);
+	if (!stamp.has_value()) {
+		return chrono::microseconds(-1);
+	}
+	if (const auto cached = m_database.get_cached_durations({ *stamp }); cached[0].has_value()) {
+		return *cached[0];
+	}
+	
+	// a single file doesn't start the scanner's workers, which would stay for a single use
+	const chrono::microseconds duration = read_duration(media);
+	if (duration >= chrono::microseconds::zero()) {
+		(void)m_database.set_cached_durations({ { *stamp, duration } });
+	}
+	return duration;
+}
+
+size_t Momuma::scan_durations(
+	const std::vector<fs::path> &media,
+	sigc::slot<void(const DurationScanner::Result&)> callback
+) {
+	// results are written back in batches, so an interrupted scan keeps most of its work
+	constexpr size_t WRITE_BATCH = 256;
+	
+	std::vector<Database::FileStamp> stamps;
+	std::vector<fs::path> missing;
+	stamps.reserve(media.size());
+	for (const fs::path &path : media) {
+		if (auto stamp = Database::FileStamp::of(path); stamp.has_value()) {
+			stamps.push_back(std::move(*stamp));
+		}
+		else {
+			missing.push_back(path);
+		}
+	}
+	
+	size_t calls = 0;
+	std::vector<fs::path> changed;
+	const auto cached = m_database.get_cached_durations(stamps);
+	for (size_t i = 0; i < stamps.size(); ++i) {
+		if (cached[i].has_value()) {
+			callback(DurationScanner::Result { stamps[i].path, *cached[i] });
+			++calls;
+		}
+		else {
+			changed.push_back(stamps[i].path);
+		}
+	}
+	for (const fs::path &path : missing) {
+		callback(DurationScanner::Result { path, chrono::microseconds(-1) });
+		++calls;
+	}
+	if (changed.empty()) {
+		return calls;
+	}
+	
+	if (m_scanner == nullptr) {
+		m_scanner = std::make_unique<DurationScanner>();
+	}
+	
+	// the stamp is taken before loading, a file modified meanwhile is simply queried again
+	std::unordered_map<fs::path, Database::FileStamp> pending;
+	for (Database::FileStamp &stamp : stamps) {
+		pending.emplace(stamp.path, std::move(stamp));
+	}
+	
+	std::vector<std::pair<Database::FileStamp, chrono::microseconds>> results;
+	calls += m_scanner->scan(std::move(changed), [&](const DurationScanner::Result &result) {
+		if (result.duration >= chrono::microseconds::zero()) {
+			results.emplace_back(pending.at(result.media), result.duration);
+		}
+		callback(result);
+		
+		if (results.size() >= WRITE_BATCH) {
+			(void)m_database.set_cached_durations(results);
+			results.clear();
+		}
+	});
+	
+	(void)m_database.set_cached_durations(results);
+	return calls;
+}
+
 }
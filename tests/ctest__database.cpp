@@ -1,20 +1,41 @@
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <set>
 #include <momuma/spdlog.h>
+#include <thread>
 
 #include "catch2_main.h"
 #include "Database-Sqlite3.h"
+#include "HistoryRecorder.h"
+#include "Indexer.h"
+#include "TagReader.h"
 
 
 [[nodiscard]] static inline
-Momuma::Database::Sqlite3 make_database(void)
-{
+Momuma::Database::Sqlite3 make_database(
+	Momuma::Database::StorageType storage = Momuma::Database::StorageType::DISK
+) {
 	spdlog::set_level(static_cast<spdlog::level::level_enum>(SPDLOG_ACTIVE_LEVEL));
-	Momuma::Database::Sqlite3 db(TESTING_PATH, Momuma::Database::StorageType::DISK);
+	Momuma::Database::Sqlite3 db(TESTING_PATH, storage);
 	
 	REQUIRE(static_cast<bool>(db));
 	REQUIRE(db.get_database_location() == TESTING_PATH);
 	return db;
 }
 
+// Inserts `count` rows into the `files` table of `playlist` without going through the API.
+static void fill_playlist(Momuma::Database::Sqlite3 &db, const std::string &playlist, int count)
+{
+	const std::string query = fmt::format(
+		R"(WITH RECURSIVE seq(i) AS (SELECT 0 UNION ALL SELECT i + 1 FROM seq WHERE i + 1 < {0:d})
+		INSERT INTO [files] SELECT (SELECT [id] FROM [playlists] WHERE [name] = '{1:s}'),
+		i, printf('track %06d.mp3', i) FROM seq;)",
+		count, playlist
+	);
+	REQUIRE(sqlite3_exec(db._handle, query.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK);
+}
+
 TEST_CASE("fill database")
 {
 	auto db = make_database();
@@ -35,3 +56,1121 @@ TEST_CASE("fill database")
 	REQUIRE(itemCount == 3);
 	REQUIRE(itemCount == std::ssize(list));
 }
+
+TEST_CASE("statement reuse", "[cache]")
+{
+	using Momuma::Database::IterFlag;
+	auto db = make_database(Momuma::Database::StorageType::MEMORY);
+	
+	REQUIRE(db.create_playlist("a"));
+	REQUIRE(db.create_playlist("b"));
+	fill_playlist(db, "a", 3);
+	fill_playlist(db, "b", 5);
+	
+	const auto count = [&db](const std::string &playlist) {
+		return db.get_media_paths(playlist, [](fs::path) { return IterFlag::NEXT; });
+	};
+	for (int i = 0; i < 3; ++i) {
+		REQUIRE(count("a") == 3);
+		REQUIRE(count("b") == 5);
+	}
+	
+	// stopping half-way must not leave the statement mid-iteration
+	REQUIRE(db.get_media_paths("b", [](fs::path) { return IterFlag::STOP; }) == 1);
+	REQUIRE(count("b") == 5);
+	
+	// the same query re-entered from inside of its own callback
+	int nested = 0;
+	REQUIRE(db.get_media_paths("a", [&](fs::path) {
+		nested += count("b");
+		return IterFlag::NEXT;
+	}) == 3);
+	REQUIRE(nested == 15);
+	
+	// longer playlists are read in several chunks, in order
+	REQUIRE(db.create_playlist("c"));
+	fill_playlist(db, "c", 600);
+	std::vector<fs::path> paths;
+	REQUIRE(db.get_media_paths("c", [&paths](fs::path path) {
+		paths.push_back(std::move(path));
+		return (paths.size() < 300) ? IterFlag::NEXT : IterFlag::STOP;
+	}) == 300);
+	REQUIRE(count("c") == 600);
+	REQUIRE(paths.back().filename() == "track 000299.mp3");
+	
+	Momuma::Database::Sqlite3 moved(std::move(db));
+	REQUIRE(static_cast<bool>(moved));
+	REQUIRE_FALSE(static_cast<bool>(db));
+	REQUIRE(moved.get_media_paths("a", [](fs::path) { return IterFlag::NEXT; }) == 3);
+}
+
+TEST_CASE("statement reuse benchmark", "[.][benchmark]")
+{
+	using Momuma::Database::IterFlag;
+	auto db = make_database(Momuma::Database::StorageType::MEMORY);
+	spdlog::set_level(spdlog::level::info);
+	
+	REQUIRE(db.create_playlist("bench"));
+	fill_playlist(db, "bench", 50);
+	
+	BENCHMARK("get_playlists") {
+		return db.get_playlists([](std::string) { return IterFlag::NEXT; });
+	};
+	BENCHMARK("create_playlist (existing)") {
+		return db.create_playlist("bench");
+	};
+	BENCHMARK("get_media_paths (50 rows)") {
+		return db.get_media_paths("bench", [](fs::path) { return IterFlag::NEXT; });
+	};
+	BENCHMARK("get_media_paths (first row)") {
+		return db.get_media_paths("bench", [](fs::path) { return IterFlag::STOP; });
+	};
+}
+
+TEST_CASE("set playlist data", "[playlist]")
+{
+	using Momuma::Database::IterFlag;
+	auto db = make_database(Momuma::Database::StorageType::MEMORY);
+	const fs::path folder = db.get_database_location() / "Playlists" / "list";
+	
+	std::vector<fs::path> paths;
+	for (int i = 0; i < 300; ++i) {
+		paths.push_back(folder / fmt::format("{:03d}.mp3", i));
+	}
+	paths.push_back("/elsewhere/outside.mp3");
+	
+	const auto read = [&db](const std::string &playlist) {
+		std::vector<fs::path> result;
+		db.get_media_paths(playlist, [&result](fs::path path) {
+			result.push_back(std::move(path));
+			return IterFlag::NEXT;
+		});
+		return result;
+	};
+	
+	REQUIRE_FALSE(db.set_playlist_data("list", paths));
+	REQUIRE(db.create_playlist("list"));
+	REQUIRE(db.set_playlist_data("list", paths));
+	REQUIRE(read("list") == paths);
+	
+	paths.resize(7);
+	REQUIRE(db.set_playlist_data("list", paths));
+	REQUIRE(read("list") == paths);
+	
+	REQUIRE(db.set_playlist_data("list", {}));
+	REQUIRE(read("list").empty());
+}
+
+// Returns the last column of the first row of `query` as text.
+[[nodiscard]] static
+std::string query_text(sqlite3 *db, const std::string &query)
+{
+	std::string result;
+	const int rc = sqlite3_exec(db, query.c_str(), [](void *out, int columns, char **values, char**) {
+		std::string &str = *static_cast<std::string*>(out);
+		if (str.empty() && values[columns - 1] != nullptr) { str = values[columns - 1]; }
+		return 0;
+	}, &result, nullptr);
+	REQUIRE(rc == SQLITE_OK);
+	return result;
+}
+
+// Returns the details of every step of the plan of `query`, one per line.
+[[nodiscard]] static
+std::string query_plan(sqlite3 *db, const std::string &query)
+{
+	std::string result;
+	const int rc = sqlite3_exec(db, ("EXPLAIN QUERY PLAN " + query).c_str(),
+		[](void *out, int columns, char **values, char**) {
+			std::string &str = *static_cast<std::string*>(out);
+			if (values[columns - 1] != nullptr) { str.append(values[columns - 1]).push_back('\n'); }
+			return 0;
+		}, &result, nullptr
+	);
+	REQUIRE(rc == SQLITE_OK);
+	return result;
+}
+
+TEST_CASE("schema migrations", "[schema]")
+{
+	const fs::path root = fs::path(TESTING_PATH) / "migration";
+	fs::remove_all(root);
+	fs::create_directory(root);
+	
+	// a database created before `database_version` was maintained
+	{
+		sqlite3 *handle = nullptr;
+		REQUIRE(sqlite3_open((root / "sqlite3.db").c_str(), &handle) == SQLITE_OK);
+		REQUIRE(sqlite3_exec(handle,
+			R"(CREATE TABLE [files] ([playlist_id] INTEGER NOT NULL,
+				[index] INTEGER NOT NULL, [name] TEXT NOT NULL) STRICT;
+			CREATE TABLE [playlists] ([id] INTEGER NOT NULL, [name] TEXT NOT NULL UNIQUE,
+				PRIMARY KEY([id] AUTOINCREMENT)) STRICT;
+			CREATE TABLE [database_version] ([version] INTEGER NOT NULL, [notes] TEXT,
+				PRIMARY KEY([version])) STRICT;
+			INSERT INTO [playlists] ([name]) VALUES ('old');
+			INSERT INTO [files] VALUES (1, 0, 'a.mp3'), (1, 1, 'b.mp3');)",
+			nullptr, nullptr, nullptr) == SQLITE_OK
+		);
+		REQUIRE(sqlite3_close(handle) == SQLITE_OK);
+	}
+	
+	for (int i = 0; i < 2; ++i) {
+		Momuma::Database::Sqlite3 db(root);
+		REQUIRE(static_cast<bool>(db));
+		REQUIRE(query_text(db._handle, "SELECT MIN(version) FROM database_version;") == "1");
+		REQUIRE(db.get_media_paths("old", [](fs::path) {
+			return Momuma::Database::IterFlag::NEXT;
+		}) == 2);
+		
+		const std::string plan = query_text(db._handle,
+			"EXPLAIN QUERY PLAN SELECT [name] FROM [files] WHERE [playlist_id] = 1 ORDER BY [index];"
+		);
+		REQUIRE_THAT(plan, Catch::Contains("COVERING INDEX"));
+		
+		// rows existing before the full-text index are searchable
+		std::vector<Momuma::Database::SearchHit> hits;
+		REQUIRE(db.search_media(".mp3", 10, hits) == 2);
+	}
+}
+
+TEST_CASE("media names batch", "[playlist]")
+{
+	auto db = make_database(Momuma::Database::StorageType::MEMORY);
+	const fs::path folder = db.get_playlist_location("list");
+	Momuma::Database::MediaBatch batch;
+	
+	REQUIRE(db.create_playlist("list"));
+	REQUIRE(db.get_media_names("list", batch) == 0);
+	REQUIRE(batch.empty());
+	
+	REQUIRE(db.set_playlist_data("list", { folder / "b.mp3", "/other/a.mp3", folder / "" }));
+	REQUIRE(db.get_media_names("list", batch) == 3);
+	REQUIRE(batch.size() == 3);
+	REQUIRE(batch[0] == "b.mp3");
+	REQUIRE(batch[1] == "/other/a.mp3");
+	REQUIRE(batch[2] == ".");
+	REQUIRE(db.get_media_names("missing", batch) == 0);
+	REQUIRE(batch.empty());
+}
+
+TEST_CASE("media window", "[playlist]")
+{
+	using Kind = Momuma::Database::FileChange::Kind;
+	auto db = make_database(Momuma::Database::StorageType::MEMORY);
+	Momuma::Database::MediaBatch batch;
+	
+	REQUIRE(db.create_playlist("list"));
+	fill_playlist(db, "list", 10);
+	REQUIRE(db.apply_file_changes({
+		{ .kind = Kind::REMOVE_FILE, .playlist = "list", .name = "track 000004.mp3" }
+	}));
+	
+	REQUIRE(db.get_media_window("list", 0, 3, batch) == 3);
+	REQUIRE(batch[0] == "track 000000.mp3");
+	REQUIRE(batch[2] == "track 000002.mp3");
+	
+	// pages continue after the last returned index and skip removed rows
+	REQUIRE(db.get_media_window("list", batch.indexes.back() + 1, 3, batch) == 3);
+	REQUIRE(batch.indexes == std::vector<int64_t>{ 3, 5, 6 });
+	REQUIRE(batch[1] == "track 000005.mp3");
+	
+	REQUIRE(db.get_media_window("list", 8, 3, batch) == 2);
+	REQUIRE(batch[1] == "track 000009.mp3");
+	REQUIRE(db.get_media_window("list", 10, 3, batch) == 0);
+	REQUIRE(db.get_media_window("list", 0, 0, batch) == 0);
+	REQUIRE(db.get_media_window("missing", 0, 3, batch) == 0);
+	
+	// the plan of the query actually run, its parameters are left unbound
+	using Momuma::Database::Sqlite3;
+	const std::string plan = query_plan(db._handle, Sqlite3::media_window_query());
+	REQUIRE_THAT(plan,
+		Catch::Contains("COVERING INDEX files_by_playlist (playlist_id=? AND index>?)")
+	);
+	REQUIRE_THAT(plan, !Catch::Contains("TEMP B-TREE"));
+}
+
+TEST_CASE("full-text search", "[search]")
+{
+	using Kind = Momuma::Database::FileChange::Kind;
+	auto db = make_database(Momuma::Database::StorageType::MEMORY);
+	const fs::path folder = db.get_playlist_location("Rock \"Classics\"");
+	std::vector<Momuma::Database::SearchHit> hits;
+	std::vector<std::string> playlists;
+	
+	REQUIRE(db.create_playlist("Rock \"Classics\""));
+	REQUIRE(db.create_playlist("Jazz"));
+	REQUIRE(db.set_playlist_data("Rock \"Classics\"", {
+		folder / "Queen - Bohemian Rhapsody.mp3",
+		folder / "Queen - Don't Stop Me Now.flac",
+		folder / "Deep Purple - \"Smoke\" on the Water.mp3",
+	}));
+	fill_playlist(db, "Jazz", 20);
+	
+	REQUIRE(db.search_media("queen", 10, hits) == 2);
+	REQUIRE(hits[0].playlist == "Rock \"Classics\"");
+	REQUIRE(hits[0].name.starts_with("Queen - "));
+	REQUIRE(db.search_media("queen", 1, hits) == 1);
+	
+	// the input is a literal substring, not a query
+	REQUIRE(db.search_media("Queen - Don't", 10, hits) == 1);
+	REQUIRE(hits[0].index == 1);
+	REQUIRE(db.search_media("\"Smoke\"", 10, hits) == 1);
+	REQUIRE(db.search_media("queen OR jazz", 10, hits) == 0);
+	REQUIRE(db.search_media("*)(", 10, hits) == 0);
+	REQUIRE(db.search_media("track 00001", 100, hits) == 10);
+	
+	// trigrams can't match shorter text
+	REQUIRE(db.search_media("qu", 10, hits) == 0);
+	REQUIRE(db.search_media("", 10, hits) == 0);
+	REQUIRE(db.search_media("мус", 10, hits) == 0);
+	
+	REQUIRE(db.search_playlists("classic", 10, playlists) == 1);
+	REQUIRE(playlists[0] == "Rock \"Classics\"");
+	REQUIRE(db.search_playlists("zz", 10, playlists) == 0);
+	
+	// the index follows changes to the tables
+	REQUIRE(db.apply_file_changes({
+		{ .kind = Kind::RENAME_FILE, .playlist = "Rock \"Classics\"",
+			.name = "Queen - Bohemian Rhapsody.mp3", .newName = "Queen - Innuendo.mp3" },
+		{ .kind = Kind::RENAME_PLAYLIST, .playlist = "Jazz", .newName = "Smooth Jazz" },
+	}));
+	REQUIRE(db.search_media("Rhapsody", 10, hits) == 0);
+	REQUIRE(db.search_media("innuendo", 10, hits) == 1);
+	REQUIRE(db.search_playlists("smooth", 10, playlists) == 1);
+	REQUIRE(db.search_media("track 000019", 10, hits) == 1);
+	REQUIRE(hits[0].playlist == "Smooth Jazz");
+	
+	// bulk writes are indexed by the next search, renames before it included
+	REQUIRE(db.set_playlist_data("Rock \"Classics\"", {
+		folder / "Queen - Bohemian Rhapsody.mp3", folder / "Muse - Uprising.mp3",
+	}));
+	REQUIRE(db.apply_file_changes({
+		{ .kind = Kind::RENAME_FILE, .playlist = "Rock \"Classics\"",
+			.name = "Muse - Uprising.mp3", .newName = "Muse - Madness.mp3" },
+	}));
+	REQUIRE(db.search_media("innuendo", 10, hits) == 0);
+	REQUIRE(db.search_media("Uprising", 10, hits) == 0);
+	REQUIRE(db.search_media("madness", 10, hits) == 1);
+	REQUIRE(db.search_media("Rhapsody", 10, hits) == 1);
+	REQUIRE(db.set_playlist_data("Rock \"Classics\"", { folder / "Queen - Innuendo.mp3" }));
+	REQUIRE(db.search_media("queen", 10, hits) == 1);
+	REQUIRE(hits[0].name == "Queen - Innuendo.mp3");
+	REQUIRE(query_text(db._handle, "SELECT COUNT(*) FROM files_fts_deferred;") == "0");
+	REQUIRE(query_text(db._handle,
+		"INSERT INTO files_fts (files_fts) VALUES ('integrity-check'); SELECT 'ok';") == "ok");
+	
+	REQUIRE(db.remove_playlist("Smooth Jazz"));
+	REQUIRE(db.search_media("track", 10, hits) == 0);
+	REQUIRE(db.search_playlists("smooth", 10, playlists) == 0);
+}
+
+TEST_CASE("set playlist data benchmark", "[.][benchmark]")
+{
+	using Momuma::Database::StorageType;
+	spdlog::set_level(spdlog::level::info);
+	
+	for (const StorageType storage : { StorageType::DISK, StorageType::MEMORY }) {
+		Momuma::Database::Sqlite3 db(fs::path(TESTING_PATH) / "benchmark", storage);
+		REQUIRE(static_cast<bool>(db));
+		REQUIRE(db.create_playlist("bench"));
+		
+		for (const int count : { 1'000, 10'000, 100'000 }) {
+			std::vector<fs::path> paths;
+			paths.reserve(static_cast<size_t>(count));
+			for (int i = 0; i < count; ++i) {
+				paths.push_back(fmt::format("/music/artist {:d}/track {:06d}.flac", i % 97, i));
+			}
+			
+			const auto start = chrono::steady_clock::now();
+			REQUIRE(db.set_playlist_data("bench", paths));
+			const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+			
+			SPDLOG_INFO("set_playlist_data: {:s} {:7d} rows | {} | {:.0f} rows/s",
+				(storage == StorageType::DISK ? "disk  " : "memory"),
+				count, chrono::duration_cast<chrono::microseconds>(elapsed),
+				count / elapsed.count()
+			);
+		}
+		
+		// the first search indexes the files of the last write
+		std::vector<Momuma::Database::SearchHit> hits;
+		const auto start = chrono::steady_clock::now();
+		REQUIRE(db.search_media("track 000001", 10, hits) == 1);
+		SPDLOG_INFO("first search:      {:s}  100000 rows | {}",
+			(storage == StorageType::DISK ? "disk  " : "memory"),
+			chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start)
+		);
+		
+		// replacing an indexed playlist removes its names from the index first
+		const auto replaceStart = chrono::steady_clock::now();
+		REQUIRE(db.set_playlist_data("bench", { "/music/single.flac" }));
+		SPDLOG_INFO("set_playlist_data: {:s}       1 row over 100000 indexed | {}",
+			(storage == StorageType::DISK ? "disk  " : "memory"),
+			chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - replaceStart)
+		);
+	}
+}
+
+TEST_CASE("playlist load vs library size benchmark", "[.][benchmark]")
+{
+	using Momuma::Database::IterFlag;
+	auto db = make_database(Momuma::Database::StorageType::MEMORY);
+	spdlog::set_level(spdlog::level::info);
+	
+	REQUIRE(db.create_playlist("small"));
+	REQUIRE(db.create_playlist("library"));
+	fill_playlist(db, "small", 50);
+	
+	const auto load = [&db] {
+		return db.get_media_paths("small", [](fs::path) { return IterFlag::NEXT; });
+	};
+	
+	BENCHMARK("get_media_paths (50 of 50 rows)") { return load(); };
+	fill_playlist(db, "library", 10'000);
+	BENCHMARK("get_media_paths (50 of 10k rows)") { return load(); };
+	fill_playlist(db, "library", 200'000);
+	BENCHMARK("get_media_paths (50 of 200k rows)") { return load(); };
+}
+
+TEST_CASE("read connection pool", "[pool]")
+{
+	using Momuma::Database::IterFlag;
+	const fs::path root = fs::path(TESTING_PATH) / "wal";
+	fs::remove_all(root);
+	
+	Momuma::Database::Sqlite3 db(root, Momuma::Database::StorageType::DISK, 2);
+	REQUIRE(static_cast<bool>(db));
+	REQUIRE(query_text(db._handle, "PRAGMA journal_mode;") == "wal");
+	
+	const auto count = [&db](const std::string &playlist) {
+		return db.get_media_paths(playlist, [](fs::path) { return IterFlag::NEXT; });
+	};
+	
+	// writes are visible to the read connections as soon as they're committed
+	REQUIRE(db.create_playlist("list"));
+	REQUIRE(count("list") == 0);
+	REQUIRE(db.set_playlist_data("list", { "/a.mp3", "/b.mp3" }));
+	REQUIRE(count("list") == 2);
+	
+	// nesting deeper than the pool falls back to the writer connection
+	int nested = 0;
+	REQUIRE(db.get_media_paths("list", [&](fs::path) {
+		db.get_media_paths("list", [&](fs::path) {
+			nested += count("list");
+			return IterFlag::NEXT;
+		});
+		return IterFlag::NEXT;
+	}) == 2);
+	REQUIRE(nested == 8);
+	
+	std::vector<std::thread> threads;
+	std::atomic<int> failures = 0;
+	for (int i = 0; i < 4; ++i) {
+		threads.emplace_back([&] {
+			for (int j = 0; j < 100; ++j) {
+				if (count("list") != 2) { ++failures; }
+			}
+		});
+	}
+	for (auto &thread : threads) { thread.join(); }
+	REQUIRE(failures == 0);
+	
+	// a reserved reader stays with its thread, other threads share the rest of the pool
+	{
+		const Momuma::Database::ReservedReader reader = db.reserve_reader();
+		REQUIRE(static_cast<bool>(reader));
+		REQUIRE_FALSE(static_cast<bool>(db.reserve_reader()));
+		REQUIRE(count("list") == 2);
+		
+		std::array<bool, 2> reserved = { false, false };
+		std::thread other([&] {
+			const Momuma::Database::ReservedReader otherReader = db.reserve_reader();
+			reserved[0] = static_cast<bool>(otherReader);
+			std::thread([&] {
+				reserved[1] = static_cast<bool>(db.reserve_reader());
+			}).join();
+			if (count("list") != 2) { ++failures; }
+		});
+		other.join();
+		REQUIRE(reserved[0]);
+		REQUIRE_FALSE(reserved[1]);
+		REQUIRE(failures == 0);
+	}
+	REQUIRE(static_cast<bool>(db.reserve_reader()));
+}
+
+TEST_CASE("reads without a reader", "[pool]")
+{
+	using Momuma::Database::IterFlag;
+	auto db = make_database(Momuma::Database::StorageType::MEMORY);
+	REQUIRE(db.create_playlist("list"));
+	std::vector<fs::path> paths;
+	for (int i = 0; i < 2000; ++i) {
+		paths.push_back(fmt::format("/music/track {:04d}.mp3", i));
+	}
+	
+	// queries on the writer connection never see the rows of a transaction in progress
+	std::atomic<bool> done = false;
+	std::atomic<int> partial = 0;
+	std::thread reader([&] {
+		while (!done) {
+			const int count = db.get_media_paths("list", [](fs::path) { return IterFlag::NEXT; });
+			if (count != 0 && count != 2000) { ++partial; }
+		}
+	});
+	for (int i = 0; i < 20; ++i) {
+		REQUIRE(db.set_playlist_data("list", (i % 2 == 0) ? paths : std::vector<fs::path>()));
+	}
+	done = true;
+	reader.join();
+	REQUIRE(partial == 0);
+}
+
+TEST_CASE("concurrent readers benchmark", "[.][benchmark]")
+{
+	using Momuma::Database::IterFlag;
+	spdlog::set_level(spdlog::level::info);
+	const fs::path root = fs::path(TESTING_PATH) / "wal";
+	constexpr auto DURATION = chrono::seconds(1);
+	
+	std::vector<fs::path> paths;
+	for (int i = 0; i < 1'000; ++i) {
+		paths.push_back(fmt::format("/music/track {:04d}.flac", i));
+	}
+	
+	for (const unsigned threadCount : { 1u, 2u, 4u, 8u }) {
+		for (const unsigned readers : { 0u, threadCount }) {
+			Momuma::Database::Sqlite3 db(root, Momuma::Database::StorageType::DISK, readers);
+			REQUIRE(static_cast<bool>(db));
+			REQUIRE(db.create_playlist("bench"));
+			REQUIRE(db.set_playlist_data("bench", paths));
+			
+			std::atomic<bool> running = true;
+			std::atomic<int64_t> queries = 0;
+			std::vector<std::thread> threads;
+			for (unsigned i = 0; i < threadCount; ++i) {
+				threads.emplace_back([&] {
+					while (running) {
+						db.get_media_paths("bench", [](fs::path) { return IterFlag::NEXT; });
+						++queries;
+					}
+				});
+			}
+			std::this_thread::sleep_for(DURATION);
+			running = false;
+			for (auto &thread : threads) { thread.join(); }
+			
+			SPDLOG_INFO("{:d} threads, {:d} read connections: {:.0f} playlist loads/s",
+				threadCount, readers, static_cast<double>(queries) / DURATION.count()
+			);
+		}
+	}
+}
+
+TEST_CASE("duration cache", "[cache]")
+{
+	using Momuma::Database::FileStamp;
+	auto db = make_database(Momuma::Database::StorageType::MEMORY);
+	
+	const fs::path root = fs::path(TESTING_PATH) / "stamps";
+	fs::remove_all(root);
+	fs::create_directory(root);
+	std::vector<FileStamp> stamps;
+	for (int i = 0; i < 3; ++i) {
+		const fs::path path = root / fmt::format("{:d}.mp3", i);
+		std::ofstream(path) << "data";
+		stamps.push_back(FileStamp::of(path).value());
+	}
+	REQUIRE_FALSE(FileStamp::of(root / "missing.mp3").has_value());
+	
+	REQUIRE(db.set_cached_durations({
+		{ stamps[0], chrono::seconds(10) },
+		{ stamps[1], chrono::seconds(20) },
+	}));
+	auto durations = db.get_cached_durations(stamps);
+	REQUIRE(durations.size() == 3);
+	REQUIRE(durations[0] == chrono::seconds(10));
+	REQUIRE(durations[1] == chrono::seconds(20));
+	REQUIRE_FALSE(durations[2].has_value());
+	
+	// a modified file misses the cache until its new duration is stored
+	std::ofstream(stamps[1].path, std::ios::app) << "more";
+	stamps[1] = FileStamp::of(stamps[1].path).value();
+	REQUIRE_FALSE(db.get_cached_durations(stamps)[1].has_value());
+	REQUIRE(db.set_cached_durations({ { stamps[1], chrono::seconds(21) } }));
+	REQUIRE(db.get_cached_durations(stamps)[1] == chrono::seconds(21));
+}
+
+TEST_CASE("duration cache benchmark", "[.][benchmark]")
+{
+	using Momuma::Database::FileStamp;
+	auto db = make_database(Momuma::Database::StorageType::MEMORY);
+	spdlog::set_level(spdlog::level::info);
+	
+	std::vector<std::pair<FileStamp, chrono::microseconds>> entries;
+	std::vector<FileStamp> stamps;
+	for (int i = 0; i < 50'000; ++i) {
+		FileStamp stamp { fmt::format("/music/track {:05d}.flac", i), 4'000'000 + i, i };
+		entries.emplace_back(stamp, chrono::seconds(180 + i % 60));
+		stamps.push_back(std::move(stamp));
+	}
+	REQUIRE(db.set_cached_durations(entries));
+	
+	BENCHMARK("get_cached_durations (50k files)") {
+		return db.get_cached_durations(stamps).size();
+	};
+}
+
+TEST_CASE("resume points", "[resume]")
+{
+	auto db = make_database(Momuma::Database::StorageType::MEMORY);
+	const fs::path book = "/audiobooks/chapter 1.m4b";
+	const fs::path other = "/audiobooks/chapter 2.m4b";
+	REQUIRE_FALSE(db.get_resume_point(book).has_value());
+	
+	REQUIRE(db.set_resume_points({ { book, chrono::seconds(90) }, { other, chrono::seconds(5) } }));
+	REQUIRE(db.get_resume_point(book) == chrono::seconds(90));
+	REQUIRE(db.get_resume_point(other) == chrono::seconds(5));
+	
+	// later positions replace the older ones, negative ones remove them
+	REQUIRE(db.set_resume_points({ { book, chrono::seconds(95) }, { other, chrono::seconds(-1) } }));
+	REQUIRE(db.get_resume_point(book) == chrono::seconds(95));
+	REQUIRE_FALSE(db.get_resume_point(other).has_value());
+	REQUIRE(db.set_resume_points({ { other, chrono::seconds(-1) } }));
+}
+
+TEST_CASE("play history", "[history]")
+{
+	using Momuma::Database::PlayEvent;
+	auto db = make_database(Momuma::Database::StorageType::MEMORY);
+	const fs::path song = "/music/song.flac";
+	const fs::path skipped = "/music/skipped.flac";
+	const auto start = chrono::system_clock::now() - chrono::hours(1);
+	
+	REQUIRE(db.add_play_events({
+		{ song, PlayEvent::Kind::PLAYED, start, chrono::seconds(200) },
+		{ skipped, PlayEvent::Kind::SKIPPED, start + chrono::minutes(4), chrono::seconds(3) },
+		{ song, PlayEvent::Kind::SKIPPED, start + chrono::minutes(5), chrono::seconds(10) },
+		// events don't have to be in order, the latest play is kept
+		{ song, PlayEvent::Kind::PLAYED, start - chrono::hours(1), chrono::seconds(200) },
+	}));
+	REQUIRE(db.add_play_events({}));
+	
+	const auto stats = db.get_play_stats({ song, skipped, "/music/unknown.flac" });
+	REQUIRE(stats.size() == 3);
+	REQUIRE(stats[0].playCount == 2);
+	REQUIRE(stats[0].skipCount == 1);
+	REQUIRE(stats[0].lastPlayed.has_value());
+	REQUIRE(chrono::abs(*stats[0].lastPlayed - start) < chrono::milliseconds(1));
+	REQUIRE(stats[1].playCount == 0);
+	REQUIRE(stats[1].skipCount == 1);
+	REQUIRE_FALSE(stats[1].lastPlayed.has_value());
+	REQUIRE(stats[2].playCount == 0);
+	REQUIRE(stats[2].skipCount == 0);
+	
+	// in the order they were added, last first
+	std::vector<PlayEvent> history;
+	REQUIRE(db.get_play_history(3, history) == 3);
+	REQUIRE(history.size() == 3);
+	REQUIRE(history[0].kind == PlayEvent::Kind::PLAYED);
+	REQUIRE(chrono::abs(history[0].time - (start - chrono::hours(1))) < chrono::milliseconds(1));
+	REQUIRE(history[1].path == song);
+	REQUIRE(history[1].kind == PlayEvent::Kind::SKIPPED);
+	REQUIRE(history[1].position == chrono::seconds(10));
+	REQUIRE(history[2].path == skipped);
+}
+
+TEST_CASE("history recorder", "[history]")
+{
+	using Momuma::Database::PlayEvent;
+	auto db = make_database(Momuma::Database::StorageType::MEMORY);
+	const auto event = [](int i) {
+		return PlayEvent {
+			fmt::format("/music/track {:02d}.flac", i % 10),
+			(i % 3 == 0) ? PlayEvent::Kind::SKIPPED : PlayEvent::Kind::PLAYED,
+			chrono::system_clock::now(), chrono::seconds(i),
+		};
+	};
+	
+	SECTION("flush") {
+		Momuma::HistoryRecorder recorder(db, 64, chrono::seconds(60));
+		for (int i = 0; i < 30; ++i) {
+			REQUIRE(recorder.record(event(i)));
+		}
+		REQUIRE(recorder.flush(chrono::seconds(5)));
+		REQUIRE(recorder.dropped() == 0);
+		
+		std::vector<PlayEvent> history;
+		REQUIRE(db.get_play_history(100, history) == 30);
+		const auto stats = db.get_play_stats({ "/music/track 00.flac" });
+		REQUIRE(stats[0].playCount == 2); // 10, 20
+		REQUIRE(stats[0].skipCount == 1); // 0
+	}
+	SECTION("destruction writes the queue") {
+		{
+			Momuma::HistoryRecorder recorder(db, 64, chrono::seconds(60));
+			for (int i = 0; i < 10; ++i) {
+				REQUIRE(recorder.record(event(i)));
+			}
+		}
+		std::vector<PlayEvent> history;
+		REQUIRE(db.get_play_history(100, history) == 10);
+	}
+	SECTION("bounded queue") {
+		Momuma::HistoryRecorder recorder(db, 0);
+		REQUIRE_FALSE(recorder.record(event(0)));
+		REQUIRE(recorder.dropped() == 1);
+		REQUIRE(recorder.flush(chrono::seconds(5)));
+	}
+}
+
+TEST_CASE("history recorder benchmark", "[.][benchmark]")
+{
+	using Momuma::Database::PlayEvent;
+	auto db = make_database();
+	spdlog::set_level(spdlog::level::info);
+	
+	std::vector<PlayEvent> events;
+	for (int i = 0; i < 200; ++i) {
+		events.push_back({
+			fmt::format("/music/track {:03d}.flac", i), PlayEvent::Kind::SKIPPED,
+			chrono::system_clock::now(), chrono::seconds(1),
+		});
+	}
+	
+	BENCHMARK("add_play_events, one transaction per event (200 events)") {
+		for (const PlayEvent &event : events) {
+			(void)db.add_play_events({ event });
+		}
+	};
+	BENCHMARK("HistoryRecorder, group commit (200 events)") {
+		Momuma::HistoryRecorder recorder(db);
+		for (const PlayEvent &event : events) {
+			(void)recorder.record(event);
+		}
+		return recorder.flush(chrono::seconds(30));
+	};
+}
+
+TEST_CASE("playlists folder indexer", "[indexer]")
+{
+	using Momuma::Database::IterFlag;
+	const fs::path root = fs::path(TESTING_PATH) / "indexer";
+	const fs::path folder = root / "Playlists";
+	fs::remove_all(root);
+	fs::create_directories(folder / "a");
+	std::ofstream(folder / "a" / "1.mp3");
+	std::ofstream(folder / "a" / "2.mp3");
+	std::ofstream(folder / "a" / ".hidden");
+	
+	Momuma::Database::Sqlite3 db(root);
+	REQUIRE(static_cast<bool>(db));
+	
+	const auto names = [&db, &folder](const std::string &playlist) {
+		std::vector<std::string> result;
+		db.get_media_paths(playlist, [&](fs::path path) {
+			result.push_back(path.lexically_relative(folder / playlist));
+			return IterFlag::NEXT;
+		});
+		return result;
+	};
+	const auto playlists = [&db] {
+		std::set<std::string> result;
+		db.get_playlists([&](std::string playlist) {
+			result.insert(std::move(playlist));
+			return IterFlag::NEXT;
+		});
+		return result;
+	};
+	// polls `condition` until the indexer caught up
+	const auto eventually = [](auto condition) {
+		for (int i = 0; i < 100 && !condition(); ++i) {
+			std::this_thread::sleep_for(chrono::milliseconds(20));
+		}
+		return condition();
+	};
+	
+	Momuma::Indexer indexer(db, chrono::milliseconds(10));
+	REQUIRE(static_cast<bool>(indexer));
+	REQUIRE(indexer.wait_crawled(chrono::seconds(5)));
+	REQUIRE(names("a") == std::vector<std::string> { "1.mp3", "2.mp3" });
+	
+	std::ofstream(folder / "a" / "3.mp3");
+	fs::rename(folder / "a" / "1.mp3", folder / "a" / "0.mp3");
+	fs::remove(folder / "a" / "2.mp3");
+	REQUIRE(eventually([&] {
+		return names("a") == std::vector<std::string> { "0.mp3", "3.mp3" };
+	}));
+	
+	// moved over an existing file, which isn't kept twice
+	std::ofstream(folder / "a" / "4.mp3");
+	REQUIRE(eventually([&] { return names("a").size() == 3; }));
+	fs::rename(folder / "a" / "4.mp3", folder / "a" / "3.mp3");
+	REQUIRE(eventually([&] {
+		return names("a") == std::vector<std::string> { "0.mp3", "3.mp3" };
+	}));
+	
+	fs::create_directory(folder / "b");
+	std::ofstream(folder / "b" / "x.mp3");
+	fs::rename(folder / "a" / "3.mp3", folder / "b" / "3.mp3");
+	// whether the files arrive before the folder is being watched is up to timing
+	REQUIRE(eventually([&] {
+		const std::vector<std::string> list = names("b");
+		return std::set(list.begin(), list.end()) == std::set<std::string> { "x.mp3", "3.mp3" };
+	}));
+	REQUIRE(names("a") == std::vector<std::string> { "0.mp3" });
+	
+	fs::rename(folder / "a", folder / "c");
+	fs::remove_all(folder / "b");
+	REQUIRE(eventually([&] { return playlists() == std::set<std::string> { "c" }; }));
+	REQUIRE(names("c") == std::vector<std::string> { "0.mp3" });
+	
+	// the rename conflicts with a stored playlist, the folder's content replaces it
+	REQUIRE(sqlite3_exec(db._handle,
+		R"(INSERT INTO [playlists] ([name]) VALUES ('d');
+		INSERT INTO [files] SELECT [id], 0, 'stale.mp3' FROM [playlists] WHERE [name] = 'd';)",
+		nullptr, nullptr, nullptr) == SQLITE_OK
+	);
+	std::ofstream(folder / "c" / "1.mp3");
+	fs::rename(folder / "c", folder / "d");
+	REQUIRE(eventually([&] { return playlists() == std::set<std::string> { "d" }; }));
+	REQUIRE(eventually([&] {
+		const std::vector<std::string> list = names("d");
+		return std::set(list.begin(), list.end()) == std::set<std::string> { "0.mp3", "1.mp3" };
+	}));
+}
+
+// Appends `value` to `bytes` as a little endian 32-bit integer.
+static void append_le32(std::vector<uint8_t> &bytes, const uint32_t value)
+{
+	for (int shift = 0; shift < 32; shift += 8) {
+		bytes.push_back(static_cast<uint8_t>(value >> shift));
+	}
+}
+
+// Builds a Vorbis comment block of `comments` ("NAME=value" strings).
+[[nodiscard]] static
+std::vector<uint8_t> make_vorbis_comments(const std::vector<std::string> &comments)
+{
+	std::vector<uint8_t> block;
+	append_le32(block, 4);
+	block.insert(block.end(), { 't', 'e', 's', 't' });
+	append_le32(block, static_cast<uint32_t>(comments.size()));
+	for (const std::string &comment : comments) {
+		append_le32(block, static_cast<uint32_t>(comment.size()));
+		block.insert(block.end(), comment.begin(), comment.end());
+	}
+	return block;
+}
+
+// Builds a FLAC file holding a STREAMINFO block and the Vorbis comments `comments`.
+[[nodiscard]] static
+std::vector<uint8_t> make_flac(const std::vector<std::string> &comments)
+{
+	const std::vector<uint8_t> block = make_vorbis_comments(comments);
+	std::vector<uint8_t> flac = { 'f', 'L', 'a', 'C', 0x00, 0, 0, 34 };
+	flac.resize(flac.size() + 34);
+	flac.insert(flac.end(), {
+		0x84, uint8_t(block.size() >> 16), uint8_t(block.size() >> 8), uint8_t(block.size())
+	});
+	flac.insert(flac.end(), block.begin(), block.end());
+	return flac;
+}
+
+static void write_file(const fs::path &path, const std::vector<uint8_t> &bytes)
+{
+	std::ofstream(path, std::ios::binary).write(
+		reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size())
+	);
+}
+
+TEST_CASE("media tag parsing", "[tags]")
+{
+	using Momuma::Database::MediaTags;
+	const auto contains = [](const std::vector<uint8_t> &bytes, const std::string_view text) {
+		const auto *data = reinterpret_cast<const char*>(bytes.data());
+		return text.data() >= data && text.data() + text.size() <= data + bytes.size();
+	};
+	
+	SECTION("ID3v2.4 with an ID3v1 fallback") {
+		// frame: id, syncsafe size, flags, then an encoding byte and the text
+		const auto frame = [](const std::string &id, const uint8_t encoding, const std::string &text) {
+			std::vector<uint8_t> bytes(id.begin(), id.end());
+			const size_t size = text.size() + 1;
+			bytes.insert(bytes.end(), { 0, 0, uint8_t(size >> 7), uint8_t(size & 0x7F), 0, 0 });
+			bytes.push_back(encoding);
+			bytes.insert(bytes.end(), text.begin(), text.end());
+			return bytes;
+		};
+		std::vector<uint8_t> frames;
+		for (const auto &bytes : {
+			frame("TIT2", 1, std::string("\xFF\xFE" "A\0\xE9\0", 6)), // "Aé" in UTF-16
+			frame("TPE1", 3, "Ünïcode Artist"),
+			frame("TPE2", 3, "Various"),
+			frame("TCON", 0, "(17)"),
+			frame("TRCK", 0, "3/12"),
+			frame("TDRC", 3, "2004-05-01"),
+		}) {
+			frames.insert(frames.end(), bytes.begin(), bytes.end());
+		}
+		
+		std::vector<uint8_t> file = { 'I', 'D', '3', 4, 0, 0, 0, 0 };
+		file.insert(file.end(), { uint8_t(frames.size() >> 7), uint8_t(frames.size() & 0x7F) });
+		file.insert(file.end(), frames.begin(), frames.end());
+		file.resize(file.size() + 1000, 0xFF); // audio
+		std::string id3v1(128, '\0');
+		id3v1.replace(0, 3, "TAG");
+		id3v1.replace(3, 5, "Other");
+		id3v1.replace(63, 6, "Album ");
+		file.insert(file.end(), id3v1.begin(), id3v1.end());
+		
+		MediaTags tags;
+		Momuma::TagArena arena;
+		REQUIRE(Momuma::parse_tags(file, tags, arena));
+		REQUIRE(tags.title == "A\xC3\xA9");
+		REQUIRE(tags.artist == "Ünïcode Artist");
+		REQUIRE(tags.albumArtist == "Various");
+		REQUIRE(tags.album == "Album");
+		REQUIRE(tags.genre == "Rock");
+		REQUIRE(tags.track == 3);
+		REQUIRE(tags.year == 2004);
+		
+		// only the UTF-16 title was copied
+		REQUIRE(arena.size() == 1);
+		REQUIRE(contains(file, tags.artist));
+		REQUIRE(contains(file, tags.album));
+	}
+	
+	SECTION("FLAC") {
+		const std::vector<uint8_t> file = make_flac({
+			"title=Song", "ARTIST=Band", "ARTIST=Second", "Album=Record", "TRACKNUMBER=7",
+			"DATE=1999", "GENRE=Jazz", "COMMENT=ignored", "ALBUM ARTIST=Orchestra",
+		});
+		MediaTags tags;
+		Momuma::TagArena arena;
+		REQUIRE(Momuma::parse_tags(file, tags, arena));
+		REQUIRE(tags.title == "Song");
+		REQUIRE(tags.artist == "Band");
+		REQUIRE(tags.albumArtist == "Orchestra");
+		REQUIRE(tags.album == "Record");
+		REQUIRE(tags.genre == "Jazz");
+		REQUIRE(tags.track == 7);
+		REQUIRE(tags.year == 1999);
+		REQUIRE(arena.empty());
+		REQUIRE(contains(file, tags.title));
+	}
+	
+	SECTION("Ogg Vorbis, with the comment header spanning two pages") {
+		// page: "OggS", version, flags, granule, serial, sequence, checksum, segment sizes, data
+		const auto page = [](const std::vector<uint8_t> &segments, const std::vector<uint8_t> &body) {
+			std::vector<uint8_t> bytes = { 'O', 'g', 'g', 'S', 0, 0 };
+			bytes.resize(bytes.size() + 8, 0);
+			append_le32(bytes, 1234);
+			bytes.resize(bytes.size() + 8, 0);
+			bytes.push_back(static_cast<uint8_t>(segments.size()));
+			bytes.insert(bytes.end(), segments.begin(), segments.end());
+			bytes.insert(bytes.end(), body.begin(), body.end());
+			return bytes;
+		};
+		std::vector<uint8_t> identification = { 1, 'v', 'o', 'r', 'b', 'i', 's' };
+		identification.resize(30, 0);
+		std::vector<uint8_t> comments = { 3, 'v', 'o', 'r', 'b', 'i', 's' };
+		const std::string title(300, 't');
+		const std::vector<uint8_t> block = make_vorbis_comments({ "TITLE=" + title, "ARTIST=Ogg" });
+		comments.insert(comments.end(), block.begin(), block.end());
+		comments.push_back(1); // framing bit
+		
+		std::vector<uint8_t> file = page({ 30 }, identification);
+		const std::vector<uint8_t> first(comments.begin(), comments.begin() + 255);
+		const std::vector<uint8_t> rest(comments.begin() + 255, comments.end());
+		for (const auto &bytes : { page({ 255 }, first), page({ uint8_t(rest.size()) }, rest) }) {
+			file.insert(file.end(), bytes.begin(), bytes.end());
+		}
+		
+		MediaTags tags;
+		Momuma::TagArena arena;
+		REQUIRE(Momuma::parse_tags(file, tags, arena));
+		REQUIRE(tags.title == title);
+		REQUIRE(tags.artist == "Ogg");
+	}
+	
+	SECTION("unsupported") {
+		const std::vector<uint8_t> garbage(4096, 0xFF);
+		MediaTags tags;
+		Momuma::TagArena arena;
+		REQUIRE_FALSE(Momuma::parse_tags(garbage, tags, arena));
+		REQUIRE_FALSE(Momuma::parse_tags({}, tags, arena));
+		REQUIRE(tags.title.empty());
+	}
+}
+
+TEST_CASE("media tags", "[tags]")
+{
+	using Momuma::Database::FileStamp;
+	auto db = make_database(Momuma::Database::StorageType::MEMORY);
+	
+	const fs::path root = fs::path(TESTING_PATH) / "tags";
+	fs::remove_all(root);
+	fs::create_directory(root);
+	const std::vector<fs::path> files = {
+		root / "a.flac", root / "b.flac", root / "untagged.mp3", root / "missing.mp3",
+	};
+	write_file(files[0], make_flac({ "TITLE=First", "ARTIST=Band", "ALBUM=Record", "TRACKNUMBER=1" }));
+	write_file(files[1], make_flac({ "TITLE=Second", "ARTIST=Band", "ALBUM=Record", "DATE=2001" }));
+	write_file(files[2], std::vector<uint8_t>(256, 0xFF));
+	
+	REQUIRE(Momuma::scan_media_tags(db, files, 2) == 3);
+	std::vector<FileStamp> stamps;
+	for (size_t i = 0; i < 3; ++i) {
+		stamps.push_back(FileStamp::of(files[i]).value());
+	}
+	
+	auto tags = db.get_media_tags(stamps);
+	REQUIRE(tags.size() == 3);
+	REQUIRE(tags[0].has_value());
+	REQUIRE(tags[0]->title == "First");
+	REQUIRE(tags[0]->artist == "Band");
+	REQUIRE(tags[0]->albumArtist == "Band");
+	REQUIRE(tags[0]->album == "Record");
+	REQUIRE(tags[0]->track == 1);
+	REQUIRE(tags[0]->year == 0);
+	REQUIRE(tags[1]->title == "Second");
+	REQUIRE(tags[1]->year == 2001);
+	REQUIRE(tags[2].has_value());
+	REQUIRE(tags[2]->title.empty());
+	REQUIRE(tags[2]->genre.empty());
+	
+	// artists and albums are shared
+	REQUIRE(query_text(db._handle, "SELECT COUNT(*) FROM artists;") == "1");
+	REQUIRE(query_text(db._handle, "SELECT COUNT(*) FROM albums;") == "1");
+	
+	// a modified file isn't found until it's scanned again
+	write_file(files[1], make_flac({ "TITLE=Renamed", "ARTIST=Other" }));
+	stamps[1] = FileStamp::of(files[1]).value();
+	REQUIRE_FALSE(db.get_media_tags(stamps)[1].has_value());
+	REQUIRE(Momuma::scan_media_tags(db, { files[1] }) == 1);
+	tags = db.get_media_tags(stamps);
+	REQUIRE(tags[1]->title == "Renamed");
+	REQUIRE(tags[1]->artist == "Other");
+	REQUIRE(tags[1]->album.empty());
+	REQUIRE(tags[0]->artist == "Band");
+	
+	// the names no file uses anymore are removed
+	const auto rescan = [&](const size_t i, const std::vector<std::string> &comments) {
+		write_file(files[i], make_flac(comments));
+		stamps[i] = FileStamp::of(files[i]).value();
+		REQUIRE(Momuma::scan_media_tags(db, { files[i] }) == 1);
+	};
+	rescan(0, { "TITLE=Alone", "ARTIST=Other", "GENRE=Jazz" });
+	REQUIRE(query_text(db._handle, "SELECT GROUP_CONCAT(name) FROM artists;") == "Other");
+	REQUIRE(query_text(db._handle, "SELECT COUNT(*) FROM albums;") == "0");
+	REQUIRE(query_text(db._handle, "SELECT COUNT(*) FROM genres;") == "1");
+	rescan(0, { "TITLE=Alone" });
+	REQUIRE(query_text(db._handle, "SELECT COUNT(*) FROM genres;") == "0");
+	
+	// the tracks of a compilation share the album of their album artist
+	rescan(0, { "ARTIST=Band", "ALBUMARTIST=Various", "ALBUM=Hits" });
+	rescan(1, { "ARTIST=Other", "ALBUMARTIST=Various", "ALBUM=Hits" });
+	tags = db.get_media_tags(stamps);
+	REQUIRE(tags[0]->artist == "Band");
+	REQUIRE(tags[1]->artist == "Other");
+	REQUIRE(tags[0]->albumArtist == "Various");
+	REQUIRE(tags[1]->albumArtist == "Various");
+	REQUIRE(query_text(db._handle, "SELECT COUNT(*) FROM albums;") == "1");
+	REQUIRE(query_text(db._handle, "SELECT COUNT(*) FROM artists;") == "3");
+	
+	// removing the album also removes its artist once no file uses it directly
+	rescan(0, { "ARTIST=Other" });
+	rescan(1, { "ARTIST=Other" });
+	REQUIRE(query_text(db._handle, "SELECT GROUP_CONCAT(name) FROM artists;") == "Other");
+	REQUIRE(query_text(db._handle, "SELECT COUNT(*) FROM albums;") == "0");
+}
+
+TEST_CASE("playlist fetch benchmark", "[.][benchmark]")
+{
+	using Momuma::Database::IterFlag;
+	auto db = make_database(Momuma::Database::StorageType::MEMORY);
+	spdlog::set_level(spdlog::level::info);
+	
+	REQUIRE(db.create_playlist("bench"));
+	fill_playlist(db, "bench", 100'000);
+	
+	BENCHMARK("get_media_paths (100k rows)") {
+		size_t bytes = 0;
+		db.get_media_paths("bench", [&bytes](fs::path path) {
+			bytes += path.native().size();
+			return IterFlag::NEXT;
+		});
+		return bytes;
+	};
+	
+	Momuma::Database::MediaBatch batch;
+	BENCHMARK("get_media_names (100k rows)") {
+		size_t bytes = 0;
+		db.get_media_names("bench", batch);
+		for (size_t i = 0; i < batch.size(); ++i) {
+			bytes += batch[i].size();
+		}
+		return bytes;
+	};
+}
+
+TEST_CASE("media window benchmark", "[.][benchmark]")
+{
+	auto db = make_database(Momuma::Database::StorageType::MEMORY);
+	spdlog::set_level(spdlog::level::info);
+	REQUIRE(db.create_playlist("bench"));
+	fill_playlist(db, "bench", 1'000'000);
+	
+	Momuma::Database::MediaBatch batch;
+	BENCHMARK("first page (50 of 1M rows)") {
+		return db.get_media_window("bench", 0, 50, batch);
+	};
+	BENCHMARK("middle page (50 of 1M rows)") {
+		return db.get_media_window("bench", 500'000, 50, batch);
+	};
+}
+
+TEST_CASE("full-text search benchmark", "[.][benchmark]")
+{
+	auto db = make_database(Momuma::Database::StorageType::MEMORY);
+	spdlog::set_level(spdlog::level::info);
+	REQUIRE(db.create_playlist("bench"));
+	fill_playlist(db, "bench", 1'000'000);
+	
+	std::vector<Momuma::Database::SearchHit> hits;
+	BENCHMARK("rare name (1M rows)") {
+		return db.search_media("track 123456", 50, hits);
+	};
+	BENCHMARK("common name, top 50 (1M rows)") {
+		return db.search_media("track 12", 50, hits);
+	};
+}
+
+TEST_CASE("media tag scan benchmark", "[.][benchmark]")
+{
+	auto db = make_database(Momuma::Database::StorageType::MEMORY);
+	spdlog::set_level(spdlog::level::info);
+	
+	const fs::path root = fs::path(TESTING_PATH) / "tag_bench";
+	fs::remove_all(root);
+	fs::create_directory(root);
+	std::vector<fs::path> files;
+	for (int i = 0; i < 2000; ++i) {
+		files.push_back(root / fmt::format("{:04d}.flac", i));
+		std::vector<uint8_t> flac = make_flac({
+			fmt::format("TITLE=Track {:d}", i), fmt::format("ARTIST=Artist {:d}", i % 50),
+			fmt::format("ALBUM=Album {:d}", i % 200), fmt::format("TRACKNUMBER={:d}", i % 10),
+		});
+		flac.resize(flac.size() + 64 * 1024); // audio, never read
+		write_file(files.back(), flac);
+	}
+	
+	BENCHMARK("scan_media_tags (2000 files, 1 thread)") {
+		return Momuma::scan_media_tags(db, files, 1);
+	};
+	BENCHMARK("scan_media_tags (2000 files, all cores)") {
+		return Momuma::scan_media_tags(db, files);
+	};
+}
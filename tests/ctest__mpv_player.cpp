@@ -1,7 +1,23 @@
+#include <algorithm>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <memory>
 #include <momuma/spdlog.h>
+#include <momuma/spsc_ring.h>
+#include <stop_token>
+#include <thread>
 
 #include "catch2_main.h"
+#include "Database-Sqlite3.h"
+#include "DurationReader.h"
+#include "DurationScanner.h"
+#include "EventDispatcher.h"
+#include "HistoryRecorder.h"
+#include "PlaylistLoader.h"
+#include "PositionStream.h"
 #include "MpvPlayer.h"
+#include "PlayerReactor.h"
 
 
 const std::array<fs::path, 2> TEST_MEDIA = {
@@ -40,6 +56,175 @@ TEST_CASE("Query media duration", "[query, play]")
 	REQUIRE(test_query_duration(TEST_MEDIA[1], fsec(213), fsec(214)));
 }
 
+// `count` paths alternating between all of `TEST_MEDIA`.
+[[nodiscard]] static
+std::vector<fs::path> make_media_batch(const size_t count)
+{
+	std::vector<fs::path> batch;
+	for (size_t i = 0; i < count; ++i) {
+		batch.push_back(TEST_MEDIA[i % TEST_MEDIA.size()]);
+	}
+	return batch;
+}
+
+// matches the ranges checked by "Query media duration"
+[[nodiscard]] static
+bool is_expected_duration(const Momuma::DurationScanner::Result &result)
+{
+	using fsec = chrono::duration<double>;
+	if (result.media == TEST_MEDIA[0]) {
+		return fsec(1.8) < result.duration && result.duration <= fsec(1.9);
+	}
+	return fsec(213) < result.duration && result.duration <= fsec(214);
+}
+
+TEST_CASE("Parallel duration scan", "[query, scan]")
+{
+	Momuma::DurationScanner scanner(4);
+	REQUIRE(scanner.worker_count() == 4);
+	
+	std::vector<fs::path> batch = make_media_batch(12);
+	batch.push_back(fs::path(TESTING_PATH) / "missing.mp3");
+	
+	size_t failures = 0;
+	const size_t count = scanner.scan(batch, [&](const Momuma::DurationScanner::Result &result) {
+		if (result.duration < chrono::microseconds::zero()) {
+			REQUIRE(result.media == batch.back());
+			++failures;
+		}
+		else {
+			REQUIRE(is_expected_duration(result));
+		}
+	});
+	REQUIRE(count == batch.size());
+	REQUIRE(failures == 1);
+	REQUIRE(scanner.pending() == 0);
+	REQUIRE_FALSE(scanner.wait_result(chrono::milliseconds(1)).has_value());
+	
+	// concurrent scans only receive the results of their own files
+	std::array<std::vector<fs::path>, 2> received;
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < received.size(); ++i) {
+		threads.emplace_back([&scanner, &received, i] {
+			const std::vector<fs::path> own(20, TEST_MEDIA[i]);
+			(void)scanner.scan(own, [&received, i](const Momuma::DurationScanner::Result &result) {
+				received[i].push_back(result.media);
+			});
+		});
+	}
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+	for (size_t i = 0; i < received.size(); ++i) {
+		REQUIRE(received[i] == std::vector<fs::path>(20, TEST_MEDIA[i]));
+	}
+}
+
+TEST_CASE("Probe deadline and cancellation", "[query, probe]")
+{
+	using fsec = chrono::duration<double>;
+	mpv_error err;
+	Momuma::MpvPlayer player(err, Momuma::MpvPlayer::Mode::PROBE);
+	REQUIRE(err == MPV_ERROR_SUCCESS);
+	
+	// no time left, or a stop requested beforehand, fail without waiting
+	REQUIRE(player.probe_duration(TEST_MEDIA[1], chrono::microseconds(0)).count() == -1);
+	std::stop_source stopped;
+	stopped.request_stop();
+	const auto cancelled =
+		player.probe_duration(TEST_MEDIA[1], chrono::seconds(5), stopped.get_token());
+	REQUIRE(cancelled.count() == -1);
+	
+	// gives up while the file is opening, its events are left for the next probe
+	(void)player.probe_duration(TEST_MEDIA[1], chrono::milliseconds(1));
+	
+	// the abandoned loads don't disturb the next probe
+	const chrono::microseconds duration = player.probe_duration(TEST_MEDIA[0], chrono::seconds(5));
+	REQUIRE(fsec(1.8) < duration);
+	REQUIRE(duration <= fsec(1.9));
+	
+	// a stop requested by another thread interrupts the wait
+	std::stop_source source;
+	std::thread stopper([&source] {
+		std::this_thread::sleep_for(chrono::milliseconds(50));
+		source.request_stop();
+	});
+	const auto start = chrono::steady_clock::now();
+	(void)player.probe_duration(TEST_MEDIA[1], chrono::microseconds(-1), source.get_token());
+	stopper.join();
+	REQUIRE(chrono::steady_clock::now() - start < chrono::seconds(5));
+}
+
+TEST_CASE("Header duration", "[query, header]")
+{
+	using fsec = chrono::duration<double>;
+	
+	// agrees with mpv, within a frame
+	for (const fs::path &media : TEST_MEDIA) {
+		const std::optional<chrono::microseconds> header = Momuma::read_header_duration(media);
+		REQUIRE(header.has_value());
+		const chrono::microseconds probed = Momuma::MpvPlayer::query_duration(media);
+		REQUIRE(chrono::abs(*header - probed) < chrono::milliseconds(30));
+	}
+	REQUIRE(Momuma::read_duration(TEST_MEDIA[0]) > fsec(1.8));
+	
+	// 1 s of 16-bit stereo PCM at 8 kHz, the data chunk follows an unknown chunk
+	std::vector<uint8_t> wav = {
+		'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E',
+		'f', 'm', 't', ' ', 16, 0, 0, 0,
+		1, 0, 2, 0, 0x40, 0x1F, 0, 0, 0x00, 0x7D, 0, 0, 4, 0, 16, 0,
+		'L', 'I', 'S', 'T', 3, 0, 0, 0, 'a', 'b', 'c', 0,
+		'd', 'a', 't', 'a', 0x00, 0x7D, 0, 0,
+	};
+	wav.resize(wav.size() + 32000);
+	REQUIRE(Momuma::parse_header_duration(wav) == chrono::seconds(1));
+	
+	// 96000 samples at 48 kHz
+	std::vector<uint8_t> flac = { 'f', 'L', 'a', 'C', 0x80, 0, 0, 34 };
+	flac.resize(flac.size() + 34);
+	const std::array<uint8_t, 8> streamInfo = { 0x0B, 0xB8, 0x01, 0xF0, 0x00, 0x01, 0x77, 0x00 };
+	std::copy(streamInfo.begin(), streamInfo.end(), flac.begin() + 8 + 10);
+	REQUIRE(Momuma::parse_header_duration(flac) == chrono::seconds(2));
+	
+	const std::vector<uint8_t> garbage(4096, 0xFF);
+	REQUIRE_FALSE(Momuma::parse_header_duration(garbage).has_value());
+	REQUIRE_FALSE(Momuma::read_header_duration(fs::path(TESTING_PATH) / "missing.mp3"));
+}
+
+TEST_CASE("Header duration benchmark", "[.][benchmark]")
+{
+	BENCHMARK("read_header_duration") {
+		return Momuma::read_header_duration(TEST_MEDIA[1])->count();
+	};
+	BENCHMARK("MpvPlayer::query_duration") {
+		return Momuma::MpvPlayer::query_duration(TEST_MEDIA[1]).count();
+	};
+}
+
+TEST_CASE("Duration scan benchmark", "[.][benchmark]")
+{
+	const std::vector<fs::path> batch = make_media_batch(64);
+	
+	BENCHMARK("query_duration x64 (serial)") {
+		int64_t total = 0;
+		for (const fs::path &media : batch) {
+			total += Momuma::MpvPlayer::query_duration(media).count();
+		}
+		return total;
+	};
+	
+	for (const unsigned workers : { 1u, 2u, 4u, 8u }) {
+		Momuma::DurationScanner scanner(workers);
+		BENCHMARK(fmt::format("DurationScanner x64 ({:d} workers)", workers)) {
+			int64_t total = 0;
+			scanner.scan(batch, [&total](const Momuma::DurationScanner::Result &result) {
+				total += result.duration.count();
+			});
+			return total;
+		};
+	}
+}
+
 TEST_CASE("Append track and play", "[play, append]")
 {
 	auto player = make_player();
@@ -47,3 +232,846 @@ TEST_CASE("Append track and play", "[play, append]")
 	player.set_play(true);
 	sleep(2);
 }
+
+TEST_CASE("Move player", "[play]")
+{
+	auto player = make_player();
+	Momuma::MpvPlayer moved(std::move(player));
+	REQUIRE_FALSE(static_cast<bool>(player));
+	REQUIRE(static_cast<bool>(moved));
+	
+	// clients are moved into the vector, the temporaries don't destroy their handle
+	std::vector<Momuma::MpvPlayer> clients;
+	for (int i = 0; i < 4; ++i) {
+		clients.push_back(moved.create_client());
+	}
+	for (const Momuma::MpvPlayer &client : clients) {
+		REQUIRE(static_cast<bool>(client));
+	}
+	
+	player = std::move(moved);
+	REQUIRE_FALSE(static_cast<bool>(moved));
+	check_mpv_error(player.set_media(TEST_MEDIA[0]));
+	REQUIRE(player.get<Momuma::Prop::Pause>().value);
+}
+
+TEST_CASE("Observed property cache", "[play, state]")
+{
+	using State = Momuma::MpvPlayer::State;
+	auto player = make_player();
+	REQUIRE(player.get_state() == State::STOP);
+	
+	// modifications are visible before their change events were received
+	check_mpv_error(player.append_media(TEST_MEDIA[0]));
+	check_mpv_error(player.append_media(TEST_MEDIA[1]));
+	REQUIRE(player.playlist_size() == 2);
+	REQUIRE(player.get_state() == State::PAUSE);
+	
+	std::vector<std::pair<State, State>> transitions;
+	player.signal_stateChanged.connect([&](Momuma::MpvPlayer&, State prev, State next) {
+		transitions.emplace_back(prev, next);
+	});
+	
+	player.set_play(true);
+	REQUIRE_FALSE(player.is_paused());
+	while (player.wait_event(chrono::seconds(5))->event_id != MPV_EVENT_PLAYBACK_RESTART) {}
+	REQUIRE(player.get_index() == 0);
+	
+	mpv_error err;
+	REQUIRE(player.get_position(err) >= chrono::microseconds::zero());
+	REQUIRE(err == MPV_ERROR_SUCCESS);
+	REQUIRE(transitions.size() == 1);
+	REQUIRE(transitions[0] == std::pair(State::STOP, State::PLAY));
+	
+	// change events queued before a set don't overwrite it
+	player.set_play(false);
+	player.set_play(true);
+	for (int i = 0; i < 100; ++i) {
+		if (player.wait_event(chrono::milliseconds(100))->event_id == MPV_EVENT_NONE) {
+			break;
+		}
+		REQUIRE_FALSE(player.is_paused());
+	}
+	REQUIRE_FALSE(player.is_paused());
+}
+
+// A coroutine which starts right away and isn't awaited.
+struct DetachedTask
+{
+	struct promise_type
+	{
+		DetachedTask get_return_object(void) { return {}; }
+		std::suspend_never initial_suspend(void) noexcept { return {}; }
+		std::suspend_never final_suspend(void) noexcept { return {}; }
+		void return_void(void) {}
+		void unhandled_exception(void) { std::terminate(); }
+	};
+};
+
+// the results are checked by the caller, GCC 12 can't compile Catch2 assertions in coroutines
+static DetachedTask load_and_count(
+	Momuma::MpvPlayer &player, mpv_error &loadError, Momuma::PropertyReply<int64_t> &count,
+	bool &done
+) {
+	loadError = co_await player.command_async(std::array{ "loadfile", TEST_MEDIA[0].c_str() });
+	count = co_await player.get_property_async<int64_t>("playlist-count");
+	done = true;
+}
+
+static DetachedTask pause_and_wait(Momuma::MpvPlayer &player, bool &done)
+{
+	(void)co_await player.command_async(std::array{ "set", "pause", "yes" });
+	player.wait_event(chrono::milliseconds(10));
+	done = true;
+}
+
+TEST_CASE("Asynchronous commands and properties", "[async]")
+{
+	auto player = make_player();
+	
+	// several requests in flight at once, read through futures
+	auto append1 = player.command_async(std::array{ "loadfile", TEST_MEDIA[0].c_str(), "append" });
+	auto append2 = player.command_async(std::array{ "loadfile", TEST_MEDIA[1].c_str(), "append" });
+	auto count = player.get_property_async<int64_t>("playlist-count");
+	auto paused = player.get_property_async<bool>("pause");
+	auto missing = player.get_property_async<std::string>("no-such-property");
+	auto countFuture = count.get_future();
+	
+	while (!(append1.ready() && append2.ready() && count.ready() && paused.ready()
+		&& missing.ready())
+	) {
+		player.wait_event(chrono::seconds(1));
+	}
+	REQUIRE(append1.get_future().get() == MPV_ERROR_SUCCESS);
+	REQUIRE(append2.get_future().get() == MPV_ERROR_SUCCESS);
+	REQUIRE(countFuture.get().value == 2);
+	REQUIRE(paused.get_future().get().value);
+	REQUIRE(missing.get_future().get().error == MPV_ERROR_PROPERTY_NOT_FOUND);
+	
+	// awaited by a coroutine, resumed by `wait_event()`
+	mpv_error loadError = MPV_ERROR_GENERIC;
+	Momuma::PropertyReply<int64_t> playlistCount { MPV_ERROR_GENERIC, -1 };
+	bool done = false;
+	load_and_count(player, loadError, playlistCount, done);
+	while (!done) {
+		player.wait_event(chrono::seconds(1));
+	}
+	REQUIRE(loadError == MPV_ERROR_SUCCESS);
+	REQUIRE(playlistCount.error == MPV_ERROR_SUCCESS);
+	REQUIRE(playlistCount.value == 1);
+	
+	// a coroutine waiting for events itself is only resumed once its reply was returned
+	bool waited = false;
+	pause_and_wait(player, waited);
+	const mpv_event *reply;
+	do {
+		reply = player.wait_event(chrono::seconds(1));
+	} while (reply->event_id != MPV_EVENT_COMMAND_REPLY);
+	REQUIRE_FALSE(waited);
+	while (!waited) {
+		player.wait_event(chrono::seconds(1));
+	}
+	
+	// requests still waiting on destruction fail
+	auto pending = player.command_async(std::array{ "loadfile", TEST_MEDIA[1].c_str() });
+	auto pendingFuture = pending.get_future();
+	player.destroy();
+	REQUIRE(pendingFuture.get() == MPV_ERROR_GENERIC);
+}
+
+TEST_CASE("Single producer single consumer ring", "[dispatcher]")
+{
+	constexpr uint64_t COUNT = 1'000'000;
+	auto ring = std::make_unique<Momuma::SpscRing<uint64_t, 256>>();
+	REQUIRE_FALSE(ring->try_pop().has_value());
+	REQUIRE(ring->try_push(7));
+	REQUIRE(ring->try_pop() == 7);
+	
+	for (uint64_t i = 0; i < ring->capacity(); ++i) {
+		REQUIRE(ring->try_push(i));
+	}
+	REQUIRE_FALSE(ring->try_push(0));
+	REQUIRE(ring->size() == ring->capacity());
+	for (uint64_t i = 0; i < ring->capacity(); ++i) {
+		REQUIRE(ring->try_pop() == i);
+	}
+	
+	std::thread producer([&ring] {
+		for (uint64_t i = 0; i < COUNT; ++i) {
+			while (!ring->try_push(i)) {
+				std::this_thread::yield();
+			}
+		}
+	});
+	
+	// values arrive complete and in order
+	uint64_t expected = 0;
+	std::array<uint64_t, 32> batch;
+	while (expected < COUNT) {
+		const size_t count = ring->pop_batch(batch.data(), batch.size());
+		for (size_t i = 0; i < count; ++i) {
+			REQUIRE(batch[i] == expected);
+			++expected;
+		}
+	}
+	producer.join();
+	REQUIRE(ring->size() == 0);
+}
+
+TEST_CASE("Event dispatcher thread", "[dispatcher]")
+{
+	using Record = Momuma::EventDispatcher::Record;
+	auto player = make_player();
+	Momuma::EventDispatcher dispatcher(player);
+	REQUIRE(static_cast<bool>(dispatcher));
+	REQUIRE(dispatcher.notify_fd() >= 0);
+	
+	check_mpv_error(player.append_media(TEST_MEDIA[0]));
+	player.set_play(true);
+	
+	std::vector<Record> records;
+	const auto loaded = [&records] {
+		return std::any_of(records.begin(), records.end(), [](const Record &record) {
+			return record.id == MPV_EVENT_FILE_LOADED;
+		});
+	};
+	while (!loaded()) {
+		REQUIRE(dispatcher.wait(chrono::seconds(5)));
+		dispatcher.drain([&records](const Record &record) { records.push_back(record); });
+	}
+	
+	const auto start = std::find_if(records.begin(), records.end(), [](const Record &record) {
+		return record.id == MPV_EVENT_START_FILE;
+	});
+	REQUIRE(start != records.end());
+	REQUIRE(start->entryId >= 0);
+	REQUIRE(records.back().state == Momuma::MpvPlayer::State::PLAY);
+	REQUIRE(player.get_index() == 0);
+	
+	// nothing is left once drained
+	REQUIRE(dispatcher.drain([](const Record&) {}) == 0);
+}
+
+TEST_CASE("Event mask", "[events]")
+{
+	using Momuma::MpvEventMask;
+	using Momuma::mpv_event_bit;
+	auto player = make_player();
+	REQUIRE(player.get_event_mask() == MpvEventMask::ALL);
+	REQUIRE(player.connected_events() == Momuma::MpvPlayer::REQUIRED_EVENTS);
+	
+	player.signal_streamStarted.connect([](Momuma::MpvPlayer&) {});
+	const MpvEventMask connected = player.connected_events();
+	REQUIRE((connected & mpv_event_bit(MPV_EVENT_FILE_LOADED)) != MpvEventMask::NONE);
+	REQUIRE((connected & mpv_event_bit(MPV_EVENT_SEEK)) == MpvEventMask::NONE);
+	
+	player.set_event_mask(connected);
+	REQUIRE(player.get_event_mask() == connected);
+	
+	// disabled events aren't generated anymore
+	check_mpv_error(player.append_media(TEST_MEDIA[0]));
+	mpv_event_id id = MPV_EVENT_NONE;
+	do {
+		id = player.wait_event(chrono::seconds(5))->event_id;
+		REQUIRE(id != MPV_EVENT_START_FILE);
+		REQUIRE(id != MPV_EVENT_NONE);
+	} while (id != MPV_EVENT_FILE_LOADED);
+	
+	player.set_event_mask(MpvEventMask::ALL);
+	REQUIRE((player.get_event_mask() & mpv_event_bit(MPV_EVENT_SEEK)) != MpvEventMask::NONE);
+}
+
+TEST_CASE("Event mask benchmark", "[.][benchmark]")
+{
+	// every broadcast `script-message` makes one command reply and one client message
+	constexpr int MESSAGES = 1000;
+	// requests in flight at once, as mpv's event queue only holds 1000 events
+	constexpr int BATCH = 100;
+	struct Broadcast
+	{
+		int delivered = 0;
+		int events = 0;
+	};
+	const auto broadcast = [](Momuma::MpvPlayer &player) {
+		const std::array cmd = { "script-message", "benchmark" };
+		Broadcast result;
+		std::vector<Momuma::MpvRequest<mpv_error>> requests;
+		requests.reserve(BATCH);
+		for (int sent = 0; sent < MESSAGES; sent += BATCH) {
+			for (int i = 0; i < BATCH; ++i) {
+				requests.push_back(player.command_async(cmd));
+			}
+			for (const auto &request : requests) {
+				while (!request.ready()) {
+					REQUIRE(player.wait_event(chrono::seconds(5))->event_id != MPV_EVENT_NONE);
+					++result.events;
+				}
+			}
+			for (auto &request : requests) {
+				result.delivered += (request.get_future().get() == MPV_ERROR_SUCCESS);
+			}
+			requests.clear();
+		}
+		return result;
+	};
+	
+	auto all = make_player();
+	auto connected = make_player();
+	connected.set_event_mask(connected.connected_events());
+	const Broadcast allResult = broadcast(all);
+	const Broadcast connectedResult = broadcast(connected);
+	REQUIRE(allResult.delivered == MESSAGES);
+	REQUIRE(connectedResult.delivered == MESSAGES);
+	SPDLOG_INFO("Events per {:d} messages: {:d} (all) | {:d} (connected)",
+		MESSAGES, allResult.events, connectedResult.events
+	);
+	
+	BENCHMARK("1000 messages (all events)") {
+		return broadcast(all).events;
+	};
+	BENCHMARK("1000 messages (connected events)") {
+		return broadcast(connected).events;
+	};
+}
+
+// waits for the reply of `request` on the calling thread
+template<typename T>
+[[nodiscard]] static T wait_reply(Momuma::MpvPlayer &player, Momuma::MpvRequest<T> request)
+{
+	while (!request.ready()) {
+		player.wait_event(chrono::seconds(1));
+	}
+	return request.get_future().get();
+}
+
+TEST_CASE("Bulk append", "[play, append]")
+{
+	auto player = make_player();
+	
+	// names which can't be a playlist line are loaded on their own, keeping the order
+	const std::vector<fs::path> media = {
+		TEST_MEDIA[0], "/tmp/line\nbreak.mp3", TEST_MEDIA[1], "/tmp/spaced.mp3 ", TEST_MEDIA[0],
+	};
+	check_mpv_error(player.append_media(media));
+	REQUIRE(player.playlist_size() == 5);
+	check_mpv_error(player.append_media(std::span(TEST_MEDIA)));
+	REQUIRE(player.playlist_size() == 7);
+	
+	const auto filename = [&player](const int index) {
+		const std::string name = fmt::format("playlist/{:d}/filename", index);
+		return wait_reply(player, player.get_property_async<std::string>(name.c_str())).value;
+	};
+	REQUIRE(filename(0) == TEST_MEDIA[0]);
+	REQUIRE(filename(1) == "/tmp/line\nbreak.mp3");
+	REQUIRE(filename(2) == TEST_MEDIA[1]);
+	REQUIRE(filename(3) == "/tmp/spaced.mp3 ");
+	REQUIRE(filename(6) == TEST_MEDIA[1]);
+	
+	check_mpv_error(player.append_media(std::span<const fs::path>()));
+	REQUIRE(player.playlist_size() == 7);
+}
+
+TEST_CASE("Playlist snapshot", "[play, snapshot]")
+{
+	auto player = make_player();
+	Momuma::PlaylistSnapshot previous, snapshot;
+	check_mpv_error(player.get_playlist(previous));
+	REQUIRE(previous.empty());
+	
+	check_mpv_error(player.append_media(std::span(TEST_MEDIA)));
+	check_mpv_error(player.get_playlist(snapshot));
+	REQUIRE(snapshot.size() == 2);
+	REQUIRE(snapshot.filename(0) == TEST_MEDIA[0].native());
+	REQUIRE(snapshot.filename(1) == TEST_MEDIA[1].native());
+	REQUIRE(snapshot.entries[0].id != snapshot.entries[1].id);
+	
+	Momuma::PlaylistDiff diff = snapshot.diff(previous);
+	REQUIRE(diff.position == 0);
+	REQUIRE(diff.removed == 0);
+	REQUIRE(diff.added == 2);
+	REQUIRE(diff.updated.empty());
+	REQUIRE(snapshot.diff(snapshot).empty());
+	
+	// appending only adds rows, switching entries only updates the flags of both
+	std::swap(previous, snapshot);
+	check_mpv_error(player.append_media(TEST_MEDIA[0]));
+	check_mpv_error(player.get_playlist(snapshot));
+	diff = snapshot.diff(previous);
+	REQUIRE(diff.position == 2);
+	REQUIRE(diff.removed == 0);
+	REQUIRE(diff.added == 1);
+	
+	std::swap(previous, snapshot);
+	player.set_index(1);
+	check_mpv_error(player.get_playlist(snapshot));
+	REQUIRE(snapshot.entries[1].current);
+	REQUIRE_FALSE(snapshot.entries[2].current);
+	diff = snapshot.diff(previous);
+	REQUIRE(diff.removed == 0);
+	REQUIRE(diff.added == 0);
+	REQUIRE(std::ranges::find(diff.updated, size_t(1)) != diff.updated.end());
+	REQUIRE(std::ranges::find(diff.updated, size_t(2)) == diff.updated.end());
+	
+	// a removed entry is replaced by nothing
+	std::swap(previous, snapshot);
+	check_mpv_error(wait_reply(player, player.command_async(std::array{ "playlist-remove", "2" })));
+	check_mpv_error(player.get_playlist(snapshot));
+	diff = snapshot.diff(previous);
+	REQUIRE(diff.position == 2);
+	REQUIRE(diff.removed == 1);
+	REQUIRE(diff.added == 0);
+}
+
+TEST_CASE("Bulk append benchmark", "[.][benchmark]")
+{
+	const std::vector<fs::path> media = make_media_batch(10'000);
+	auto player = make_player();
+	
+	BENCHMARK("append_media x10k (loop)") {
+		player.stop_playback();
+		for (const fs::path &path : media) {
+			(void)player.append_media(path);
+		}
+		return player.playlist_size();
+	};
+	BENCHMARK("append_media x10k (bulk)") {
+		player.stop_playback();
+		(void)player.append_media(media);
+		return player.playlist_size();
+	};
+}
+
+TEST_CASE("Playlist snapshot benchmark", "[.][benchmark]")
+{
+	const std::vector<fs::path> media = make_media_batch(10'000);
+	auto player = make_player();
+	(void)player.append_media(media);
+	
+	BENCHMARK("playlist x10k (per entry)") {
+		size_t bytes = 0;
+		const int64_t count = player.playlist_size();
+		for (int64_t i = 0; i < count; ++i) {
+			const std::string name = fmt::format("playlist/{:d}/filename", i);
+			char *filename = mpv_get_property_string(player._ctx, name.c_str());
+			bytes += std::string_view(filename).size();
+			mpv_free(filename);
+		}
+		return bytes;
+	};
+	Momuma::PlaylistSnapshot snapshot;
+	BENCHMARK("playlist x10k (snapshot)") {
+		(void)player.get_playlist(snapshot);
+		return snapshot.arena.size();
+	};
+	Momuma::PlaylistSnapshot previous = snapshot;
+	BENCHMARK("playlist x10k (diff)") {
+		return snapshot.diff(previous).updated.size();
+	};
+}
+
+// an in-memory database holding `playlist`, made of `count` tracks alternating `TEST_MEDIA`
+[[nodiscard]] static
+Momuma::Database::Sqlite3 make_playlist_database(const std::string &playlist, size_t count)
+{
+	Momuma::Database::Sqlite3 db(TESTING_PATH, Momuma::Database::StorageType::MEMORY);
+	REQUIRE(static_cast<bool>(db));
+	REQUIRE(db.create_playlist(playlist));
+	REQUIRE(db.set_playlist_data(playlist, make_media_batch(count)));
+	return db;
+}
+
+// waits until `player` starts outputting audio
+static void wait_playback(Momuma::MpvPlayer &player)
+{
+	while (player.wait_event(chrono::seconds(5))->event_id != MPV_EVENT_PLAYBACK_RESTART) {}
+}
+
+TEST_CASE("Playlist loader", "[play, loader]")
+{
+	auto db = make_playlist_database("list", 2500);
+	auto player = make_player();
+	Momuma::PlaylistLoader loader(db, player, 1000);
+	
+	REQUIRE_FALSE(loader.load("missing"));
+	REQUIRE(player.playlist_size() == 0);
+	
+	REQUIRE(loader.load("list"));
+	REQUIRE(loader.queued() >= 1);
+	wait_playback(player);
+	REQUIRE(player.get_index() == 0);
+	
+	REQUIRE(loader.wait_loaded(chrono::seconds(30)));
+	REQUIRE(loader.queued() == 2500);
+	REQUIRE(player.playlist_size() == 2500);
+	
+	// loading again replaces the queue, even while the previous load is in progress
+	REQUIRE(loader.load("list", false));
+	REQUIRE(loader.load("list", false));
+	REQUIRE(loader.wait_loaded(chrono::seconds(30)));
+	REQUIRE(player.playlist_size() == 2500);
+	REQUIRE(player.is_paused());
+	
+	// replacing the playlist meanwhile stops the loader, at most one more page is appended
+	auto bigDb = make_playlist_database("big", 20'000);
+	Momuma::PlaylistLoader smallPages(bigDb, player, 50);
+	REQUIRE(smallPages.load("big", false));
+	check_mpv_error(player.set_media(TEST_MEDIA[0]));
+	REQUIRE(smallPages.wait_loaded(chrono::seconds(30)));
+	REQUIRE(smallPages.queued() < 20'000);
+	REQUIRE(player.playlist_size() <= 51);
+}
+
+// `P` can be written by `MpvPlayer::set()` with a `V`
+template<typename P, typename V>
+concept settable = requires(Momuma::MpvPlayer &player, V value) { player.set<P>(value); };
+
+static_assert(settable<Momuma::Prop::Volume, double>);
+static_assert(!settable<Momuma::Prop::Duration, chrono::microseconds>);
+static_assert(!settable<Momuma::Prop::Path, std::string>);
+static_assert(!settable<Momuma::Prop::Volume, std::string>);
+static_assert(std::same_as<
+	decltype(std::declval<Momuma::MpvPlayer&>().get<Momuma::Prop::PlaylistPos>().value), int64_t
+>);
+
+TEST_CASE("Typed properties", "[play, property]")
+{
+	namespace Prop = Momuma::Prop;
+	using Observed = Momuma::PropertyList<Prop::Volume, Prop::Mute>;
+	static_assert(Observed::index_of<Prop::Mute>() == 1);
+	constexpr uint64_t OBSERVED_ID = 42;
+	auto player = make_player();
+	
+	check_mpv_error(player.set<Prop::Volume>(50.0));
+	auto volume = player.get<Prop::Volume>();
+	check_mpv_error(volume.error);
+	REQUIRE(volume.value == 50.0);
+	check_mpv_error(player.set<Prop::Mute>(true));
+	REQUIRE(player.get<Prop::Mute>().value);
+	check_mpv_error(player.set<Prop::GaplessAudio>("yes"));
+	REQUIRE(player.get<Prop::GaplessAudio>().value == "yes");
+	REQUIRE(player.get<Prop::Path>().error != MPV_ERROR_SUCCESS);
+	
+	// the current values are received first, by their position in the list
+	std::vector<uint64_t> changed;
+	player.signal_eventPropertyChange.connect([&changed](uint64_t id, mpv_event_property&) {
+		changed.push_back(id);
+	});
+	check_mpv_error(player.observe(Observed(), OBSERVED_ID));
+	while (std::ranges::count(changed, OBSERVED_ID + Observed::index_of<Prop::Mute>()) == 0) {
+		REQUIRE(player.wait_event(chrono::seconds(5))->event_id != MPV_EVENT_NONE);
+	}
+	REQUIRE(std::ranges::count(changed, OBSERVED_ID + Observed::index_of<Prop::Volume>()) == 1);
+	
+	// the asynchronous version converts the same way
+	check_mpv_error(player.append_media(TEST_MEDIA[0]));
+	player.set_play(true);
+	wait_playback(player);
+	const auto duration = wait_reply(player, player.get_async<Prop::Duration>());
+	check_mpv_error(duration.error);
+	REQUIRE(duration.value > chrono::microseconds::zero());
+	REQUIRE(duration.value == player.get<Prop::Duration>().value);
+}
+
+TEST_CASE("Position stream", "[play, position]")
+{
+	Momuma::Database::Sqlite3 db(TESTING_PATH, Momuma::Database::StorageType::MEMORY);
+	REQUIRE(static_cast<bool>(db));
+	auto player = make_player();
+	const auto play_for = [&player](const chrono::milliseconds duration) {
+		const auto end = chrono::steady_clock::now() + duration;
+		while (chrono::steady_clock::now() < end) {
+			player.wait_event(chrono::milliseconds(20));
+		}
+	};
+	
+	// `time-pos` changes many times per second, they're merged down to the stream's rate
+	std::vector<chrono::microseconds> positions;
+	{
+		Momuma::PositionStream stream(player, chrono::milliseconds(200));
+		stream.signal_position.connect([&positions](const chrono::microseconds position) {
+			positions.push_back(position);
+		});
+		check_mpv_error(player.set_media(TEST_MEDIA[1]));
+		player.set_play(true);
+		play_for(chrono::seconds(2));
+	}
+	REQUIRE(positions.size() >= 5);
+	REQUIRE(positions.size() <= 14);
+	REQUIRE(std::ranges::is_sorted(positions));
+	
+	// long media starts again where it was left, written when the stream is destroyed
+	Momuma::PositionStream::ResumeOptions options;
+	options.minDuration = chrono::seconds(5);
+	options.endMargin = chrono::seconds(1);
+	{
+		Momuma::PositionStream stream(player, chrono::milliseconds(200), db, options);
+		check_mpv_error(player.set_media(TEST_MEDIA[1]));
+		player.set_play(true);
+		wait_playback(player);
+		check_mpv_error(player.set_position(chrono::seconds(30)));
+		for (int i = 0; i < 100 && stream.position() < chrono::seconds(30); ++i) {
+			play_for(chrono::milliseconds(50));
+		}
+		REQUIRE(stream.position() >= chrono::seconds(30));
+		REQUIRE_FALSE(db.get_resume_point(TEST_MEDIA[1]).has_value());
+	}
+	REQUIRE(db.get_resume_point(TEST_MEDIA[1]).value_or(chrono::seconds(0)) >= chrono::seconds(30));
+	
+	{
+		Momuma::PositionStream stream(player, chrono::milliseconds(200), db, options);
+		check_mpv_error(player.set_media(TEST_MEDIA[1]));
+		wait_playback(player);
+		mpv_error err;
+		REQUIRE(player.get_position(err) >= chrono::seconds(29));
+		check_mpv_error(err);
+	}
+}
+
+TEST_CASE("History recorder", "[play, history]")
+{
+	using Kind = Momuma::Database::PlayEvent::Kind;
+	Momuma::Database::Sqlite3 db(TESTING_PATH, Momuma::Database::StorageType::MEMORY);
+	REQUIRE(static_cast<bool>(db));
+	auto player = make_player();
+	
+	std::vector<Momuma::Database::PlayEvent> history;
+	{
+		Momuma::HistoryRecorder recorder(db);
+		recorder.attach(player);
+		
+		// the short media reaches its end, the long one is replaced right after starting
+		check_mpv_error(player.set_media(TEST_MEDIA[0]));
+		check_mpv_error(player.append_media(TEST_MEDIA[1]));
+		player.set_play(true);
+		while (player.get_index() != 1) {
+			REQUIRE(player.wait_event(chrono::seconds(5)) != nullptr);
+		}
+		wait_playback(player);
+		check_mpv_error(player.set_media(TEST_MEDIA[0]));
+		wait_playback(player);
+		recorder.detach(player);
+		
+		REQUIRE(recorder.flush(chrono::seconds(5)));
+		REQUIRE(recorder.dropped() == 0);
+	}
+	REQUIRE(db.get_play_history(10, history) == 2);
+	REQUIRE(history[0].path == TEST_MEDIA[1]);
+	REQUIRE(history[0].kind == Kind::SKIPPED);
+	REQUIRE(history[1].path == TEST_MEDIA[0]);
+	REQUIRE(history[1].kind == Kind::PLAYED);
+	
+	const auto stats = db.get_play_stats({ TEST_MEDIA[0], TEST_MEDIA[1] });
+	REQUIRE(stats[0].playCount == 1);
+	REQUIRE(stats[0].lastPlayed.has_value());
+	REQUIRE(stats[1].skipCount == 1);
+	REQUIRE_FALSE(stats[1].lastPlayed.has_value());
+	
+	// flushing nothing doesn't hurry the following event
+	{
+		Momuma::HistoryRecorder recorder(db, 16, chrono::seconds(2));
+		REQUIRE(recorder.flush(chrono::milliseconds(0)));
+		REQUIRE(recorder.record(Momuma::Database::PlayEvent {
+			.path = TEST_MEDIA[0],
+			.kind = Kind::PLAYED,
+			.time = chrono::system_clock::now(),
+			.position = chrono::microseconds(0),
+		}));
+		std::this_thread::sleep_for(chrono::milliseconds(200));
+		REQUIRE(db.get_play_history(10, history) == 2);
+		REQUIRE(recorder.flush(chrono::seconds(5)));
+	}
+	REQUIRE(db.get_play_history(10, history) == 3);
+}
+
+TEST_CASE("Transition timing", "[play, tuning]")
+{
+	auto player = make_player();
+	REQUIRE(player.set_tuning(Momuma::MpvPlayer::PlaybackTuning()) == MPV_ERROR_SUCCESS);
+	
+	// the options set before the invalid one are restored
+	Momuma::MpvPlayer::PlaybackTuning invalid;
+	invalid.gapless = Momuma::MpvPlayer::PlaybackTuning::Gapless::NO;
+	invalid.prefetchPlaylist = false;
+	invalid.demuxerMaxBytes = -1;
+	REQUIRE(player.set_tuning(invalid) != MPV_ERROR_SUCCESS);
+	REQUIRE(player.get<Momuma::Prop::GaplessAudio>().value == "weak");
+	REQUIRE(player.get<Momuma::Prop::PrefetchPlaylist>().value);
+	REQUIRE(player.set_tuning(Momuma::MpvPlayer::PlaybackTuning()) == MPV_ERROR_SUCCESS);
+	
+	std::vector<Momuma::MpvPlayer::TransitionTiming> timings;
+	player.signal_transition.connect(
+		[&timings](Momuma::MpvPlayer&, const Momuma::MpvPlayer::TransitionTiming &timing) {
+			timings.push_back(timing);
+		}
+	);
+	player.set_event_mask(player.connected_events());
+	
+	// the short media ends on its own, the seek restarts the playback without a transition
+	REQUIRE(player.set_media(TEST_MEDIA[0]) == MPV_ERROR_SUCCESS);
+	REQUIRE(player.append_media(TEST_MEDIA[1]) == MPV_ERROR_SUCCESS);
+	player.set_play(true);
+	wait_playback(player);
+	REQUIRE(player.set_position(chrono::milliseconds(500)) == MPV_ERROR_SUCCESS);
+	while (player.get_index() != 1) {
+		REQUIRE(player.wait_event(chrono::seconds(5)) != nullptr);
+	}
+	wait_playback(player);
+	
+	REQUIRE(timings.size() == 1);
+	REQUIRE(timings[0].loading >= chrono::microseconds(0));
+	REQUIRE(timings[0].starting >= chrono::microseconds(0));
+	REQUIRE(timings[0].total() < chrono::seconds(5));
+	
+	// replacing the media isn't a transition
+	REQUIRE(player.set_media(TEST_MEDIA[0]) == MPV_ERROR_SUCCESS);
+	wait_playback(player);
+	REQUIRE(timings.size() == 1);
+}
+
+TEST_CASE("Time to first audio benchmark", "[.][benchmark]")
+{
+	constexpr size_t COUNT = 100'000;
+	auto db = make_playlist_database("bench", COUNT);
+	spdlog::set_level(spdlog::level::info);
+	
+	// everything is read and queued before playback starts
+	{
+		auto player = make_player();
+		const auto start = chrono::steady_clock::now();
+		std::vector<fs::path> paths;
+		db.get_media_paths("bench", [&paths](fs::path path) {
+			paths.push_back(std::move(path));
+			return Momuma::Database::IterFlag::NEXT;
+		});
+		for (const fs::path &path : paths) {
+			(void)player.append_media(path);
+		}
+		player.set_play(true);
+		wait_playback(player);
+		const auto elapsed = chrono::steady_clock::now() - start;
+		SPDLOG_INFO("Time to first audio, read then append: {} ({:d} entries)",
+			chrono::duration_cast<chrono::milliseconds>(elapsed), COUNT
+		);
+	}
+	
+	{
+		auto player = make_player();
+		Momuma::PlaylistLoader loader(db, player);
+		const auto start = chrono::steady_clock::now();
+		REQUIRE(loader.load("bench"));
+		wait_playback(player);
+		const auto firstAudio = chrono::steady_clock::now() - start;
+		REQUIRE(loader.wait_loaded(chrono::seconds(60)));
+		const auto loaded = chrono::steady_clock::now() - start;
+		SPDLOG_INFO("Time to first audio, PlaylistLoader: {} (queue filled after {})",
+			chrono::duration_cast<chrono::milliseconds>(firstAudio),
+			chrono::duration_cast<chrono::milliseconds>(loaded)
+		);
+	}
+}
+
+TEST_CASE("Player reactor", "[reactor]")
+{
+	auto core = make_player();
+	std::deque<Momuma::MpvPlayer> players;
+	for (int i = 0; i < 8; ++i) {
+		players.push_back(core.create_client());
+		REQUIRE(players.back());
+	}
+	
+	Momuma::PlayerReactor reactor;
+	REQUIRE(reactor);
+	REQUIRE(reactor.fd() >= 0);
+	for (auto &player : players) {
+		REQUIRE(reactor.add(player));
+	}
+	REQUIRE_FALSE(reactor.add(players[0]));
+	REQUIRE(reactor.size() == players.size());
+	
+	// the replies of every player are received by the single dispatching thread
+	std::vector<Momuma::MpvRequest<Momuma::PropertyReply<bool>>> requests;
+	for (auto &player : players) {
+		requests.push_back(player.get_property_async<bool>("pause"));
+	}
+	const auto allReady = [&requests] {
+		return std::ranges::all_of(requests, [](const auto &request) { return request.ready(); });
+	};
+	for (int i = 0; i < 100 && !allReady(); ++i) {
+		REQUIRE(reactor.dispatch(chrono::seconds(1)) >= 0);
+	}
+	REQUIRE(allReady());
+	for (auto &request : requests) {
+		REQUIRE(request.get_future().get().value);
+	}
+	
+	// signals are emitted by `dispatch()`, and may remove their own player
+	bool loaded = false;
+	players[1].signal_eventFileLoaded.connect([&] {
+		loaded = true;
+		reactor.remove(players[1]);
+	});
+	REQUIRE(players[1].set_media(TEST_MEDIA[0]) == MPV_ERROR_SUCCESS);
+	for (int i = 0; i < 100 && !loaded; ++i) {
+		REQUIRE(reactor.dispatch(chrono::seconds(1)) >= 0);
+	}
+	REQUIRE(loaded);
+	REQUIRE(reactor.size() == players.size() - 1);
+	
+	reactor.remove(players[1]);
+	reactor.remove(players[2]);
+	REQUIRE(reactor.size() == players.size() - 2);
+	REQUIRE(reactor.add(players[2]));
+	
+	// destroying a player removes it, even from inside of its own signal
+	auto doomed = std::make_unique<Momuma::MpvPlayer>(core.create_client());
+	REQUIRE(reactor.add(*doomed));
+	bool destroyed = false;
+	doomed->signal_streamStarted.connect([&](Momuma::MpvPlayer&) {
+		destroyed = true;
+		doomed.reset();
+	});
+	REQUIRE(doomed->set_media(TEST_MEDIA[0]) == MPV_ERROR_SUCCESS);
+	for (int i = 0; i < 100 && !destroyed; ++i) {
+		REQUIRE(reactor.dispatch(chrono::seconds(1)) >= 0);
+	}
+	REQUIRE(destroyed);
+	REQUIRE(reactor.size() == players.size() - 1);
+	REQUIRE(reactor.dispatch(chrono::milliseconds(10)) >= 0);
+}
+
+TEST_CASE("Player reactor benchmark", "[.][benchmark]")
+{
+	// every client owns a wakeup pipe, two descriptors each
+	constexpr std::array<size_t, 4> PLAYER_COUNTS = { 1, 16, 64, 256 };
+	constexpr int ROUNDS = 100;
+	spdlog::set_level(spdlog::level::info);
+	
+	for (const size_t playerCount : PLAYER_COUNTS) {
+		auto core = make_player();
+		std::deque<Momuma::MpvPlayer> players;
+		Momuma::PlayerReactor reactor;
+		for (size_t i = 0; i < playerCount; ++i) {
+			players.push_back(core.create_client());
+			REQUIRE(reactor.add(players.back()));
+		}
+		
+		// one request in flight per player, all replies handled by this thread
+		const auto start = chrono::steady_clock::now();
+		for (int round = 0; round < ROUNDS; ++round) {
+			std::vector<Momuma::MpvRequest<Momuma::PropertyReply<bool>>> requests;
+			requests.reserve(playerCount);
+			for (auto &player : players) {
+				requests.push_back(player.get_property_async<bool>("pause"));
+			}
+			while (!std::ranges::all_of(requests, [](const auto &r) { return r.ready(); })) {
+				REQUIRE(reactor.dispatch(chrono::seconds(1)) >= 0);
+			}
+		}
+		const auto elapsed = chrono::steady_clock::now() - start;
+		SPDLOG_INFO("Player reactor, {:d} players: {} per round, {} per reply",
+			playerCount,
+			chrono::duration_cast<chrono::microseconds>(elapsed / ROUNDS),
+			chrono::duration_cast<chrono::nanoseconds>(elapsed / (ROUNDS * playerCount))
+		);
+	}
+}